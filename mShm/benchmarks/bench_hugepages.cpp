@@ -0,0 +1,80 @@
+#include <iostream>
+#include <string>
+#include <chrono>
+#include "mshm.h"
+
+// Random 8 byte reads over a large segment, with regular pages and with huge pages.
+// The reads go straight through a view so the figure is dominated by cache and TLB misses.
+
+static const char* backing_name(mshm::Backing backing)
+{
+    switch (backing)
+    {
+    case mshm::SHMEM_BACKING_HUGETLB_2M:       return "hugetlb 2M";
+    case mshm::SHMEM_BACKING_HUGETLB_1G:       return "hugetlb 1G";
+    case mshm::SHMEM_BACKING_TRANSPARENT_HUGE: return "THP";
+    default:                                   return "4K pages";
+    }
+}
+
+static void run(mshm::PageSize page_size, size_t size, uint64_t reads)
+{
+    const char* name = "mshm_bench_hugepages";
+
+    mshm::OpenOptions options;
+    options.page_size = page_size;
+
+    mshm::mshm_handle handle = nullptr;
+    mshm::Return ret = mshm::shmem_open(handle, name, size, options);
+
+    if (ret.error_code != mshm::SHMEM_OK)
+    {
+        std::cout << ret.error_string << std::endl;
+        return;
+    }
+
+    mshm::View view;
+    mshm::shmem_acquire_view(handle, view, mshm::SHMEM_VIEW_WRITE, size);
+
+    uint64_t* words = (uint64_t*)view.data;
+    const uint64_t count = size / sizeof(uint64_t);
+
+    for (uint64_t i = 0; i < count; ++i)
+    {
+        words[i] = i; // touch every page before measuring
+    }
+
+    uint64_t x = 88172645463325252ull, sum = 0;
+    auto start = std::chrono::steady_clock::now();
+
+    for (uint64_t i = 0; i < reads; ++i)
+    {
+        x ^= x << 13; x ^= x >> 7; x ^= x << 17; // xorshift
+        sum += words[x % count];
+    }
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    mshm::shmem_release_view(view);
+
+    std::cout << backing_name(mshm::shmem_backing(handle)) << "\t"
+              << (uint64_t)(reads / elapsed.count() / 1e6) << " Mreads/s\t"
+              << elapsed.count() * 1e9 / reads << " ns/read\t(" << (sum & 1) << ")" << std::endl;
+
+    mshm::shmem_close(handle);
+    mshm::shmem_delete(name);
+}
+
+int main(int argc, char** argv)
+{
+    const size_t size = (argc > 1 ? std::stoull(argv[1]) : 1024) << 20;
+    const uint64_t reads = argc > 2 ? std::stoull(argv[2]) : 50000000;
+
+    std::cout << "segment " << (size >> 20) << " MiB, " << reads << " random reads" << std::endl;
+
+    run(mshm::SHMEM_PAGE_DEFAULT, size, reads);
+    run(mshm::SHMEM_PAGE_HUGE_2M, size, reads);
+    run(mshm::SHMEM_PAGE_HUGE_1G, size, reads);
+
+    return 0;
+}
@@ -0,0 +1,414 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <benchmark/benchmark.h>
+#include "mshm.h"
+
+#ifndef _WIN32
+    #include <sys/mman.h>
+    #include <sys/wait.h>
+    #include <unistd.h>
+#endif
+
+// Latency and throughput of the read/write and open/close paths.
+// Time per iteration is ns/op, bytes_per_second is the throughput, p50/p99/p999 are
+// per-operation latencies over the samples of all threads. Only one read/write in
+// SAMPLE_EVERY is timed, so the clock reads barely weigh on ns/op; timer_ns is the cost of
+// the two clock reads every latency sample includes. For regression tracking:
+//   mshm_bench --benchmark_out=mshm_bench.json --benchmark_out_format=json
+// Peer: 0 = no one else, 1 = a thread, 2 = a forked process doing the opposite
+// operation on the same segment for the whole run.
+
+enum Peer
+{
+    PEER_NONE,
+    PEER_THREAD,
+    PEER_PROCESS
+};
+
+static const char* SEGMENT_NAME = "mshm_bench";
+
+
+// time one read/write in SAMPLE_EVERY: two clock reads cost as much as a small copy
+static const uint64_t SAMPLE_EVERY = 16;
+
+// log-linear histogram of latency samples: 64 linear buckets per power of two (1.6% error).
+// Fixed size, so recording in the timed loop never allocates
+class Latency
+{
+public:
+    Latency() : _counts(BUCKETS, 0) {}
+
+    void add(std::chrono::steady_clock::duration elapsed)
+    {
+        ++_counts[bucket((uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count())];
+        ++_total;
+    }
+
+    void merge(const Latency& other)
+    {
+        for (size_t i = 0; i < BUCKETS; ++i) _counts[i] += other._counts[i];
+        _total += other._total;
+    }
+
+    void clear()
+    {
+        std::fill(_counts.begin(), _counts.end(), 0);
+        _total = 0;
+    }
+
+    uint64_t total() const { return _total; }
+
+    // lower bound of the bucket holding the p-th sample
+    double percentile(double p) const
+    {
+        uint64_t rank = std::min(_total - 1, (uint64_t)(p * _total));
+        uint64_t seen = 0;
+
+        for (size_t i = 0; i < BUCKETS; ++i)
+        {
+            seen += _counts[i];
+
+            if (seen > rank)
+            {
+                return (double)lower_bound(i);
+            }
+        }
+
+        return 0;
+    }
+
+private:
+    static const int SUB_BITS = 6;
+    static const size_t BUCKETS = (64 - SUB_BITS + 1) << SUB_BITS;
+
+    // below 64 ns one bucket per ns, above it the top 7 significant bits
+    static size_t bucket(uint64_t ns)
+    {
+        if (ns < (1u << SUB_BITS))
+        {
+            return (size_t)ns;
+        }
+
+        int shift = 0;
+        while ((ns >> shift) >= (2u << SUB_BITS)) ++shift;
+
+        return ((size_t)(shift + 1) << SUB_BITS) + (size_t)((ns >> shift) - (1u << SUB_BITS));
+    }
+
+    static uint64_t lower_bound(size_t index)
+    {
+        size_t group = index >> SUB_BITS;
+        uint64_t sub = index & ((1u << SUB_BITS) - 1);
+
+        return group == 0 ? sub : (sub + (1u << SUB_BITS)) << (group - 1);
+    }
+
+    std::vector<uint64_t> _counts;
+    uint64_t _total = 0;
+};
+
+// samples of every thread of the running benchmark: percentiles come from the merged
+// histogram, not from an average of per-thread percentiles
+static Latency g_latency;
+static std::mutex g_latency_mutex;
+static std::atomic<int> g_latency_threads{0};
+
+// median cost of two back to back clock reads, measured once
+static double timer_overhead_ns()
+{
+    static const double overhead = []() {
+        std::vector<int64_t> samples(1001);
+
+        for (int64_t& sample : samples)
+        {
+            auto begin = std::chrono::steady_clock::now();
+            sample = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin).count();
+        }
+
+        std::nth_element(samples.begin(), samples.begin() + samples.size() / 2, samples.end());
+        return (double)samples[samples.size() / 2];
+    }();
+
+    return overhead;
+}
+
+// thread 0, before the timed loop: the loop start is a barrier, so no one merges before this
+static void latency_begin(benchmark::State& state)
+{
+    if (state.thread_index() == 0)
+    {
+        g_latency.clear();
+        g_latency_threads.store(0);
+    }
+}
+
+// every thread adds its samples, thread 0 waits for all of them and reports
+static void latency_report(benchmark::State& state, const Latency& latency)
+{
+    {
+        std::lock_guard<std::mutex> guard(g_latency_mutex);
+        g_latency.merge(latency);
+    }
+
+    g_latency_threads.fetch_add(1);
+
+    if (state.thread_index() != 0)
+    {
+        return;
+    }
+
+    while (g_latency_threads.load() < state.threads())
+    {
+        std::this_thread::yield();
+    }
+
+    if (g_latency.total() == 0)
+    {
+        return;
+    }
+
+    // set by thread 0 only: the sum over threads is this value
+    state.counters["p50_ns"] = g_latency.percentile(0.50);
+    state.counters["p99_ns"] = g_latency.percentile(0.99);
+    state.counters["p999_ns"] = g_latency.percentile(0.999);
+    state.counters["timer_ns"] = timer_overhead_ns();
+}
+
+
+// somebody else hammering the segment with writes (or reads) while the benchmark runs
+class PeerLoad
+{
+public:
+    void start(Peer kind, size_t size, bool writes)
+    {
+        _kind = kind;
+
+        if (kind == PEER_THREAD)
+        {
+            _stop_flag.store(false);
+            _thread = std::thread([this, size, writes]() { run(&_stop_flag, size, writes); });
+        }
+#ifndef _WIN32
+        else if (kind == PEER_PROCESS)
+        {
+            // the stop flag must be visible across fork
+            _shared_stop = (std::atomic<bool>*)mmap(nullptr, sizeof(std::atomic<bool>), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+            new (_shared_stop) std::atomic<bool>(false);
+
+            _child = fork();
+
+            if (_child == 0)
+            {
+                run(_shared_stop, size, writes);
+                _exit(0);
+            }
+        }
+#endif
+    }
+
+    void stop()
+    {
+        if (_kind == PEER_THREAD)
+        {
+            _stop_flag.store(true);
+            _thread.join();
+        }
+#ifndef _WIN32
+        else if (_kind == PEER_PROCESS)
+        {
+            _shared_stop->store(true);
+            waitpid(_child, nullptr, 0);
+            munmap(_shared_stop, sizeof(std::atomic<bool>));
+        }
+#endif
+        _kind = PEER_NONE;
+    }
+
+private:
+    static void run(std::atomic<bool>* stop, size_t size, bool writes)
+    {
+        mshm::mshm_handle handle = nullptr;
+        if (mshm::shmem_open(handle, SEGMENT_NAME, size).error_code != mshm::SHMEM_OK)
+        {
+            return;
+        }
+
+        std::vector<unsigned char> buffer(size, 0x5A);
+
+        while (!stop->load(std::memory_order_relaxed))
+        {
+            if (writes) mshm::shmem_write_ec(handle, buffer.data(), size);
+            else mshm::shmem_read_ec(handle, buffer.data(), size);
+        }
+
+        mshm::shmem_close(handle);
+    }
+
+    Peer _kind = PEER_NONE;
+    std::atomic<bool> _stop_flag{false};
+    std::thread _thread;
+#ifndef _WIN32
+    std::atomic<bool>* _shared_stop = nullptr;
+    pid_t _child = -1;
+#endif
+};
+
+
+static mshm::mshm_handle g_handle = nullptr;
+static PeerLoad g_peer;
+
+template<bool Write>
+static void read_write(benchmark::State& state)
+{
+    const size_t size = (size_t)state.range(0);
+    const Peer peer = (Peer)state.range(1);
+
+    // thread 0 sets up before the threads enter the timed loop together
+    if (state.thread_index() == 0)
+    {
+        mshm::shmem_open(g_handle, SEGMENT_NAME, size);
+        g_peer.start(peer, size, !Write);
+    }
+
+    latency_begin(state);
+
+    std::vector<unsigned char> buffer(size, 0xA5);
+    Latency latency;
+    uint64_t count = 0;
+
+    auto operation = [&]() {
+        return Write
+            ? mshm::shmem_write_ec(g_handle, buffer.data(), size)
+            : mshm::shmem_read_ec(g_handle, buffer.data(), size);
+    };
+
+    for (auto _ : state)
+    {
+        mshm::ErrorCode code;
+
+        if (++count % SAMPLE_EVERY == 0)
+        {
+            auto begin = std::chrono::steady_clock::now();
+            code = operation();
+            latency.add(std::chrono::steady_clock::now() - begin);
+        }
+        else
+        {
+            code = operation();
+        }
+
+        if (code != mshm::SHMEM_OK)
+        {
+            state.SkipWithError(mshm::shmem_error_string(code));
+            break;
+        }
+    }
+
+    state.SetBytesProcessed(state.iterations() * size);
+    latency_report(state, latency);
+
+    if (state.thread_index() == 0)
+    {
+        g_peer.stop();
+        mshm::shmem_close(g_handle);
+        mshm::shmem_delete(SEGMENT_NAME);
+    }
+}
+
+static void BM_Write(benchmark::State& state)
+{
+    read_write<true>(state);
+}
+
+static void BM_Read(benchmark::State& state)
+{
+    read_write<false>(state);
+}
+
+// peer != 0: the segment already exists (created by a peer thread or process), otherwise
+// every iteration creates it, maps it and deletes it
+static void BM_OpenClose(benchmark::State& state)
+{
+    const size_t size = (size_t)state.range(0);
+    const Peer peer = (Peer)state.range(1);
+    const bool attach = peer != PEER_NONE;
+
+    mshm::mshm_handle owner = nullptr;
+
+    if (attach)
+    {
+        mshm::shmem_open(owner, SEGMENT_NAME, size);
+        g_peer.start(peer, size, false);
+    }
+
+    // microseconds per open: every iteration is timed
+    latency_begin(state);
+    Latency latency;
+
+    for (auto _ : state)
+    {
+        auto begin = std::chrono::steady_clock::now();
+
+        mshm::mshm_handle handle = nullptr;
+        mshm::Return ret = mshm::shmem_open(handle, SEGMENT_NAME, size);
+        if (ret.error_code == mshm::SHMEM_OK) ret = mshm::shmem_close(handle);
+        if (!attach) mshm::shmem_delete(SEGMENT_NAME);
+
+        latency.add(std::chrono::steady_clock::now() - begin);
+
+        if (ret.error_code != mshm::SHMEM_OK)
+        {
+            state.SkipWithError(ret.error_string.c_str());
+            break;
+        }
+    }
+
+    latency_report(state, latency);
+
+    if (attach)
+    {
+        g_peer.stop();
+        mshm::shmem_close(owner);
+        mshm::shmem_delete(SEGMENT_NAME);
+    }
+}
+
+
+static void payload_sizes(benchmark::internal::Benchmark* bench)
+{
+    const int peers =
+#ifndef _WIN32
+        PEER_PROCESS;
+#else
+        PEER_THREAD;
+#endif
+
+    const int64_t sizes[] = { 8, 64, 512, 4 << 10, 32 << 10, 256 << 10, 2 << 20, 16 << 20, 64 << 20 };
+
+    for (int64_t size : sizes)
+    {
+        for (int peer = PEER_NONE; peer <= peers; ++peer)
+        {
+            bench->Args({ size, peer });
+        }
+    }
+}
+
+BENCHMARK(BM_Write)->Apply(payload_sizes)->ArgNames({ "bytes", "peer" })
+    ->Threads(1)->Threads(2)->Threads(4)->UseRealTime();
+
+BENCHMARK(BM_Read)->Apply(payload_sizes)->ArgNames({ "bytes", "peer" })
+    ->Threads(1)->Threads(2)->Threads(4)->UseRealTime();
+
+BENCHMARK(BM_OpenClose)->Args({ 4096, PEER_NONE })->Args({ 4096, PEER_THREAD })
+#ifndef _WIN32
+    ->Args({ 4096, PEER_PROCESS })
+#endif
+    ->Args({ (int64_t)64 << 20, PEER_NONE })->ArgNames({ "bytes", "peer" })->UseRealTime();
+
+BENCHMARK_MAIN();
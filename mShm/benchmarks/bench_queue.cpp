@@ -0,0 +1,169 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include "mshm.h"
+
+// Throughput of the shared memory MPMC queue against bounded rings kept in a
+// plain segment and moved with shmem_write / shmem_read, so every step takes
+// the default process-shared segment mutex (what the segment gives you today),
+// with N producers and N consumers moving 64 byte messages. A ring needs a
+// check and a copy under one lock, which shmem_write can not give: each
+// producer / consumer pair has its own ring, all behind the same mutex.
+
+struct t_msg
+{
+    uint64_t payload[8];
+};
+
+struct t_ring_index
+{
+    uint64_t head;
+    uint64_t tail;
+};
+
+class SegmentRings
+{
+public:
+    SegmentRings(mshm::mshm_handle segment, size_t rings, size_t capacity)
+        : _segment(segment), _capacity(capacity), _slots_offset(rings * sizeof(t_ring_index))
+    {
+        std::vector<t_ring_index> zero(rings, t_ring_index{0, 0});
+        mshm::shmem_write(_segment, zero.data(), zero.size() * sizeof(t_ring_index), 0);
+    }
+
+    static size_t segment_size(size_t rings, size_t capacity)
+    {
+        return rings * (sizeof(t_ring_index) + capacity * sizeof(t_msg));
+    }
+
+    bool try_push(int ring, const t_msg& msg)
+    {
+        t_ring_index index;
+        mshm::shmem_read(_segment, &index, sizeof(index), index_offset(ring));
+        if (index.head - index.tail == _capacity) return false;
+
+        // only this producer moves head: the slot is written before the consumer can see it
+        mshm::shmem_write(_segment, &msg, sizeof(msg), slot_offset(ring, index.head));
+        ++index.head;
+        mshm::shmem_write(_segment, &index.head, sizeof(index.head), index_offset(ring));
+        return true;
+    }
+
+    bool try_pop(int ring, t_msg& msg)
+    {
+        t_ring_index index;
+        mshm::shmem_read(_segment, &index, sizeof(index), index_offset(ring));
+        if (index.head == index.tail) return false;
+
+        mshm::shmem_read(_segment, &msg, sizeof(msg), slot_offset(ring, index.tail));
+        ++index.tail;
+        mshm::shmem_write(_segment, &index.tail, sizeof(index.tail), index_offset(ring) + sizeof(index.head));
+        return true;
+    }
+
+private:
+    uint64_t index_offset(int ring) const
+    {
+        return ring * sizeof(t_ring_index);
+    }
+
+    uint64_t slot_offset(int ring, uint64_t position) const
+    {
+        return _slots_offset + (ring * _capacity + position % _capacity) * sizeof(t_msg);
+    }
+
+    mshm::mshm_handle _segment;
+    size_t _capacity;
+    size_t _slots_offset;
+};
+
+template <typename Push, typename Pop>
+double run(int pairs, uint64_t per_producer, Push push, Pop pop)
+{
+    std::atomic<uint64_t> consumed{0};
+    const uint64_t total = per_producer * pairs;
+    std::vector<std::thread> threads;
+
+    auto start = std::chrono::steady_clock::now();
+
+    for (int p = 0; p < pairs; ++p)
+    {
+        threads.emplace_back([&, p]() {
+            t_msg msg{};
+            for (uint64_t i = 0; i < per_producer; ++i)
+            {
+                msg.payload[0] = i;
+                while (!push(p, msg)) std::this_thread::yield();
+            }
+        });
+
+        threads.emplace_back([&, p]() {
+            t_msg msg{};
+            while (consumed.load(std::memory_order_relaxed) < total)
+            {
+                if (pop(p, msg)) consumed.fetch_add(1, std::memory_order_relaxed);
+                else std::this_thread::yield();
+            }
+        });
+    }
+
+    for (auto& t : threads) t.join();
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return total / elapsed.count();
+}
+
+int main(int argc, char** argv)
+{
+    const uint64_t per_producer = argc > 1 ? std::stoull(argv[1]) : 1000000;
+    const int max_pairs = std::max(1u, std::thread::hardware_concurrency() / 2);
+    const char* name = "mshm_bench_queue";
+    const char* rings_name = "mshm_bench_queue_rings";
+
+    mshm::mshm_queue queue = nullptr;
+    mshm::Return ret = mshm::shmem_queue_open(queue, name, sizeof(t_msg), 4096);
+
+    if (ret.error_code != mshm::SHMEM_OK)
+    {
+        std::cout << ret.error_string << std::endl;
+        return 1;
+    }
+
+    mshm::mshm_handle segment = nullptr;
+    ret = mshm::shmem_open(segment, rings_name, SegmentRings::segment_size(max_pairs, 4096));
+
+    if (ret.error_code != mshm::SHMEM_OK)
+    {
+        std::cout << ret.error_string << std::endl;
+        mshm::shmem_queue_close(queue);
+        mshm::shmem_delete(name);
+        return 1;
+    }
+
+    std::cout << "pairs\tmpmc_queue_msg_s\tsegment_ring_msg_s" << std::endl;
+
+    for (int pairs = 1; pairs <= max_pairs; pairs *= 2)
+    {
+        double lock_free = run(pairs, per_producer,
+            [&](int, const t_msg& m) { return mshm::shmem_queue_try_enqueue(queue, &m); },
+            [&](int, t_msg& m) { return mshm::shmem_queue_try_dequeue(queue, &m); });
+
+        SegmentRings rings(segment, pairs, 4096);
+        double locked = run(pairs, per_producer,
+            [&](int p, const t_msg& m) { return rings.try_push(p, m); },
+            [&](int p, t_msg& m) { return rings.try_pop(p, m); });
+
+        std::cout << pairs << "\t" << (uint64_t)lock_free << "\t\t\t" << (uint64_t)locked << std::endl;
+    }
+
+    mshm::shmem_queue_close(queue);
+    mshm::shmem_delete(name);
+    mshm::shmem_close(segment);
+    mshm::shmem_delete(rings_name);
+
+    return 0;
+}
@@ -0,0 +1,84 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include "mshm.h"
+
+// Write throughput of N threads updating disjoint slices of one 64 MiB segment,
+// with the single segment mutex and with one lock stripe per writer slice.
+
+static double run(mshm::mshm_handle handle, int writers, size_t segment_size, size_t block, double seconds)
+{
+    std::atomic<bool> stop{false};
+    std::atomic<uint64_t> writes{0};
+    std::vector<std::thread> threads;
+    const size_t slice = segment_size / writers;
+
+    for (int w = 0; w < writers; ++w)
+    {
+        threads.emplace_back([&, w]() {
+            std::vector<unsigned char> src(block, (unsigned char)w);
+            uint64_t offset = w * slice;
+            uint64_t count = 0;
+
+            while (!stop.load(std::memory_order_relaxed))
+            {
+                mshm::shmem_write(handle, src.data(), block, offset);
+                offset += block;
+                if (offset + block > (w + 1) * slice) offset = w * slice;
+                ++count;
+            }
+
+            writes.fetch_add(count);
+        });
+    }
+
+    std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+    stop = true;
+
+    for (auto& t : threads) t.join();
+
+    return writes / seconds;
+}
+
+int main(int argc, char** argv)
+{
+    const double seconds = argc > 1 ? std::stod(argv[1]) : 1.0;
+    const size_t block = argc > 2 ? std::stoull(argv[2]) : 4096;
+    const size_t segment_size = (size_t)64 << 20;
+    const int max_writers = std::max(2u, std::thread::hardware_concurrency());
+    const char* name = "mshm_bench_stripes";
+
+    std::cout << "writers\tsingle_mutex_writes_s\tstriped_writes_s" << std::endl;
+
+    for (int writers = 1; writers <= max_writers; writers *= 2)
+    {
+        double result[2];
+
+        for (int striped = 0; striped < 2; ++striped)
+        {
+            mshm::OpenOptions options;
+            options.lock_stripes = striped ? 64 : 0;
+
+            mshm::mshm_handle handle = nullptr;
+            mshm::Return ret = mshm::shmem_open(handle, name, segment_size, options);
+
+            if (ret.error_code != mshm::SHMEM_OK)
+            {
+                std::cout << ret.error_string << std::endl;
+                return 1;
+            }
+
+            result[striped] = run(handle, writers, segment_size, block, seconds);
+
+            mshm::shmem_close(handle);
+            mshm::shmem_delete(name);
+        }
+
+        std::cout << writers << "\t" << (uint64_t)result[0] << "\t\t\t" << (uint64_t)result[1] << std::endl;
+    }
+
+    return 0;
+}
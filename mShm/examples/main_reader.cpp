@@ -37,9 +37,24 @@ int main()
         std::getline(std::cin, key);
     }
 
+    uint32_t last_seen = 0;
+
     while (true)
     {
-        ret = mshm::shmem_read(test_shm, &p_shm.cycle, sizeof(p_shm.cycle), offsetof(t_data_shm, cycle));
+        // sleep until the writer publishes something new instead of spinning on shmem_read
+        ret = mshm::shmem_wait_changed(test_shm, last_seen, 1000);
+
+        if (ret.error_code == mshm::SHMEM_ERR_TIMEOUT)
+        {
+            continue;
+        }
+
+        mshm::ErrorCode code = mshm::shmem_read_ec(test_shm, &p_shm.cycle, sizeof(p_shm.cycle), mshm::member_offset<&t_data_shm::cycle>::value);
+
+        if (code != mshm::SHMEM_OK)
+        {
+            std::cout << mshm::shmem_error_string(code) << std::endl;
+        }
 
         std::cout << p_shm.toggle << " " << p_shm.cycle << std::endl;
 
@@ -60,7 +75,7 @@ int main()
 
     ///////////////////////////////////////////
     //// CLASS VERSION
-    //mshm::SharedMemory<t_data_shm> data_shm{ "/test_class_shm" };
+    //mshm::SharedMemory<t_data_shm> data_shm{ "test_class_shm" };
     //auto retu = data_shm.open();
 
     //while (true)
@@ -69,11 +84,8 @@ int main()
 
     //    ret = data_shm.read(p_shm);
     //    std::cout << p_shm.toggle << " " << p_shm.cycle << std::endl;
-    //
-    //    p_shm.toggle = !p_shm.toggle;
-    //    p_shm.cycle++;
 
-    //    ret = data_shm.write(p_shm);
+    //    ret = data_shm.write_field<&t_data_shm::toggle>(!p_shm.toggle);
 
     //    if (key == "q")
     //    {
@@ -32,7 +32,13 @@ int main()
         p_shm.toggle = !p_shm.toggle;
         p_shm.cycle++;
         
-        ret = mshm::shmem_write(test_shm, &p_shm.cycle, sizeof(p_shm.cycle), offsetof(t_data_shm, cycle));
+        // offset and size of the field are compile-time constants (no hand-written offsetof)
+        mshm::ErrorCode code = mshm::shmem_write_ec(test_shm, &p_shm.cycle, sizeof(p_shm.cycle), mshm::member_offset<&t_data_shm::cycle>::value);
+
+        if (code != mshm::SHMEM_OK)
+        {
+            std::cout << mshm::shmem_error_string(code) << std::endl;
+        }
 
         if (key == "q")
         {
@@ -47,20 +53,17 @@ int main()
 
     /////////////////////////////////////////
     // CLASS VERSION
-    //mshm::SharedMemory<t_data_shm> data_shm{shm_name.c_str()};
+    //mshm::SharedMemory<t_data_shm> data_shm{shm_name};
     //ret = data_shm.open();
 //
     //while (true)
     //{
     //    std::getline(std::cin, key);
 //
-    //    ret = data_shm.read(p_shm);
-    //    std::cout << p_shm.toggle << " " << p_shm.cycle << std::endl;
-//
-    //    p_shm.toggle = !p_shm.toggle;
-    //    p_shm.cycle++;
+    //    p_shm.cycle = data_shm.read_field<&t_data_shm::cycle>();
+    //    std::cout << p_shm.cycle << std::endl;
 //
-    //    ret = data_shm.write(p_shm);
+    //    ret = data_shm.write_field<&t_data_shm::cycle>(p_shm.cycle + 1);
 //
     //    if (key == "q")
     //    {
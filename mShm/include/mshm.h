@@ -20,7 +20,10 @@
 
 
 #include <string>
+#include <vector>
 #include <cstdint>
+#include <type_traits>
+#include <new>
 
 namespace mshm
 {
@@ -35,7 +38,130 @@ namespace mshm
         SHMEM_ERR_NOT_OPEN,
         SHMEM_ERR_SIZE,
         SHMEM_ERR_COPY,
-        SHMEM_ERR_DELETE
+        SHMEM_ERR_DELETE,
+        SHMEM_ERR_NOT_SUPPORTED,
+        SHMEM_ERR_TIMEOUT,
+        SHMEM_ERR_OWNER_DEAD
+    };
+
+    /**
+        @brief  Synchronization used by shmem_write / shmem_read on a segment.
+                The mode is chosen by the process that creates the segment and stored
+                in the segment header: every other opener must ask for the same mode.
+    **/
+    enum SyncMode
+    {
+        SHMEM_SYNC_MUTEX,       // readers and writers take the process-shared mutex
+        SHMEM_SYNC_SEQLOCK,     // writers bump a sequence counter, readers copy optimistically and retry
+        SHMEM_SYNC_TRIPLE_BUFFER, // three copies of the data: writers fill a back copy and publish it with
+                                  // one atomic index swap, readers always get the newest complete snapshot
+        SHMEM_SYNC_RWLOCK         // process-shared reader/writer lock: readers run in parallel, a waiting
+                                  // writer blocks new readers so it can not be starved (no robust / PI policy)
+    };
+
+    /**
+        @brief  How the segment mutex behaves. Flags can be or-ed together.
+                ADAPTIVE:      spin for a while before sleeping in the kernel
+                ROBUST:        if the holder dies, the next locker gets the lock back and
+                               the call returns SHMEM_ERR_OWNER_DEAD (operation done, but the
+                               data the dead process was writing may be partial)
+                PRIO_INHERIT:  the holder inherits the priority of the waiters (SCHED_FIFO loops)
+                Like the sync mode, the policy is stored in the segment header.
+    **/
+    enum LockPolicy
+    {
+        SHMEM_LOCK_DEFAULT      = 0,
+        SHMEM_LOCK_ADAPTIVE     = 1 << 0,
+        SHMEM_LOCK_ROBUST       = 1 << 1,
+        SHMEM_LOCK_PRIO_INHERIT = 1 << 2
+    };
+
+    /**
+        @brief  Page size backing a segment. Huge pages cut TLB misses on big, randomly
+                accessed segments. The segment is placed on a hugetlbfs mount with that
+                page size when one is available (and has free pages); otherwise it stays in
+                /dev/shm, 2 MiB aligned and advised for transparent huge pages.
+                shmem_backing tells what was actually obtained. Like the sync mode, the page
+                size is stored in the segment header: every opener must ask for the same one.
+    **/
+    enum PageSize
+    {
+        SHMEM_PAGE_DEFAULT,
+        SHMEM_PAGE_HUGE_2M,
+        SHMEM_PAGE_HUGE_1G
+    };
+
+    enum Backing
+    {
+        SHMEM_BACKING_PAGES,            // regular pages
+        SHMEM_BACKING_HUGETLB_2M,       // hugetlbfs, 2 MiB pages
+        SHMEM_BACKING_HUGETLB_1G,       // hugetlbfs, 1 GiB pages
+        SHMEM_BACKING_TRANSPARENT_HUGE  // /dev/shm advised with MADV_HUGEPAGE
+    };
+
+    /**
+        @brief  Per-process prefaulting, so the first real read / write runs at steady-state
+                latency instead of taking a page fault per page. Flags can be or-ed together.
+                POPULATE:       map with MAP_POPULATE
+                LOCK:           mlock the whole segment (faults it in and pins it)
+                LOCK_ON_FAULT:  pin pages as they are touched (MLOCK_ONFAULT), without faulting them in
+                PARALLEL:       fault the segment in from prefault_threads threads (useful for GBs)
+                Pinning may need CAP_IPC_LOCK or a larger RLIMIT_MEMLOCK: shmem_open fails if denied.
+    **/
+    enum Prefault
+    {
+        SHMEM_PREFAULT_NONE          = 0,
+        SHMEM_PREFAULT_POPULATE      = 1 << 0,
+        SHMEM_PREFAULT_LOCK          = 1 << 1,
+        SHMEM_PREFAULT_LOCK_ON_FAULT = 1 << 2,
+        SHMEM_PREFAULT_PARALLEL      = 1 << 3
+    };
+
+    /**
+        @brief  Where the pages of a new segment are placed on multi-socket machines.
+                BIND:         all pages on numa_node
+                INTERLEAVE:   pages spread round-robin over every allowed node
+                FIRST_TOUCH:  each page on the node of the first process touching it
+                              (let the readers fault it in, e.g. with SHMEM_PREFAULT_PARALLEL)
+                Set by the creator, the policy holds for every process mapping the segment.
+                On a single-node machine it is a no-op.
+    **/
+    enum NumaPolicy
+    {
+        SHMEM_NUMA_DEFAULT,
+        SHMEM_NUMA_BIND,
+        SHMEM_NUMA_INTERLEAVE,
+        SHMEM_NUMA_FIRST_TOUCH
+    };
+
+    struct OpenOptions
+    {
+        SyncMode     sync_mode = SHMEM_SYNC_MUTEX;
+        unsigned int lock_policy = SHMEM_LOCK_DEFAULT;  // LockPolicy flags
+        int          lock_timeout_ms = -1;              // bounded wait on the mutex (SHMEM_ERR_TIMEOUT), -1 = forever
+        PageSize     page_size = SHMEM_PAGE_DEFAULT;
+        unsigned int prefault = SHMEM_PREFAULT_NONE;    // Prefault flags, apply to this opener only
+        unsigned int prefault_threads = 0;              // SHMEM_PREFAULT_PARALLEL threads, 0 = one per core
+        NumaPolicy   numa_policy = SHMEM_NUMA_DEFAULT;
+        int          numa_node = 0;                     // SHMEM_NUMA_BIND target node
+        /**
+            @brief  Lock striping (SHMEM_SYNC_MUTEX only), 0 = one mutex for the whole segment.
+                    With lock_stripes = N the data is split in N equal blocks of
+                    ceil(size / N) bytes rounded up to a cache line, each with its own mutex
+                    and write counter, so writers of disjoint regions do not contend.
+                    Every block must start inside the data, else shmem_open returns
+                    SHMEM_ERR_PARAM. An operation locks the stripes its range touches, in
+                    address order; shmem_writev / shmem_readv lock the stripes from the first
+                    to the last fragment. Every stripe follows the segment lock policy.
+                    The count is stored in the segment header and must match on every open.
+                    Writers still share the block versions (dirty_block_size) and the stats
+                    counters, when enabled.
+        **/
+        unsigned int lock_stripes = 0;
+        size_t       dirty_block_size = 0;              // > 0: keep a version per block for shmem_read_changed
+        bool         stats = false;                     // keep shmem_stats counters (set by the creator)
+        size_t       max_size = 0;                      // > 0: shmem_resize can grow the data up to max_size
+        const char*  persist_dir = nullptr;             // != nullptr: the segment is the file <persist_dir>/<name>
     };
 
     struct Return
@@ -46,66 +172,594 @@ namespace mshm
 
     typedef void* mshm_handle;
 
-    MSHMAPI Return shmem_open(mshm_handle& handle, const char* name, size_t size);
+    MSHMAPI Return shmem_open(mshm_handle& handle, const char* name, size_t size, const OpenOptions& options = OpenOptions());
 
     MSHMAPI Return shmem_close(mshm_handle handle);
 
+    MSHMAPI Backing shmem_backing(mshm_handle handle);
+
+    /**
+        @brief  Grow a segment created with OpenOptions::max_size while it is in use.
+                The file is grown under the segment lock and a generation in the header is
+                bumped: every other handle maps the new tail on its next operation. Data is
+                never copied and the segment never moves (address space up to max_size is
+                reserved at open), so views and readers in flight are not disturbed.
+                Segments only grow. Attaching never resizes a segment: asking shmem_open for
+                more than its current size fails with SHMEM_ERR_SIZE.
+                Not available with stripes, dirty blocks, triple buffer or huge pages.
+    **/
+    MSHMAPI Return shmem_resize(mshm_handle handle, size_t size);
+
+    // current data size seen by this handle (follows shmem_resize), 0 if not open
+    MSHMAPI size_t shmem_size(mshm_handle handle);
+
+    /**
+        @brief  Create a segment with no name (memfd), shared only by passing its file
+                descriptor over a unix socket with shmem_send_fd / shmem_receive_fd.
+                It goes away with the last descriptor or mapping. Same options as
+                shmem_open, except huge pages. Linux only.
+    **/
+    MSHMAPI Return shmem_create_anonymous(mshm_handle& handle, size_t size, const OpenOptions& options = OpenOptions());
+
+    // send the segment descriptor over a connected AF_UNIX socket (SCM_RIGHTS)
+    MSHMAPI Return shmem_send_fd(mshm_handle handle, int socket);
+
+    // receive a segment sent with shmem_send_fd and map it: a sealed segment is mapped read only
+    MSHMAPI Return shmem_receive_fd(mshm_handle& handle, int socket);
+
+    /**
+        @brief  Make an anonymous segment immutable (F_SEAL_WRITE, F_SEAL_GROW, F_SEAL_SHRINK).
+                Reads of a sealed segment take no lock and a read view needs no validation;
+                writes, write views and shmem_resize fail with SHMEM_ERR_NOT_SUPPORTED.
+                The kernel refuses the seal while any other handle maps the segment writable
+                (SHMEM_ERR_MMAP): seal before sending the descriptor, or after every receiver
+                closed. The handle is remapped: release its views first.
+    **/
+    MSHMAPI Return shmem_seal(mshm_handle handle);
+
+    /**
+        @brief  Push the pages of [offset, offset + size) to the backing file (msync), size 0 =
+                up to the end. async only schedules the write back.
+                File-backed segments (OpenOptions::persist_dir): every flush keeps writers out
+                while it records a checksum of the whole data in the header; a synchronous flush
+                of the whole segment also writes every page to the disk before they get back in.
+                When a process opens the file and no other handle has it open (a restart, also
+                after a crash or a reboot), the data is kept if it still matches the last
+                recorded checksum: locks are initialized again and shmem_restored tells the
+                caller. Otherwise the segment starts again from zeroes, as a new one. After a
+                process crash any flush is enough; after a reboot only pages that reached the
+                disk count, so a ranged or async flush may leave an image that no longer matches.
+                The last handle to close the file flushes it this way. Remove the file to drop
+                the image; huge pages are not available.
+    **/
+    MSHMAPI Return shmem_flush(mshm_handle handle, uint64_t offset = 0, size_t size = 0, bool async = false);
+
+    // true if this handle reattached to the consistent image a previous run left in the file
+    MSHMAPI bool shmem_restored(mshm_handle handle);
+
+    // number of resident pages of the segment on each NUMA node (index = node)
+    MSHMAPI Return shmem_numa_residency(mshm_handle handle, std::vector<size_t>& pages_per_node);
+
     MSHMAPI Return shmem_write(mshm_handle shm, const void* src, size_t size, uint64_t offset = 0);
 
     MSHMAPI Return shmem_read(mshm_handle shm, void* dst, size_t size, uint64_t offset = 0);
 
+    /**
+        @brief  Scatter write: copies every fragment under a single lock acquisition and
+                publishes them as one update (readers never see only part of them).
+                All entries are validated first: on error nothing is written.
+    **/
+    struct WriteEntry
+    {
+        const void* src;
+        size_t      size;
+        uint64_t    offset;
+    };
+
+    MSHMAPI Return shmem_writev(mshm_handle shm, const WriteEntry* entries, size_t count);
+
+    /**
+        @brief  Gather read: bounds are checked once, then every fragment is copied from the
+                same snapshot (one critical section, or one seqlock/triple buffer retry loop).
+                generation is the number of writes the snapshot includes, so two reads
+                returning the same generation saw identical data.
+    **/
+    struct ReadEntry
+    {
+        void*       dst;
+        size_t      size;
+        uint64_t    offset;
+    };
+
+    MSHMAPI Return shmem_readv(mshm_handle shm, const ReadEntry* entries, size_t count, uint64_t& generation);
+
+    /**
+        @brief  Incremental sync for segments opened with dirty_block_size (mutex, rwlock or
+                seqlock mode). Every write stamps the blocks it covers with its generation;
+                shmem_read_changed copies into dst (a full image of the data, data size bytes)
+                only the blocks written after version, then sets version to the generation dst
+                is now up to date with. Start from version 0 and a zeroed dst.
+    **/
+    MSHMAPI Return shmem_read_changed(mshm_handle shm, void* dst, uint64_t& version);
+
     MSHMAPI Return shmem_delete(const char* name);
 
-    //template <typename T>
-    //class SharedMemory
-    //{
-    //public:
-    //    explicit SharedMemory(const std::string& name)
-    //        : _name(name), _mshm(nullptr)
-    //    {
-    //    }
-
-    //    ~SharedMemory()
-    //    {
-    //        close();
-    //        shmem_delete(_name.c_str());
-    //    }
-
-    //    Return open()
-    //    {
-    //        return _status = shmem_open(&_mshm, _name.c_str(), sizeof(T));
-    //    }
-
-    //    Return close()
-    //    {
-    //        return _status = shmem_close(_mshm);
-    //    }
-
-    //    Return write(const T& src)
-    //    {
-    //        return _status = shmem_write(_mshm, &src, sizeof(T));
-    //    }
-
-    //    Return read(T& dst)
-    //    {
-    //        return _status = shmem_read(_mshm, &dst, sizeof(T));
-    //    }
-
-    //    Return status()
-    //    {
-    //        return _status;
-    //    }
-
-    //    std::string name()
-    //    {
-    //        return _name;
-    //    }
-
-    //private:
-    //    Return      _status;
-    //    std::string _name;
-    //    mshm_handle _mshm;
-    //};
+    /**
+        @brief  Sleep until the segment is written, instead of polling with shmem_read.
+                Every write bumps the segment generation (shmem_readv): the call returns as
+                soon as its low 32 bits differ from last_seen and stores the new value in it.
+                Spins for up to spin_us microseconds before going to sleep on the kernel
+                (trade CPU for wake-up latency), then waits up to timeout_ms (-1 = forever).
+                Returns SHMEM_ERR_TIMEOUT if nothing was written in time. On a sealed segment
+                it compares the generation once and returns at once: nothing can change it.
+    **/
+    MSHMAPI Return shmem_wait_changed(mshm_handle shm, uint32_t& last_seen, int timeout_ms = -1, unsigned int spin_us = 0);
+
+    /**
+        @brief  Counters kept in the segment header when the creator opened it with
+                OpenOptions::stats, shared by every process: any handle (e.g. a monitor)
+                can take a snapshot without locking. Reads and writes count the read / write
+                calls (plain and scatter / gather); lock counters cover every lock taken on the
+                segment, stripes and views included. Without stats the hot path pays one branch
+                and shmem_stats returns SHMEM_ERR_NOT_SUPPORTED.
+    **/
+    struct Stats
+    {
+        uint64_t reads = 0;
+        uint64_t writes = 0;
+        uint64_t bytes_read = 0;
+        uint64_t bytes_written = 0;
+        uint64_t lock_acquisitions = 0;
+        uint64_t contended_acquisitions = 0;    // the lock was busy and we had to wait
+        uint64_t lock_wait_ns = 0;              // total time spent waiting on busy locks
+        uint64_t max_lock_hold_ns = 0;          // longest read / write critical section
+    };
+
+    MSHMAPI Return shmem_stats(mshm_handle shm, Stats& stats);
+
+    /**
+        @brief  Zero-copy access: a view points straight into the mapped segment.
+                A write view (and a read view on a mutex segment) holds the segment
+                mutex until shmem_release_view, so keep it short and release it from
+                the same thread. A read view on a seqlock or triple buffer segment takes no lock:
+                shmem_release_view returns SHMEM_ERR_COPY if a writer got in meanwhile,
+                in which case whatever was parsed from the view must be discarded.
+    **/
+    enum ViewMode
+    {
+        SHMEM_VIEW_READ,
+        SHMEM_VIEW_WRITE
+    };
+
+    struct View
+    {
+        void*       data = nullptr;
+        size_t      size = 0;
+        ViewMode    mode = SHMEM_VIEW_READ;
+        uint64_t    sequence = 0;
+        mshm_handle shm = nullptr;
+    };
+
+    MSHMAPI Return shmem_acquire_view(mshm_handle shm, View& view, ViewMode mode, size_t size, uint64_t offset = 0);
+
+    MSHMAPI Return shmem_release_view(View& view);
+
+    /**
+        @brief  Hot path API: the same operations, noexcept and free of heap allocations,
+                returning only the ErrorCode. shmem_error_string gives the message of a code
+                from a static table. The Return functions above wrap these.
+    **/
+    MSHMAPI const char* shmem_error_string(ErrorCode code) noexcept;
+
+    MSHMAPI ErrorCode shmem_write_ec(mshm_handle shm, const void* src, size_t size, uint64_t offset = 0) noexcept;
+
+    MSHMAPI ErrorCode shmem_read_ec(mshm_handle shm, void* dst, size_t size, uint64_t offset = 0) noexcept;
+
+    MSHMAPI ErrorCode shmem_writev_ec(mshm_handle shm, const WriteEntry* entries, size_t count) noexcept;
+
+    MSHMAPI ErrorCode shmem_readv_ec(mshm_handle shm, const ReadEntry* entries, size_t count, uint64_t& generation) noexcept;
+
+    MSHMAPI ErrorCode shmem_read_changed_ec(mshm_handle shm, void* dst, uint64_t& version) noexcept;
+
+    MSHMAPI ErrorCode shmem_acquire_view_ec(mshm_handle shm, View& view, ViewMode mode, size_t size, uint64_t offset = 0) noexcept;
+
+    MSHMAPI ErrorCode shmem_release_view_ec(View& view) noexcept;
+
+    /**
+        @brief  shmem_write_ec / shmem_read_ec without the handle, pointer and bounds checks,
+                for callers that validated them once (SharedMemory<T> at open): the handle
+                must be open and [offset, offset + size) inside the data.
+    **/
+    MSHMAPI ErrorCode shmem_write_unchecked_ec(mshm_handle shm, const void* src, size_t size, uint64_t offset) noexcept;
+
+    MSHMAPI ErrorCode shmem_read_unchecked_ec(mshm_handle shm, void* dst, size_t size, uint64_t offset) noexcept;
+
+    /**
+        @brief  Single-producer / single-consumer channel of fixed-size messages.
+                The ring lives in a segment opened with shmem_open, so it is named,
+                created and deleted (shmem_delete) like any other shmem.
+                Capacity must be a power of two. Push and pop never block and never
+                take a lock: they return how many messages were actually moved.
+    **/
+    typedef void* mshm_channel;
+
+    MSHMAPI Return shmem_channel_open(mshm_channel& channel, const char* name, size_t msg_size, size_t capacity);
+
+    MSHMAPI Return shmem_channel_close(mshm_channel channel);
+
+    MSHMAPI bool shmem_channel_push(mshm_channel channel, const void* msg);
+
+    MSHMAPI bool shmem_channel_pop(mshm_channel channel, void* msg);
+
+    MSHMAPI size_t shmem_channel_push_batch(mshm_channel channel, const void* msgs, size_t count);
+
+    MSHMAPI size_t shmem_channel_pop_batch(mshm_channel channel, void* msgs, size_t max_count);
+
+    MSHMAPI size_t shmem_channel_size(mshm_channel channel);
+
+    /**
+        @brief  Multi-producer / multi-consumer bounded queue of fixed-size messages.
+                Every slot carries its own sequence number (Vyukov queue), so producers
+                and consumers only contend on the slot they claim, never on a global lock.
+                The try_ variants never wait; the others back off (spin, yield, sleep)
+                until they succeed or timeout_ms expires (-1 = wait forever).
+    **/
+    typedef void* mshm_queue;
+
+    MSHMAPI Return shmem_queue_open(mshm_queue& queue, const char* name, size_t msg_size, size_t capacity);
+
+    MSHMAPI Return shmem_queue_close(mshm_queue queue);
+
+    MSHMAPI bool shmem_queue_try_enqueue(mshm_queue queue, const void* msg);
+
+    MSHMAPI bool shmem_queue_try_dequeue(mshm_queue queue, void* msg);
+
+    MSHMAPI bool shmem_queue_enqueue(mshm_queue queue, const void* msg, int timeout_ms = -1);
+
+    MSHMAPI bool shmem_queue_dequeue(mshm_queue queue, void* msg, int timeout_ms = -1);
+
+    /**
+        @brief  One writer / many readers broadcast ring of variable-length records.
+                The writer never waits: it overwrites the oldest records, and every record
+                gets a sequence number (from 1). Each reader keeps its own cursor in its
+                handle and never writes to the segment; a handle starts at the newest
+                record published when it was opened. A reader that was lapped gets
+                SHMEM_BROADCAST_LAPPED and continues from the newest record: the gap shows
+                in the sequence numbers. Capacity (bytes) must be a power of two; a record
+                carries at most shmem_broadcast_max_size bytes. Only one writer at a time.
+    **/
+    typedef void* mshm_broadcast;
+
+    enum BroadcastResult
+    {
+        SHMEM_BROADCAST_RECORD,     // a record was copied: size and sequence are set
+        SHMEM_BROADCAST_EMPTY,      // the reader is up to date
+        SHMEM_BROADCAST_LAPPED      // records were overwritten before being read
+    };
+
+    MSHMAPI Return shmem_broadcast_open(mshm_broadcast& broadcast, const char* name, size_t capacity);
+
+    MSHMAPI Return shmem_broadcast_close(mshm_broadcast broadcast);
+
+    MSHMAPI size_t shmem_broadcast_max_size(mshm_broadcast broadcast);
+
+    // sequence number of the record, 0 if size exceeds shmem_broadcast_max_size
+    MSHMAPI uint64_t shmem_broadcast_publish(mshm_broadcast broadcast, const void* msg, size_t size);
+
+    // copies at most max_size bytes, size is the full record size
+    MSHMAPI BroadcastResult shmem_broadcast_receive(mshm_broadcast broadcast, void* dst, size_t max_size, size_t& size, uint64_t& sequence);
+
+    // bytes published and not yet read by this handle
+    MSHMAPI uint64_t shmem_broadcast_pending(mshm_broadcast broadcast);
+
+    /**
+        @brief  Allocator for variable-size objects inside a segment opened with shmem_open.
+                Blocks are handed out from power-of-two size classes (16 B and up, 16 byte
+                aligned); each class keeps a lock-free free list, fresh blocks come from a
+                shared bump pointer. Blocks are addressed by offset (0 = null), valid in every
+                process whatever address the segment is mapped at: shmem_arena_ptr turns an
+                offset into a local pointer. The root slot lets processes find the first
+                object. shmem_arena_alloc returns 0 when the arena is exhausted.
+    **/
+    typedef void* mshm_arena;
+
+    MSHMAPI Return shmem_arena_open(mshm_arena& arena, const char* name, size_t size);
+
+    MSHMAPI Return shmem_arena_close(mshm_arena arena);
+
+    MSHMAPI uint64_t shmem_arena_alloc(mshm_arena arena, size_t size) noexcept;
+
+    MSHMAPI void shmem_arena_free(mshm_arena arena, uint64_t offset) noexcept;
+
+    MSHMAPI void* shmem_arena_ptr(mshm_arena arena, uint64_t offset) noexcept;
+
+    MSHMAPI uint64_t shmem_arena_offset(mshm_arena arena, const void* ptr) noexcept;
+
+    MSHMAPI void shmem_arena_set_root(mshm_arena arena, uint64_t offset) noexcept;
+
+    MSHMAPI uint64_t shmem_arena_root(mshm_arena arena) noexcept;
+
+    /**
+        @brief  Open-addressing hash map of fixed-size keys and values in a named segment.
+                Keys are key_size raw bytes (pad strings), capacity is a power of two and never
+                grows. Lookups take no lock: every bucket has a version counter that readers
+                check around their copy, so a get costs a couple of cache lines. Writers lock
+                one of 64 stripes chosen by the key hash, then the single bucket they change.
+                Erased buckets become tombstones: put returns false once no bucket is left.
+    **/
+    typedef void* mshm_map;
+
+    MSHMAPI Return shmem_map_open(mshm_map& map, const char* name, size_t key_size, size_t value_size, size_t capacity);
+
+    MSHMAPI Return shmem_map_close(mshm_map map);
+
+    MSHMAPI bool shmem_map_put(mshm_map map, const void* key, const void* value);
+
+    MSHMAPI bool shmem_map_get(mshm_map map, const void* key, void* value);
+
+    MSHMAPI bool shmem_map_erase(mshm_map map, const void* key);
+
+    MSHMAPI size_t shmem_map_size(mshm_map map);
+
+    /**
+        @brief  std::allocator compatible front end of an arena, e.g.
+                    std::vector<int, mshm::ArenaAllocator<int>> v{ mshm::ArenaAllocator<int>(arena) };
+                The elements live in the segment. Standard containers keep raw pointers in
+                their own object: share their content through offsets (or map the segment at
+                the same address), not by placing the container object itself in the segment.
+    **/
+    template <typename T>
+    class ArenaAllocator
+    {
+    public:
+        using value_type = T;
+
+        explicit ArenaAllocator(mshm_arena arena) noexcept
+            : _arena(arena)
+        {
+        }
+
+        template <typename U>
+        ArenaAllocator(const ArenaAllocator<U>& other) noexcept
+            : _arena(other.arena())
+        {
+        }
+
+        T* allocate(size_t n)
+        {
+            uint64_t offset = n > SIZE_MAX / sizeof(T) ? 0 : shmem_arena_alloc(_arena, n * sizeof(T));
+
+            if (offset == 0)
+            {
+                throw std::bad_alloc();
+            }
+
+            return static_cast<T*>(shmem_arena_ptr(_arena, offset));
+        }
+
+        void deallocate(T* ptr, size_t) noexcept
+        {
+            shmem_arena_free(_arena, shmem_arena_offset(_arena, ptr));
+        }
+
+        mshm_arena arena() const noexcept
+        {
+            return _arena;
+        }
+
+        template <typename U>
+        bool operator==(const ArenaAllocator<U>& other) const noexcept
+        {
+            return _arena == other.arena();
+        }
+
+        template <typename U>
+        bool operator!=(const ArenaAllocator<U>& other) const noexcept
+        {
+            return _arena != other.arena();
+        }
+
+    private:
+        mshm_arena _arena;
+    };
+
+    /**
+        @brief  Typed access to a segment holding one T. T is copied with memcpy, so it must be
+                trivially copyable. Fields are addressed by member pointer:
+                    data_shm.write_field<&t_data_shm::cycle>(42);
+                    int cycle = data_shm.read_field<&t_data_shm::cycle>();
+                offset and size of the field are compile-time constants (field_offset) and the
+                accessors use the noexcept ErrorCode API. open() checks once that the segment
+                holds a whole T, so field accesses skip the per-call bounds checks. Reads and
+                writes go through the path of the sync mode chosen in options (seqlock / triple
+                buffer reads never lock). read_field stores its result in status(); both
+                return SHMEM_ERR_NOT_OPEN before open().
+                The destructor closes the segment and deletes its name.
+    **/
+    template <auto Member>
+    struct member_traits;
+
+    template <typename C, typename F, F C::* Member>
+    struct member_traits<Member>
+    {
+        using owner = C;
+        using type = F;
+    };
+
+    /**
+        @brief  offsetof for a member pointer, as a constant expression: the field address is
+                matched against the bytes of a union overlaying the owner (only addresses are
+                compared, nothing is read). Candidates step by the field alignment, in 4 KiB
+                rounds so that each loop stays within the compiler constexpr loop limit.
+    **/
+    template <auto Member>
+    struct member_offset
+    {
+        using owner = typename member_traits<Member>::owner;
+        using type = typename member_traits<Member>::type;
+
+        union probe_t
+        {
+            unsigned char bytes[sizeof(owner)];
+            owner object;
+
+            constexpr probe_t() : bytes{} {}
+        };
+
+        static constexpr probe_t probe{};
+
+        static constexpr size_t find() noexcept
+        {
+            const void* field = &(probe.object.*Member);
+
+            for (size_t base = 0; base < sizeof(owner); base += 4096)
+            {
+                for (size_t i = base; i < base + 4096 && i < sizeof(owner); i += alignof(type))
+                {
+                    if (static_cast<const void*>(&probe.bytes[i]) == field)
+                    {
+                        return i;
+                    }
+                }
+            }
+
+            return sizeof(owner);
+        }
+
+        static constexpr size_t value = find();
+
+        static_assert(value + sizeof(type) <= sizeof(owner), "Member offset not found");
+    };
+
+    template <typename T>
+    class SharedMemory
+    {
+        static_assert(std::is_trivially_copyable<T>::value, "SharedMemory<T> copies T with memcpy: T must be trivially copyable");
+
+    public:
+        template <auto Member>
+        using field_type = typename member_traits<Member>::type;
+
+        explicit SharedMemory(const std::string& name, const OpenOptions& options = OpenOptions())
+            : _name(name), _options(options), _mshm(nullptr)
+        {
+        }
+
+        SharedMemory(const SharedMemory&) = delete;
+        SharedMemory& operator=(const SharedMemory&) = delete;
+
+        ~SharedMemory()
+        {
+            close();
+            shmem_delete(_name.c_str());
+        }
+
+        Return open()
+        {
+            Return ret = keep(shmem_open(_mshm, _name.c_str(), sizeof(T), _options));
+
+            // the only bounds check of the field accessors: segments never shrink
+            if (ret.error_code == SHMEM_OK && shmem_size(_mshm) < sizeof(T))
+            {
+                shmem_close(_mshm);
+                _mshm = nullptr;
+                ret = keep(Return{ SHMEM_ERR_SIZE, "Shared memory is smaller than T" });
+            }
+
+            return ret;
+        }
+
+        Return close()
+        {
+            if (_mshm == nullptr)
+            {
+                return status();
+            }
+
+            Return ret = keep(shmem_close(_mshm));
+
+            if (ret.error_code == SHMEM_OK)
+            {
+                _mshm = nullptr;
+            }
+
+            return ret;
+        }
+
+        Return write(const T& src)
+        {
+            return keep(shmem_write(_mshm, &src, sizeof(T)));
+        }
+
+        Return read(T& dst)
+        {
+            return keep(shmem_read(_mshm, &dst, sizeof(T)));
+        }
+
+        template <auto Member>
+        ErrorCode write_field(const field_type<Member>& value) noexcept
+        {
+            static_assert(std::is_same<typename member_traits<Member>::owner, T>::value, "Member does not belong to T");
+            constexpr size_t offset = field_offset<Member>();
+
+            if (_mshm == nullptr)
+            {
+                return _code = SHMEM_ERR_NOT_OPEN;
+            }
+
+            return _code = shmem_write_unchecked_ec(_mshm, &value, sizeof(field_type<Member>), offset);
+        }
+
+        template <auto Member>
+        field_type<Member> read_field() noexcept
+        {
+            static_assert(std::is_same<typename member_traits<Member>::owner, T>::value, "Member does not belong to T");
+            constexpr size_t offset = field_offset<Member>();
+            field_type<Member> value{};
+
+            if (_mshm == nullptr)
+            {
+                _code = SHMEM_ERR_NOT_OPEN;
+                return value;
+            }
+
+            _code = shmem_read_unchecked_ec(_mshm, &value, sizeof(field_type<Member>), offset);
+            return value;
+        }
+
+        Return status()
+        {
+            return Return{ _code, shmem_error_string(_code) };
+        }
+
+        std::string name()
+        {
+            return _name;
+        }
+
+        mshm_handle handle()
+        {
+            return _mshm;
+        }
+
+    private:
+        template <auto Member>
+        static constexpr size_t field_offset() noexcept
+        {
+            return member_offset<Member>::value;
+        }
+
+        Return keep(const Return& ret)
+        {
+            _code = ret.error_code;
+            return ret;
+        }
+
+        ErrorCode   _code = SHMEM_OK;
+        std::string _name;
+        OpenOptions _options;
+        mshm_handle _mshm;
+    };
 }
 
 #endif
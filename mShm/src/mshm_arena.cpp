@@ -0,0 +1,284 @@
+#include "mshm.h"
+#include "mshm_internal.h"
+
+#include <atomic>
+
+
+using namespace mshm;
+
+static const uint32_t ARENA_READY = 0x4d534841; // "MSHA"
+static const uint32_t BLOCK_MAGIC = 0x424c4b21; // "BLK!"
+static const uint32_t ARENA_CLASSES = 40;       // 16 B .. 8 TiB
+static const size_t MIN_BLOCK = 16;
+
+struct block_header_t
+{
+    uint32_t size_class;                       // blocco di 16 << size_class byte, header compreso
+    uint32_t magic;
+    std::atomic<uint64_t> next;                // lista libera: offset del blocco successivo
+};
+
+struct alignas(64) free_list_t
+{
+    std::atomic<uint64_t> head;                // (tag << 32) | offset / 16, tag contro ABA
+};
+
+struct arena_header_t
+{
+    alignas(64) std::atomic<uint64_t> top;     // primo byte mai allocato (offset dall'inizio del segmento)
+    alignas(64) std::atomic<uint64_t> root;    // offset dell'oggetto radice, 0 = nessuno
+    alignas(64) std::atomic<uint32_t> ready;   // scritto dal creatore quando i campi sotto sono validi
+    uint64_t size;
+    free_list_t free_lists[ARENA_CLASSES];
+    alignas(64) unsigned char heap[];
+};
+
+static_assert(sizeof(block_header_t) == MIN_BLOCK, "payloads must stay 16 byte aligned");
+
+struct t_arena_handle
+{
+    mshm_handle segment = nullptr;
+    arena_header_t* arena = nullptr;
+    unsigned char* base = nullptr;
+    size_t size = 0;
+};
+
+
+// offsets count from the start of the segment: 0 falls in the header, so it can mean null
+static inline block_header_t* block_at(t_arena_handle* a, uint64_t offset)
+{
+    return (block_header_t*)(a->base + offset);
+}
+
+// ARENA_CLASSES when no class fits: checked before the loop, size + header must not wrap
+static inline uint32_t size_class(size_t size)
+{
+    const size_t max_block = MIN_BLOCK << (ARENA_CLASSES - 1);
+
+    if (size > max_block - sizeof(block_header_t))
+    {
+        return ARENA_CLASSES;
+    }
+
+    uint32_t c = 0;
+    size_t block = MIN_BLOCK;
+
+    while (block < size + sizeof(block_header_t))
+    {
+        block <<= 1;
+        ++c;
+    }
+
+    return c;
+}
+
+static bool pop_free(t_arena_handle* a, uint32_t c, uint64_t& offset)
+{
+    std::atomic<uint64_t>& head = a->arena->free_lists[c].head;
+    uint64_t old_head = head.load(std::memory_order_acquire);
+
+    for (;;)
+    {
+        uint64_t top = (old_head & 0xffffffffu) * MIN_BLOCK;
+
+        if (top == 0)
+        {
+            return false;
+        }
+
+        // the block may be popped by someone else meanwhile: the tag makes the CAS fail then
+        uint64_t next = block_at(a, top)->next.load(std::memory_order_relaxed);
+        uint64_t new_head = ((old_head >> 32) + 1) << 32 | next / MIN_BLOCK;
+
+        if (head.compare_exchange_weak(old_head, new_head, std::memory_order_acquire, std::memory_order_acquire))
+        {
+            offset = top;
+            return true;
+        }
+    }
+}
+
+static void push_free(t_arena_handle* a, uint32_t c, uint64_t offset)
+{
+    std::atomic<uint64_t>& head = a->arena->free_lists[c].head;
+    uint64_t old_head = head.load(std::memory_order_relaxed);
+
+    for (;;)
+    {
+        block_at(a, offset)->next.store((old_head & 0xffffffffu) * MIN_BLOCK, std::memory_order_relaxed);
+        uint64_t new_head = ((old_head >> 32) + 1) << 32 | offset / MIN_BLOCK;
+
+        if (head.compare_exchange_weak(old_head, new_head, std::memory_order_release, std::memory_order_relaxed))
+        {
+            return;
+        }
+    }
+}
+
+
+Return mshm::shmem_arena_open(mshm_arena& arena, const char* name, size_t size)
+{
+    Return ret;
+    arena = nullptr;
+
+    // free list heads keep offsets in 32 bits of 16 byte units
+    if (size == 0 || size > ((uint64_t)1 << 32) * MIN_BLOCK - sizeof(arena_header_t))
+    {
+        ret.error_code = SHMEM_ERR_PARAM;
+        ret.error_string = "Arena size must be grater then 0 and below 64 GiB";
+        return ret;
+    }
+
+    size_t total_size = sizeof(arena_header_t) + size;
+
+    mshm_handle segment = nullptr;
+    arena_header_t* header = nullptr;
+    ret = internal::open_structure(segment, header, name, total_size, &arena_header_t::ready, ARENA_READY,
+                                   "Arena", "Arena was created with a different size");
+
+    if (ret.error_code != SHMEM_OK)
+    {
+        return ret;
+    }
+
+    if (internal::segment_created(segment))
+    {
+        header->size = size;
+        header->top.store(sizeof(arena_header_t), std::memory_order_relaxed);
+        header->ready.store(ARENA_READY, std::memory_order_release);
+    }
+    else if (header->size != size)
+    {
+        shmem_close(segment);
+        ret.error_code = SHMEM_ERR_PARAM;
+        ret.error_string = "Arena was created with a different size";
+        return ret;
+    }
+
+    t_arena_handle* handle = new t_arena_handle();
+    handle->segment = segment;
+    handle->arena = header;
+    handle->base = (unsigned char*)header;
+    handle->size = total_size;
+
+    arena = handle;
+
+    return ret;
+}
+
+
+Return mshm::shmem_arena_close(mshm_arena arena)
+{
+    Return ret;
+
+    if (arena == nullptr)
+    {
+        ret.error_code = SHMEM_ERR_NOT_OPEN;
+        ret.error_string = "Handle is NULL";
+        return ret;
+    }
+
+    t_arena_handle* handle = (t_arena_handle*)(arena);
+
+    ret = shmem_close(handle->segment);
+
+    if (ret.error_code != SHMEM_OK)
+    {
+        return ret;
+    }
+
+    delete handle;
+
+    return ret;
+}
+
+
+uint64_t mshm::shmem_arena_alloc(mshm_arena arena, size_t size) noexcept
+{
+    t_arena_handle* a = (t_arena_handle*)(arena);
+    uint32_t c = size_class(size);
+
+    if (c >= ARENA_CLASSES)
+    {
+        return 0;
+    }
+
+    uint64_t offset = 0;
+
+    if (!pop_free(a, c, offset))
+    {
+        // carve a fresh block, never past the end of the segment
+        uint64_t block = MIN_BLOCK << c;
+        uint64_t top = a->arena->top.load(std::memory_order_relaxed);
+
+        do
+        {
+            if (top + block > a->size)
+            {
+                return 0;
+            }
+        }
+        while (!a->arena->top.compare_exchange_weak(top, top + block, std::memory_order_relaxed));
+
+        offset = top;
+
+        block_header_t* header = block_at(a, offset);
+        header->size_class = c;
+        header->magic = BLOCK_MAGIC;
+    }
+
+    return offset + sizeof(block_header_t);
+}
+
+
+void mshm::shmem_arena_free(mshm_arena arena, uint64_t offset) noexcept
+{
+    t_arena_handle* a = (t_arena_handle*)(arena);
+
+    if (offset < sizeof(arena_header_t) + sizeof(block_header_t) || offset >= a->size)
+    {
+        return;
+    }
+
+    uint64_t block = offset - sizeof(block_header_t);
+    block_header_t* header = block_at(a, block);
+
+    if (header->magic != BLOCK_MAGIC || header->size_class >= ARENA_CLASSES)
+    {
+        return; // not a block of this arena
+    }
+
+    push_free(a, header->size_class, block);
+}
+
+
+void* mshm::shmem_arena_ptr(mshm_arena arena, uint64_t offset) noexcept
+{
+    t_arena_handle* a = (t_arena_handle*)(arena);
+
+    return offset == 0 ? nullptr : a->base + offset;
+}
+
+
+uint64_t mshm::shmem_arena_offset(mshm_arena arena, const void* ptr) noexcept
+{
+    t_arena_handle* a = (t_arena_handle*)(arena);
+
+    return ptr == nullptr ? 0 : (uint64_t)((const unsigned char*)ptr - a->base);
+}
+
+
+void mshm::shmem_arena_set_root(mshm_arena arena, uint64_t offset) noexcept
+{
+    t_arena_handle* a = (t_arena_handle*)(arena);
+
+    a->arena->root.store(offset, std::memory_order_release);
+}
+
+
+uint64_t mshm::shmem_arena_root(mshm_arena arena) noexcept
+{
+    t_arena_handle* a = (t_arena_handle*)(arena);
+
+    return a->arena->root.load(std::memory_order_acquire);
+}
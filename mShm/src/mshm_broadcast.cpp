@@ -0,0 +1,237 @@
+#include "mshm.h"
+#include "mshm_internal.h"
+
+#include <string.h>
+#include <atomic>
+
+
+using namespace mshm;
+
+static const uint32_t BROADCAST_READY = 0x4d534842; // "MSHB"
+
+static const uint32_t RECORD_DATA = 1;
+static const uint32_t RECORD_PADDING = 2;
+
+struct record_header_t
+{
+    uint32_t length;                          // header + payload, multiplo di sizeof(record_header_t)
+    uint32_t type;                            // RECORD_DATA o RECORD_PADDING (fino alla fine del ring)
+    uint64_t sequence;                        // numero del record, da 1
+    uint64_t size;                            // byte di payload
+    uint64_t reserved;
+};
+
+struct broadcast_header_t
+{
+    alignas(64) std::atomic<uint64_t> tail_intent; // fine del record in scrittura: i byte prima di tail_intent - capacity sono persi
+    alignas(64) std::atomic<uint64_t> tail;        // fine dell'ultimo record pubblicato
+    uint64_t next_sequence;                        // solo writer
+    alignas(64) std::atomic<uint32_t> ready;       // scritto dal creatore quando i campi sotto sono validi
+    uint64_t capacity;
+    alignas(64) unsigned char records[];
+};
+
+struct t_broadcast_handle
+{
+    mshm_handle segment = nullptr;
+    broadcast_header_t* ring = nullptr;
+    uint64_t capacity = 0;
+    uint64_t mask = 0;
+    uint64_t cursor = 0;                      // posizione del prossimo record da leggere (privata)
+};
+
+
+static inline size_t record_length(size_t size)
+{
+    // whole headers: the space left before the end of the ring always fits a padding record
+    return (sizeof(record_header_t) * 2 + size - 1) / sizeof(record_header_t) * sizeof(record_header_t);
+}
+
+
+Return mshm::shmem_broadcast_open(mshm_broadcast& broadcast, const char* name, size_t capacity)
+{
+    Return ret;
+    broadcast = nullptr;
+
+    if (capacity < 2 * sizeof(record_header_t) || (capacity & (capacity - 1)) != 0)
+    {
+        ret.error_code = SHMEM_ERR_PARAM;
+        ret.error_string = "Capacity must be a power of two of at least 64 bytes";
+        return ret;
+    }
+
+    if (capacity > SIZE_MAX - sizeof(broadcast_header_t))
+    {
+        ret.error_code = SHMEM_ERR_PARAM;
+        ret.error_string = "Broadcast ring size is too big";
+        return ret;
+    }
+
+    size_t total_size = sizeof(broadcast_header_t) + capacity;
+
+    mshm_handle segment = nullptr;
+    broadcast_header_t* ring = nullptr;
+    ret = internal::open_structure(segment, ring, name, total_size, &broadcast_header_t::ready, BROADCAST_READY,
+                                   "Broadcast ring", "Broadcast ring was created with a different capacity");
+
+    if (ret.error_code != SHMEM_OK)
+    {
+        return ret;
+    }
+
+    if (internal::segment_created(segment))
+    {
+        ring->next_sequence = 1;
+        ring->capacity = capacity;
+        ring->ready.store(BROADCAST_READY, std::memory_order_release);
+    }
+    else if (ring->capacity != capacity)
+    {
+        shmem_close(segment);
+        ret.error_code = SHMEM_ERR_PARAM;
+        ret.error_string = "Broadcast ring was created with a different capacity";
+        return ret;
+    }
+
+    t_broadcast_handle* handle = new t_broadcast_handle();
+    handle->segment = segment;
+    handle->ring = ring;
+    handle->capacity = capacity;
+    handle->mask = capacity - 1;
+    handle->cursor = ring->tail.load(std::memory_order_acquire);
+
+    broadcast = handle;
+
+    return ret;
+}
+
+
+Return mshm::shmem_broadcast_close(mshm_broadcast broadcast)
+{
+    Return ret;
+
+    if (broadcast == nullptr)
+    {
+        ret.error_code = SHMEM_ERR_NOT_OPEN;
+        ret.error_string = "Handle is NULL";
+        return ret;
+    }
+
+    t_broadcast_handle* handle = (t_broadcast_handle*)(broadcast);
+
+    ret = shmem_close(handle->segment);
+
+    if (ret.error_code != SHMEM_OK)
+    {
+        return ret;
+    }
+
+    delete handle;
+
+    return ret;
+}
+
+
+size_t mshm::shmem_broadcast_max_size(mshm_broadcast broadcast)
+{
+    t_broadcast_handle* bc = (t_broadcast_handle*)(broadcast);
+
+    // a record never takes more than half the ring, so the padding before it can not overlap it
+    return bc->capacity / 2 - sizeof(record_header_t);
+}
+
+
+uint64_t mshm::shmem_broadcast_publish(mshm_broadcast broadcast, const void* msg, size_t size)
+{
+    t_broadcast_handle* bc = (t_broadcast_handle*)(broadcast);
+    broadcast_header_t* ring = bc->ring;
+
+    if (size > shmem_broadcast_max_size(broadcast) || (msg == nullptr && size != 0))
+    {
+        return 0;
+    }
+
+    uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+    size_t length = record_length(size);
+    size_t index = tail & bc->mask;
+    size_t to_end = bc->capacity - index;
+    size_t padding = length > to_end ? to_end : 0;
+
+    // announce the bytes about to be overwritten before touching them (seqlock write side)
+    ring->tail_intent.store(tail + padding + length, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    if (padding != 0)
+    {
+        record_header_t pad = { (uint32_t)padding, RECORD_PADDING, 0, 0, 0 };
+        memcpy(&ring->records[index], &pad, sizeof(pad));
+        index = 0;
+    }
+
+    uint64_t sequence = ring->next_sequence++;
+    record_header_t header = { (uint32_t)length, RECORD_DATA, sequence, size, 0 };
+    memcpy(&ring->records[index], &header, sizeof(header));
+    if (size != 0) memcpy(&ring->records[index + sizeof(header)], msg, size);
+
+    ring->tail.store(tail + padding + length, std::memory_order_release);
+
+    return sequence;
+}
+
+
+BroadcastResult mshm::shmem_broadcast_receive(mshm_broadcast broadcast, void* dst, size_t max_size, size_t& size, uint64_t& sequence)
+{
+    t_broadcast_handle* bc = (t_broadcast_handle*)(broadcast);
+    broadcast_header_t* ring = bc->ring;
+
+    for (;;)
+    {
+        uint64_t tail = ring->tail.load(std::memory_order_acquire);
+
+        if (bc->cursor == tail)
+        {
+            return SHMEM_BROADCAST_EMPTY;
+        }
+
+        size_t index = bc->cursor & bc->mask;
+        record_header_t header;
+        memcpy(&header, &ring->records[index], sizeof(header));
+
+        bool valid = header.length >= sizeof(record_header_t) && header.length <= bc->capacity - index
+            && header.length % sizeof(record_header_t) == 0
+            && (header.type == RECORD_PADDING || header.size <= header.length - sizeof(record_header_t));
+
+        size_t copied = 0;
+
+        if (valid && header.type == RECORD_DATA)
+        {
+            copied = header.size < max_size ? (size_t)header.size : max_size;
+            if (copied != 0) memcpy(dst, &ring->records[index + sizeof(header)], copied);
+        }
+
+        // the writer announced it reached our bytes: whatever we copied may be torn
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (ring->tail_intent.load(std::memory_order_relaxed) - bc->cursor > bc->capacity || !valid)
+        {
+            bc->cursor = tail;
+            return SHMEM_BROADCAST_LAPPED;
+        }
+
+        bc->cursor += header.length;
+
+        if (header.type == RECORD_DATA)
+        {
+            size = (size_t)header.size;
+            sequence = header.sequence;
+            return SHMEM_BROADCAST_RECORD;
+        }
+    }
+}
+
+
+uint64_t mshm::shmem_broadcast_pending(mshm_broadcast broadcast)
+{
+    t_broadcast_handle* bc = (t_broadcast_handle*)(broadcast);
+
+    return bc->ring->tail.load(std::memory_order_acquire) - bc->cursor;
+}
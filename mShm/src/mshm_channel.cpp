@@ -0,0 +1,255 @@
+#include "mshm.h"
+#include "mshm_internal.h"
+
+#include <string.h>
+#include <atomic>
+
+
+using namespace mshm;
+
+static const uint32_t CHANNEL_READY = 0x4d534843; // "MSHC"
+
+struct channel_header_t
+{
+    alignas(64) std::atomic<uint64_t> head;   // prossimo slot da scrivere (solo producer)
+    alignas(64) std::atomic<uint64_t> tail;   // prossimo slot da leggere (solo consumer)
+    alignas(64) std::atomic<uint32_t> ready;  // scritto dal creatore quando i campi sotto sono validi
+    uint64_t msg_size;
+    uint64_t capacity;
+    alignas(64) unsigned char slots[];
+};
+
+struct t_channel_handle
+{
+    mshm_handle segment = nullptr;
+    channel_header_t* ring = nullptr;
+    size_t msg_size = 0;
+    uint64_t capacity = 0;
+    uint64_t mask = 0;
+    alignas(64) uint64_t tail_cache = 0;      // ultima tail vista dal producer
+    alignas(64) uint64_t head_cache = 0;      // ultima head vista dal consumer
+};
+
+
+static void copy_in(t_channel_handle* ch, uint64_t pos, const unsigned char* src, size_t count)
+{
+    size_t index = pos & ch->mask;
+    size_t first = count < ch->capacity - index ? count : ch->capacity - index;
+
+    memcpy(&ch->ring->slots[index * ch->msg_size], src, first * ch->msg_size);
+
+    if (count > first)
+    {
+        memcpy(ch->ring->slots, src + first * ch->msg_size, (count - first) * ch->msg_size);
+    }
+}
+
+static void copy_out(t_channel_handle* ch, uint64_t pos, unsigned char* dst, size_t count)
+{
+    size_t index = pos & ch->mask;
+    size_t first = count < ch->capacity - index ? count : ch->capacity - index;
+
+    memcpy(dst, &ch->ring->slots[index * ch->msg_size], first * ch->msg_size);
+
+    if (count > first)
+    {
+        memcpy(dst + first * ch->msg_size, ch->ring->slots, (count - first) * ch->msg_size);
+    }
+}
+
+
+Return mshm::shmem_channel_open(mshm_channel& channel, const char* name, size_t msg_size, size_t capacity)
+{
+    Return ret;
+    channel = nullptr;
+
+    if (msg_size == 0 || capacity == 0 || (capacity & (capacity - 1)) != 0)
+    {
+        ret.error_code = SHMEM_ERR_PARAM;
+        ret.error_string = "Message size must be grater then 0 and capacity a power of two";
+        return ret;
+    }
+
+    if (capacity > (SIZE_MAX - sizeof(channel_header_t)) / msg_size)
+    {
+        ret.error_code = SHMEM_ERR_PARAM;
+        ret.error_string = "Channel size is too big";
+        return ret;
+    }
+
+    size_t total_size = sizeof(channel_header_t) + msg_size * capacity;
+
+    mshm_handle segment = nullptr;
+    channel_header_t* ring = nullptr;
+    ret = internal::open_structure(segment, ring, name, total_size, &channel_header_t::ready, CHANNEL_READY,
+                                   "Channel", "Channel was created with a different message size or capacity");
+
+    if (ret.error_code != SHMEM_OK)
+    {
+        return ret;
+    }
+
+    if (internal::segment_created(segment))
+    {
+        ring->msg_size = msg_size;
+        ring->capacity = capacity;
+        ring->ready.store(CHANNEL_READY, std::memory_order_release);
+    }
+    else if (ring->msg_size != msg_size || ring->capacity != capacity)
+    {
+        shmem_close(segment);
+        ret.error_code = SHMEM_ERR_PARAM;
+        ret.error_string = "Channel was created with a different message size or capacity";
+        return ret;
+    }
+
+    t_channel_handle* handle = new t_channel_handle();
+    handle->segment = segment;
+    handle->ring = ring;
+    handle->msg_size = msg_size;
+    handle->capacity = capacity;
+    handle->mask = capacity - 1;
+    handle->tail_cache = ring->tail.load(std::memory_order_acquire);
+    handle->head_cache = ring->head.load(std::memory_order_acquire);
+
+    channel = handle;
+
+    return ret;
+}
+
+
+Return mshm::shmem_channel_close(mshm_channel channel)
+{
+    Return ret;
+
+    if (channel == nullptr)
+    {
+        ret.error_code = SHMEM_ERR_NOT_OPEN;
+        ret.error_string = "Handle is NULL";
+        return ret;
+    }
+
+    t_channel_handle* handle = (t_channel_handle*)(channel);
+
+    ret = shmem_close(handle->segment);
+
+    if (ret.error_code != SHMEM_OK)
+    {
+        return ret;
+    }
+
+    delete handle;
+
+    return ret;
+}
+
+
+bool mshm::shmem_channel_push(mshm_channel channel, const void* msg)
+{
+    t_channel_handle* ch = (t_channel_handle*)(channel);
+
+    uint64_t head = ch->ring->head.load(std::memory_order_relaxed);
+
+    if (head - ch->tail_cache == ch->capacity)
+    {
+        ch->tail_cache = ch->ring->tail.load(std::memory_order_acquire);
+
+        if (head - ch->tail_cache == ch->capacity)
+        {
+            return false; // full
+        }
+    }
+
+    memcpy(&ch->ring->slots[(head & ch->mask) * ch->msg_size], msg, ch->msg_size);
+    ch->ring->head.store(head + 1, std::memory_order_release);
+
+    return true;
+}
+
+
+bool mshm::shmem_channel_pop(mshm_channel channel, void* msg)
+{
+    t_channel_handle* ch = (t_channel_handle*)(channel);
+
+    uint64_t tail = ch->ring->tail.load(std::memory_order_relaxed);
+
+    if (tail == ch->head_cache)
+    {
+        ch->head_cache = ch->ring->head.load(std::memory_order_acquire);
+
+        if (tail == ch->head_cache)
+        {
+            return false; // empty
+        }
+    }
+
+    memcpy(msg, &ch->ring->slots[(tail & ch->mask) * ch->msg_size], ch->msg_size);
+    ch->ring->tail.store(tail + 1, std::memory_order_release);
+
+    return true;
+}
+
+
+size_t mshm::shmem_channel_push_batch(mshm_channel channel, const void* msgs, size_t count)
+{
+    t_channel_handle* ch = (t_channel_handle*)(channel);
+
+    uint64_t head = ch->ring->head.load(std::memory_order_relaxed);
+    uint64_t free_slots = ch->capacity - (head - ch->tail_cache);
+
+    if (free_slots < count)
+    {
+        ch->tail_cache = ch->ring->tail.load(std::memory_order_acquire);
+        free_slots = ch->capacity - (head - ch->tail_cache);
+    }
+
+    size_t n = count < free_slots ? count : (size_t)free_slots;
+
+    if (n == 0)
+    {
+        return 0;
+    }
+
+    copy_in(ch, head, (const unsigned char*)msgs, n);
+    ch->ring->head.store(head + n, std::memory_order_release);
+
+    return n;
+}
+
+
+size_t mshm::shmem_channel_pop_batch(mshm_channel channel, void* msgs, size_t max_count)
+{
+    t_channel_handle* ch = (t_channel_handle*)(channel);
+
+    uint64_t tail = ch->ring->tail.load(std::memory_order_relaxed);
+    uint64_t available = ch->head_cache - tail;
+
+    if (available < max_count)
+    {
+        ch->head_cache = ch->ring->head.load(std::memory_order_acquire);
+        available = ch->head_cache - tail;
+    }
+
+    size_t n = max_count < available ? max_count : (size_t)available;
+
+    if (n == 0)
+    {
+        return 0;
+    }
+
+    copy_out(ch, tail, (unsigned char*)msgs, n);
+    ch->ring->tail.store(tail + n, std::memory_order_release);
+
+    return n;
+}
+
+
+size_t mshm::shmem_channel_size(mshm_channel channel)
+{
+    t_channel_handle* ch = (t_channel_handle*)(channel);
+
+    uint64_t tail = ch->ring->tail.load(std::memory_order_acquire);
+    uint64_t head = ch->ring->head.load(std::memory_order_acquire);
+
+    return (size_t)(head - tail);
+}
@@ -0,0 +1,35 @@
+#include "mshm.h"
+
+
+using namespace mshm;
+
+// indexed by ErrorCode
+static const char* const error_strings[] =
+{
+    "No Error",
+    "Invalid parameter: null pointer, unknown option or size plus offset exceeding the shmem size",
+    "Shared memory can not be opened",
+    "Shared memory can not be resized",
+    "Shared memory can not be mapped",
+    "Mutex error: dead lock, not owned, not recoverable or not initialized",
+    "Handle is NULL or shared memory is not open",
+    "Wrong size",
+    "Data was written while the view was held, read it again",
+    "Shared memory can not be deleted",
+    "Not supported on this platform or segment",
+    "Timeout expired waiting for the lock",
+    "Previous mutex owner died while holding it: data may be partially written"
+};
+
+static_assert(sizeof(error_strings) / sizeof(error_strings[0]) == SHMEM_ERR_OWNER_DEAD + 1, "one message per ErrorCode");
+
+
+const char* mshm::shmem_error_string(ErrorCode code) noexcept
+{
+    if ((unsigned int)code >= sizeof(error_strings) / sizeof(error_strings[0]))
+    {
+        return "Unknown error";
+    }
+
+    return error_strings[code];
+}
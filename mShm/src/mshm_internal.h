@@ -0,0 +1,153 @@
+/**
+    @file      mshm_internal.h
+    @brief     Platform hooks shared by the structures built on top of a segment
+    @details   Implemented by mshm_linux.cpp / mshm_win.cpp, never installed
+    @author    Marco Pellizzoni
+**/
+
+#ifndef SHMEM_INTERNAL_H
+#define SHMEM_INTERNAL_H
+
+#include "mshm.h"
+
+#include <atomic>
+#include <cstddef>
+#include <chrono>
+#include <string>
+#include <thread>
+
+#if defined(_MSC_VER)
+    #include <intrin.h>
+#endif
+
+namespace mshm
+{
+namespace internal
+{
+    // first byte of the user data region (64 byte aligned)
+    unsigned char* segment_data(mshm_handle mshm);
+
+    // size of the user data region
+    size_t segment_size(mshm_handle mshm);
+
+    // true if this handle created the segment (and found it zeroed)
+    bool segment_created(mshm_handle mshm);
+
+    // Return API on top of the ErrorCode one
+    inline Return make_return(ErrorCode code)
+    {
+        return Return{ code, shmem_error_string(code) };
+    }
+
+    // open the segment of a structure built on top of shmem_open. A creator gets the zeroed header
+    // to fill in before it stores magic into ready; an attacher gets it once the creator did, in a
+    // segment of exactly total_size. what names the structure in the errors, mismatch explains
+    // an attach with a different layout. On failure the segment is closed and segment is nullptr
+    template <typename Header>
+    Return open_structure(mshm_handle& segment, Header*& header, const char* name, size_t total_size,
+                          std::atomic<uint32_t> Header::* ready, uint32_t magic, const char* what, const char* mismatch)
+    {
+        segment = nullptr;
+        header = nullptr;
+
+        Return ret = shmem_open(segment, name, total_size);
+
+        // attaching never grows a segment: a smaller one was created with a smaller layout
+        if (ret.error_code == SHMEM_ERR_SIZE)
+        {
+            ret.error_code = SHMEM_ERR_PARAM;
+            ret.error_string = mismatch;
+        }
+
+        if (ret.error_code != SHMEM_OK)
+        {
+            return ret;
+        }
+
+        header = (Header*)segment_data(segment);
+
+        if (segment_created(segment))
+        {
+            return ret;
+        }
+
+        // the creator may still be filling the header
+        for (int i = 0; i < 1000 && (header->*ready).load(std::memory_order_acquire) != magic; ++i)
+        {
+            std::this_thread::yield();
+        }
+
+        if ((header->*ready).load(std::memory_order_acquire) != magic)
+        {
+            ret.error_code = SHMEM_ERR_NOT_OPEN;
+            ret.error_string = std::string(what) + " was not initialized by its creator";
+        }
+        else if (segment_size(segment) != total_size)
+        {
+            ret.error_code = SHMEM_ERR_PARAM;
+            ret.error_string = mismatch;
+        }
+
+        if (ret.error_code != SHMEM_OK)
+        {
+            shmem_close(segment);
+            segment = nullptr;
+            header = nullptr;
+        }
+
+        return ret;
+    }
+
+    inline void cpu_relax()
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#elif defined(__aarch64__)
+        asm volatile("yield");
+#elif defined(_MSC_VER)
+        _mm_pause();
+#endif
+    }
+
+    // spin, then yield, then sleep: used by the blocking variants of the lock-free structures
+    class Backoff
+    {
+    public:
+        explicit Backoff(int timeout_ms)
+            : _infinite(timeout_ms < 0),
+              _deadline(std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms < 0 ? 0 : timeout_ms))
+        {
+        }
+
+        // false once the timeout is expired
+        bool pause()
+        {
+            if (_spins < 64)
+            {
+                ++_spins;
+                cpu_relax();
+                return true;
+            }
+
+            if (_spins < 128)
+            {
+                ++_spins;
+                std::this_thread::yield();
+            }
+            else
+            {
+                std::this_thread::sleep_for(std::chrono::microseconds(50));
+            }
+
+            return _infinite || std::chrono::steady_clock::now() < _deadline;
+        }
+
+    private:
+        bool _infinite;
+        std::chrono::steady_clock::time_point _deadline;
+        int _spins = 0;
+    };
+}
+}
+
+#endif
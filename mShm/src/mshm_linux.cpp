@@ -1,23 +1,90 @@
 ﻿#include "mshm.h"
+#include "mshm_internal.h"
 
 #include <fcntl.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <linux/mempolicy.h>
+#include <time.h>
 
 #include <unistd.h>
 #include <string.h>
 #include <pthread.h>
 #include <errno.h>
 #include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 
 
 using namespace mshm;
 
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "shared atomics must be lock free to work across processes");
+
+static const uint32_t SEGMENT_READY = 0x4d53484d; // "MSHM"
+
+// how long an attacher waits for the creator to finish the header
+static const int READY_TIMEOUT_MS = 2000;
+
+// lookups of shmem_open racing with creators before giving up
+static const int OPEN_ATTEMPTS = 100;
+
+// contatori per shmem_stats, aggiornati solo se stats_enabled
+struct stats_block_t
+{
+    alignas(64) std::atomic<uint64_t> reads;
+    std::atomic<uint64_t> writes;
+    std::atomic<uint64_t> bytes_read;
+    std::atomic<uint64_t> bytes_written;
+    alignas(64) std::atomic<uint64_t> lock_acquisitions;
+    std::atomic<uint64_t> contended_acquisitions;
+    std::atomic<uint64_t> lock_wait_ns;
+    std::atomic<uint64_t> max_lock_hold_ns;
+};
+
 struct shmem_internal_t
 {
+    std::atomic<uint32_t> ready; // SEGMENT_READY quando chi ha creato la shmem ha finito di inizializzarla
     pthread_mutex_t mutex;     // mutex salvato nella memoria condivisa ad esso associato
+    pthread_rwlock_t rwlock;   // lock lettori/scrittori per SHMEM_SYNC_RWLOCK
+    uint32_t sync_mode;        // SyncMode scelto da chi ha creato la shmem
+    uint32_t lock_policy;      // flag LockPolicy usati per inizializzare il mutex
+    uint32_t page_size;        // PageSize chiesto da chi ha creato la shmem
+    uint32_t backing;          // Backing ottenuto da chi ha creato la shmem
+    int32_t lock_timeout_ms;   // attesa massima sul mutex, -1 = infinita
+    uint32_t lock_stripes;     // numero di mutex a strisce dopo i dati, 0 = solo mutex
+    uint64_t stripe_size;      // byte di dati coperti da ogni striscia
+    uint64_t dirty_block_size; // byte per versione di blocco (shmem_read_changed), 0 = disabilitato
+    uint32_t stats_enabled;    // scelto da chi ha creato la shmem: aggiorna stats
+    uint64_t max_size;         // shmem_resize: dimensione massima dati, 0 = non ridimensionabile
+    std::atomic<uint64_t> size_generation; // incrementato da shmem_resize dopo aver scritto data_size
+    uint64_t image_magic;      // file persistente: IMAGE_MAGIC se image_checksum descrive un'immagine completa
+    uint64_t image_header_size; // sizeof(shmem_internal_t) di chi ha scritto l'immagine
+    uint64_t image_checksum;   // checksum dei dati all'ultimo shmem_flush completo
+    alignas(64) std::atomic<uint64_t> sequence; // seqlock: dispari = scrittura in corso, /2 = generazione
+    alignas(64) std::atomic<uint32_t> latest;   // triple buffer: indice dell'ultimo snapshot completo
+    std::atomic<uint64_t> buffer_sequence[3];   // triple buffer: seqlock di ogni copia
+    std::atomic<uint64_t> buffer_generation[3]; // triple buffer: generazione contenuta in ogni copia
+    alignas(64) std::atomic<uint32_t> changes;  // futex: incrementato ad ogni scrittura
+    std::atomic<uint32_t> waiters;              // processi in attesa su changes
     size_t data_size;          // dimensione massima dati
-    unsigned char data[];      // buffer variabile
+    stats_block_t stats;       // contatori di shmem_stats
+    alignas(64) unsigned char data[]; // buffer variabile
+};
+
+// one mutex per cache line, so neighbouring stripes do not false share
+struct alignas(64) lock_stripe_t
+{
+    pthread_mutex_t mutex;
+    std::atomic<uint64_t> generation;  // scritture completate che iniziano su questa striscia
 };
 
 struct t_shmem_handle
@@ -25,38 +92,69 @@ struct t_shmem_handle
     shmem_internal_t* shm = nullptr;
     int h_fd = -1;
     size_t total_size = 0;
+    size_t reserved_size = 0;                        // address space kept after the mapping for shmem_resize
+    std::atomic<size_t> data_size{0};                // data mapped by this handle (<= shm->data_size)
+    std::atomic<uint64_t> size_generation{UINT64_MAX}; // shm->size_generation data_size was read at
+    pthread_mutex_t resize_mutex = PTHREAD_MUTEX_INITIALIZER; // threads sharing the handle grow the mapping once
+    bool created = false;
+    bool sealed = false;                             // read-only mapping of a sealed memfd: reads take no lock
+    bool persistent = false;                         // regular file under OpenOptions::persist_dir
+    bool restored = false;                           // opened on the image a previous run flushed
+    Backing backing = SHMEM_BACKING_PAGES;
 };
 
-Return check_handle(mshm_handle mshm)
+// stripe geometry: the block size is a cache line multiple, the stripes follow the data
+static inline size_t stripe_size(size_t data_size, unsigned int stripes)
 {
-    Return ret;
-    ret.error_code = SHMEM_OK;
-    ret.error_string = "No Error";
+    size_t block = (data_size + stripes - 1) / stripes;
+    return (block + 63) & ~(size_t)63;
+}
+
+static inline lock_stripe_t* stripe_at(t_shmem_handle* handle, uint32_t index)
+{
+    size_t data_end = (handle->shm->data_size + 63) & ~(size_t)63;
+    return (lock_stripe_t*)&handle->shm->data[data_end] + index;
+}
+
+static inline size_t dirty_blocks(size_t data_size, size_t block_size)
+{
+    return block_size ? (data_size + block_size - 1) / block_size : 0;
+}
+
+// per-block versions follow the stripes: the generation of the last write touching the block
+static inline std::atomic<uint64_t>* dirty_at(t_shmem_handle* handle, size_t index)
+{
+    size_t data_end = (handle->shm->data_size + 63) & ~(size_t)63;
+    lock_stripe_t* stripes_end = (lock_stripe_t*)&handle->shm->data[data_end] + handle->shm->lock_stripes;
+    return (std::atomic<uint64_t>*)stripes_end + index;
+}
 
+// size of one copy of the data in triple buffer mode (cache line multiple)
+static inline size_t buffer_stride(size_t data_size)
+{
+    return (data_size + 63) & ~(size_t)63;
+}
+
+static inline ErrorCode check_handle_ec(mshm_handle mshm) noexcept
+{
     if (mshm == nullptr)
     {
-        ret.error_code = SHMEM_ERR_NOT_OPEN;
-        ret.error_string = "Handel is NULL";
-        return ret;
+        return SHMEM_ERR_NOT_OPEN;
     }
 
     t_shmem_handle* handle = (t_shmem_handle*)(mshm);
 
-    if (handle->shm == nullptr)
+    if (handle->shm == nullptr || handle->h_fd == -1)
     {
-        ret.error_code = SHMEM_ERR_NOT_OPEN;
-        ret.error_string = "Shmem pointer is null";
-        return ret;
+        return SHMEM_ERR_NOT_OPEN;
     }
 
-    if (handle->h_fd == -1)
-    {
-        ret.error_code = SHMEM_ERR_NOT_OPEN;
-        ret.error_string = "File descriptor is not valid";
-        return ret;
-    }
+    return SHMEM_OK;
+}
 
-    return ret;
+Return check_handle(mshm_handle mshm)
+{
+    return internal::make_return(check_handle_ec(mshm));
 }
 
 
@@ -90,265 +188,3211 @@ bool is_valid_shm_name(const std::string& name, std::string* error = nullptr)
 }
 
 
+static const size_t HUGE_PAGE_2M = (size_t)2 << 20;
+static const size_t HUGE_PAGE_1G = (size_t)1 << 30;
 
-Return mshm::shmem_open(mshm_handle& mshm, const char* name, size_t user_data_size)
+static size_t huge_page_size(PageSize page_size)
 {
-    Return ret;
-
-    std::string name_error_description;
-
-    if(!is_valid_shm_name(name, &name_error_description))
+    switch (page_size)
     {
-        mshm = nullptr;
-        ret.error_code = SHMEM_ERR_PARAM;
-        ret.error_string = name_error_description;
-        return ret;
+    case SHMEM_PAGE_HUGE_2M: return HUGE_PAGE_2M;
+    case SHMEM_PAGE_HUGE_1G: return HUGE_PAGE_1G;
+    default:                 return 0;
     }
+}
 
-    if (user_data_size <= 0)
+// mount point of a hugetlbfs serving pages of page_size bytes, empty if there is none
+static std::string hugetlbfs_mount(size_t page_size)
+{
+    FILE* mounts = fopen("/proc/mounts", "r");
+
+    if (mounts == nullptr)
     {
-        mshm = nullptr;
-        ret.error_code = SHMEM_ERR_PARAM;
-        ret.error_string = "Size is not grater then 0";
-        return ret;
+        return "";
     }
 
-    t_shmem_handle* handle = new t_shmem_handle();
-    handle->total_size = sizeof(shmem_internal_t) + user_data_size;
+    std::string found;
+    char device[256], dir[512], type[64], opts[512];
 
-    int init = 1;
+    while (fscanf(mounts, "%255s %511s %63s %511s %*d %*d", device, dir, type, opts) == 4)
+    {
+        if (strcmp(type, "hugetlbfs") != 0)
+        {
+            continue;
+        }
 
-    // add / prefix (needed for posix) -> the file will be placed in /dev/shm
-    char local_name[512];
-    snprintf(local_name, sizeof(local_name), "/%s", name);
+        size_t mount_page = HUGE_PAGE_2M; // no pagesize= option: system default
+        const char* opt = strstr(opts, "pagesize=");
 
-    // create file descriptor for shared memory
-    handle->h_fd = shm_open(local_name, O_CREAT | O_RDWR | O_EXCL, 0660); // -1 = failure
+        if (opt != nullptr)
+        {
+            char* unit = nullptr;
+            mount_page = strtoull(opt + strlen("pagesize="), &unit, 10);
+
+            switch (*unit)
+            {
+            case 'G': mount_page <<= 30; break;
+            case 'M': mount_page <<= 20; break;
+            case 'K': case 'k': mount_page <<= 10; break;
+            }
+        }
 
-    if (handle->h_fd < 0 && errno == EEXIST) // file already exists
-    {
-        // open file descriptor
-        handle->h_fd = shm_open(local_name, O_CREAT | O_RDWR, 0660); // -1 = failure
-        init = 0;
+        if (mount_page == page_size && access(dir, W_OK) == 0)
+        {
+            found = dir;
+            break;
+        }
     }
 
-    if (handle->h_fd < 0)
-    {
-        mshm = nullptr;
-        ret.error_code = SHMEM_ERR_OPEN;
-        ret.error_string = strerror(errno);
-        delete handle;
-        return ret;
-    }
+    fclose(mounts);
+
+    return found;
+}
+
+// true if the kernel may back shmem with transparent huge pages when asked with madvise
+static bool shmem_thp_enabled()
+{
+    char mode[128] = {};
+    FILE* f = fopen("/sys/kernel/mm/transparent_hugepage/shmem_enabled", "r");
 
-    // Setup dimention dimention
-    if (ftruncate(handle->h_fd, handle->total_size) != 0) // 0 = success
+    if (f == nullptr)
     {
-        close(handle->h_fd);
-        handle->h_fd = -1;
-        mshm = nullptr;
-        ret.error_code = SHMEM_ERR_FTRUNC;
-        ret.error_string = strerror(errno);
-        delete handle;
-        return ret;
+        return false;
     }
 
-    // Memory mapping
-    handle->shm = (shmem_internal_t*)mmap( // MAP_FAILED = failure
-        NULL,
-        handle->total_size,
-        PROT_READ | PROT_WRITE,
-        MAP_SHARED,
-        handle->h_fd,
-        0
-    );
+    size_t n = fread(mode, 1, sizeof(mode) - 1, f);
+    mode[n] = 0;
+    fclose(f);
+
+    return strstr(mode, "[never]") == nullptr && strstr(mode, "[deny]") == nullptr;
+}
+
+// mapping plus the address space reserved behind it for shmem_resize
+static inline size_t mapping_span(t_shmem_handle* handle)
+{
+    return handle->reserved_size > handle->total_size ? handle->reserved_size : handle->total_size;
+}
+
+// an existing segment, wherever its creator placed it: /dev/shm or a hugetlbfs mount. -1 if none
+static int open_existing(const char* local_name, const char* name, Backing& backing)
+{
+    int fd = shm_open(local_name, O_RDWR, 0660);
 
-    if (handle->shm == MAP_FAILED)
+    if (fd >= 0)
     {
-        mshm = nullptr;
-        handle->shm = NULL;
-        close(handle->h_fd);
-        handle->h_fd = -1;
-        ret.error_code = SHMEM_ERR_MMAP;
-        ret.error_string = strerror(errno);
-        delete handle;
-        return ret;
+        backing = SHMEM_BACKING_PAGES;
+        return fd;
     }
 
-    if (init) // if new shm, create the interprocess mutex
+    for (size_t page_size : { HUGE_PAGE_2M, HUGE_PAGE_1G })
     {
-        pthread_mutexattr_t attr;
-        pthread_mutexattr_init(&attr);
-        pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
-        pthread_mutex_init(&handle->shm->mutex, &attr);
-        pthread_mutexattr_destroy(&attr);
+        std::string mount = hugetlbfs_mount(page_size);
 
-        handle->shm->data_size = user_data_size;
-        memset(handle->shm->data, 0, user_data_size);
+        if (!mount.empty() && (fd = open((mount + "/" + name).c_str(), O_RDWR, 0660)) >= 0)
+        {
+            backing = page_size == HUGE_PAGE_1G ? SHMEM_BACKING_HUGETLB_1G : SHMEM_BACKING_HUGETLB_2M;
+            return fd;
+        }
     }
 
-    *mshm = handle;
-    ret.error_code = SHMEM_OK;
-    ret.error_string = "No Error";
+    errno = ENOENT;
+    return -1;
+}
 
-    return ret;
+static inline bool is_hugetlb(uint32_t backing)
+{
+    return backing == SHMEM_BACKING_HUGETLB_2M || backing == SHMEM_BACKING_HUGETLB_1G;
 }
 
+// a creator that falls back from hugetlbfs to /dev/shm unlinks the file it gave up
+static bool is_unlinked(int fd)
+{
+    struct stat st;
+    return fstat(fd, &st) == 0 && st.st_nlink == 0;
+}
 
-Return mshm::shmem_close(mshm_handle mshm)
+// attachers: the file may be sized but its header still being filled by the creator
+static bool wait_ready(t_shmem_handle* handle)
 {
-    Return ret = check_handle(mshm);
+    internal::Backoff backoff(READY_TIMEOUT_MS);
 
-    if (ret.error_code != SHMEM_OK)
+    while (handle->shm->ready.load(std::memory_order_acquire) != SEGMENT_READY)
     {
-        return ret;
-    }
+        if (is_hugetlb(handle->backing) && is_unlinked(handle->h_fd))
+        {
+            return false;
+        }
 
-    t_shmem_handle* handle = (t_shmem_handle*)(mshm);
+        if (!backoff.pause())
+        {
+            return handle->shm->ready.load(std::memory_order_acquire) == SEGMENT_READY;
+        }
+    }
 
-    int error = munmap(handle->shm, handle->total_size); // 0 = success
+    return true;
+}
 
-    if (error)
+// the creator sizes the file and maps it; an attacher maps the file as it is, it never resizes
+// it under the other processes. With want_thp the mapping is 2 MiB aligned and advised for
+// transparent huge pages. A sealed handle is mapped read only. On failure error holds the errno of the failing call
+static ErrorCode map_segment(t_shmem_handle* handle, bool create, bool want_thp, bool populate, int& error)
+{
+    if (create)
     {
-        ret.error_code = SHMEM_ERR_NOT_OPEN;
-        ret.error_string = strerror(errno);
-        return ret;
+        // Setup dimention dimention
+        if (ftruncate(handle->h_fd, handle->total_size) != 0) // 0 = success
+        {
+            error = errno;
+            return SHMEM_ERR_FTRUNC;
+        }
     }
+    else
+    {
+        struct stat st;
 
-    error = close(handle->h_fd); // 0 = success
+        // the creator may not have sized the file yet
+        for (int i = 0; ; ++i)
+        {
+            if (fstat(handle->h_fd, &st) != 0)
+            {
+                error = errno;
+                return SHMEM_ERR_OPEN;
+            }
+
+            if ((size_t)st.st_size >= sizeof(shmem_internal_t) || i == 1000)
+            {
+                break;
+            }
+
+            std::this_thread::yield();
+        }
 
-    if (error)
+        if ((size_t)st.st_size < sizeof(shmem_internal_t))
+        {
+            error = EINVAL;
+            return SHMEM_ERR_SIZE;
+        }
+
+        handle->total_size = (size_t)st.st_size;
+    }
+
+    size_t span = mapping_span(handle);
+    bool resizable = span > handle->total_size;
+
+    void* hint = NULL;
+    void* reserved = MAP_FAILED;
+    size_t reserved_size = span + (want_thp ? HUGE_PAGE_2M : 0);
+
+    if (want_thp || resizable)
     {
-        ret.error_code = SHMEM_ERR_NOT_OPEN;
-        ret.error_string = strerror(errno);
-        return ret;
+        // reserve a larger range to place the segment on a huge page boundary
+        // and / or to grow it in place later
+        reserved = mmap(NULL, reserved_size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+        if (reserved != MAP_FAILED)
+        {
+            hint = want_thp ? (void*)(((uintptr_t)reserved + HUGE_PAGE_2M - 1) & ~(uintptr_t)(HUGE_PAGE_2M - 1)) : reserved;
+        }
+        else if (resizable)
+        {
+            error = errno;
+            return SHMEM_ERR_MMAP;
+        }
     }
 
-    handle->shm = NULL;
-    handle->h_fd = -1;
-    handle->total_size = 0;
+    // Memory mapping
+    void* addr = mmap( // MAP_FAILED = failure
+        hint,
+        handle->total_size,
+        handle->sealed ? PROT_READ : PROT_READ | PROT_WRITE,
+        MAP_SHARED | (hint ? MAP_FIXED : 0) | (populate ? MAP_POPULATE : 0),
+        handle->h_fd,
+        0
+    );
 
-    return ret;
-}
+    error = addr == MAP_FAILED ? errno : 0;
 
-Return mshm::shmem_delete(const char* name)
-{
-    Return ret;
+    if (reserved != MAP_FAILED)
+    {
+        // give back the unused head and tail of the reservation
+        uintptr_t begin = (uintptr_t)reserved, end = begin + reserved_size;
+        uintptr_t used_begin = (uintptr_t)hint, used_end = used_begin + ((span + 4095) & ~(size_t)4095);
 
-    if (name == nullptr)
+        if (error) munmap(reserved, reserved_size);
+        else
+        {
+            if (used_begin > begin) munmap(reserved, used_begin - begin);
+            if (end > used_end) munmap((void*)used_end, end - used_end);
+        }
+    }
+
+    if (error)
     {
-        ret.error_code = SHMEM_ERR_PARAM;
-        ret.error_string = "Invalid parameters";
-        return ret;
+        return SHMEM_ERR_MMAP;
     }
 
-    int error = shm_unlink(name); // 0 = success
+    handle->shm = (shmem_internal_t*)addr;
 
-    if (error)
+    if (want_thp && shmem_thp_enabled() && madvise(addr, handle->total_size, MADV_HUGEPAGE) == 0)
     {
-        ret.error_code = SHMEM_ERR_DELETE;
-        ret.error_string = strerror(errno);
-        return ret;
+        handle->backing = SHMEM_BACKING_TRANSPARENT_HUGE;
     }
 
-    return ret;
+    return SHMEM_OK;
 }
 
+static inline void unmap_segment(t_shmem_handle* handle)
+{
+    munmap(handle->shm, mapping_span(handle));
+}
 
-Return mshm::shmem_write(mshm_handle mshm, const void* src, size_t size, uint64_t offset)
+// map [total_size, new_total_size) of the file right after the current mapping,
+// inside the reserved range: the segment never moves, pointers into it stay valid
+static ErrorCode grow_mapping(t_shmem_handle* handle, size_t new_total_size)
 {
-    Return ret = check_handle(mshm);
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t mapped_end = (handle->total_size + page - 1) & ~(page - 1);
+    size_t new_end = (new_total_size + page - 1) & ~(page - 1);
 
-    if (ret.error_code != SHMEM_OK)
+    if (new_total_size > mapping_span(handle))
     {
-        return ret;
+        return SHMEM_ERR_SIZE;
     }
 
-    if (src == nullptr)
+    if (new_end > mapped_end)
     {
-        ret.error_code = SHMEM_ERR_PARAM;
-        ret.error_string = "src in NULL";
-        return ret;
+        void* addr = mmap((unsigned char*)handle->shm + mapped_end, new_end - mapped_end, PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_FIXED, handle->h_fd, (off_t)mapped_end);
+
+        if (addr == MAP_FAILED)
+        {
+            return SHMEM_ERR_MMAP;
+        }
     }
 
-    t_shmem_handle* handle = (t_shmem_handle*)(mshm);
+    if (new_total_size > handle->total_size)
+    {
+        handle->total_size = new_total_size;
+    }
+
+    return SHMEM_OK;
+}
 
-    if (offset + size > handle->shm->data_size)
+// slow path of mapped_data_size: the segment was resized since this handle last looked.
+// A pthread mutex, not std::mutex: reached from the noexcept _ec calls, it must not throw
+static ErrorCode sync_size(t_shmem_handle* handle) noexcept
+{
+    if (pthread_mutex_lock(&handle->resize_mutex) != 0)
     {
-        ret.error_code = SHMEM_ERR_PARAM;
-        ret.error_string = "Size plus offset is exceeding the shmem size";
-        return ret;
+        return SHMEM_ERR_MUTEX;
     }
 
-    int error = pthread_mutex_lock(&handle->shm->mutex); // 0 = success
+    ErrorCode code = SHMEM_OK;
+    uint64_t generation = handle->shm->size_generation.load(std::memory_order_acquire);
 
-    if (error)
+    if (generation != handle->size_generation.load(std::memory_order_relaxed))
     {
-        (error == EDEADLK) ? ret.error_string = "Mutex is dead lock" : ret.error_string = "Mutex not properly initialized";
-        ret.error_code = SHMEM_ERR_MUTEX;
-        return ret;
+        size_t data_size = handle->shm->data_size; // written before the generation was bumped
+        code = grow_mapping(handle, sizeof(shmem_internal_t) + data_size);
+
+        if (code == SHMEM_OK)
+        {
+            handle->data_size.store(data_size, std::memory_order_release);
+            handle->size_generation.store(generation, std::memory_order_release);
+        }
     }
 
-    memcpy(&handle->shm->data[offset], src, size);
+    pthread_mutex_unlock(&handle->resize_mutex);
 
-    error = pthread_mutex_unlock(&handle->shm->mutex); // 0 = success
+    return code;
+}
 
-    if (error)
+// bounds of every access: what this handle has mapped, remapping first if the segment grew
+static inline size_t mapped_data_size(t_shmem_handle* handle) noexcept
+{
+    if (handle->shm->max_size != 0
+        && handle->shm->size_generation.load(std::memory_order_acquire) != handle->size_generation.load(std::memory_order_relaxed))
     {
-        error == EPERM ? ret.error_string = "The calling thread does not own the mutex" : ret.error_string = "Mutex not properly initialized";
-        ret.error_code = SHMEM_ERR_MUTEX;
-        return ret;
+        sync_size(handle); // on failure the old, still valid, size is kept
     }
 
-    return ret;
+    return handle->data_size.load(std::memory_order_acquire);
 }
 
 
-Return mshm::shmem_read(mshm_handle mshm, void* dst, size_t size, uint64_t offset)
+// fault in [begin, end) without changing its content
+static void populate_range(unsigned char* begin, unsigned char* end, size_t page)
 {
-    Return ret = check_handle(mshm);
-
-    if (ret.error_code != SHMEM_OK)
+    if (madvise(begin, end - begin, MADV_POPULATE_WRITE) == 0)
     {
-        return ret;
+        return;
     }
 
-    if (dst == nullptr)
+    // kernels older than 5.14: a read per page
+    for (volatile unsigned char* p = begin; p < end; p += page)
     {
-        ret.error_code = SHMEM_ERR_PARAM;
-        ret.error_string = "dst in NULL";
-        return ret;
+        (void)*p;
     }
+}
 
-    t_shmem_handle* handle = (t_shmem_handle*)(mshm);
+// per-process pinning and prefaulting asked with OpenOptions::prefault
+static ErrorCode prefault_segment(t_shmem_handle* handle, const OpenOptions& options, int& error)
+{
+    unsigned char* base = (unsigned char*)handle->shm;
+    size_t size = handle->total_size;
 
-    if (offset + size > handle->shm->data_size)
+    if (options.prefault & SHMEM_PREFAULT_LOCK_ON_FAULT)
     {
-        ret.error_code = SHMEM_ERR_PARAM;
-        ret.error_string = "Size plus offset is exceeding the shmem size";
-        return ret;
+        // pages are locked as they are touched (by the parallel prefault below, if asked)
+        if (mlock2(base, size, MLOCK_ONFAULT) != 0)
+        {
+            error = errno;
+            return SHMEM_ERR_MMAP;
+        }
     }
-
-    int error = pthread_mutex_lock(&handle->shm->mutex); // 0 = success
-
-    if (error)
+    else if (options.prefault & SHMEM_PREFAULT_LOCK)
     {
-        (error == EDEADLK) ? ret.error_string = "Mutex is dead lock" : ret.error_string = "Mutex not properly initialized";
-        ret.error_code = SHMEM_ERR_MUTEX;
-        return ret;
+        // faults in and pins every page
+        if (mlock(base, size) != 0)
+        {
+            error = errno;
+            return SHMEM_ERR_MMAP;
+        }
     }
 
-    memcpy(dst, &handle->shm->data[offset], size);
+    if (options.prefault & SHMEM_PREFAULT_PARALLEL)
+    {
+        size_t page = handle->backing == SHMEM_BACKING_HUGETLB_1G ? HUGE_PAGE_1G
+                    : handle->backing == SHMEM_BACKING_PAGES ? (size_t)sysconf(_SC_PAGESIZE) : HUGE_PAGE_2M;
+        size_t pages = (size + page - 1) / page;
 
-    error = pthread_mutex_unlock(&handle->shm->mutex); // 0 = success
+        unsigned int threads = options.prefault_threads ? options.prefault_threads : std::thread::hardware_concurrency();
+        if (threads == 0) threads = 1;
+        if (threads > pages) threads = (unsigned int)pages;
 
-    if (error)
-    {
-        error == EPERM ? ret.error_string = "The calling thread does not own the mutex" : ret.error_string = "Mutex not properly initialized";
-        ret.error_code = SHMEM_ERR_MUTEX;
-        return ret;
+        size_t pages_per_thread = (pages + threads - 1) / threads;
+        std::vector<std::thread> workers;
+
+        for (unsigned int t = 1; t < threads; ++t)
+        {
+            unsigned char* begin = base + std::min(size, t * pages_per_thread * page);
+            unsigned char* end = base + std::min(size, (t + 1) * pages_per_thread * page);
+
+            if (begin < end)
+            {
+                workers.emplace_back(populate_range, begin, end, page);
+            }
+        }
+
+        populate_range(base, base + std::min(size, pages_per_thread * page), page);
+
+        for (auto& worker : workers)
+        {
+            worker.join();
+        }
     }
 
-    return ret;
+    return SHMEM_OK;
 }
 
+
+static const unsigned long NUMA_MAX_NODES = 1024;
+static const size_t NUMA_MASK_WORDS = NUMA_MAX_NODES / (8 * sizeof(unsigned long));
+
+static inline bool node_in_mask(const unsigned long* mask, unsigned long node)
+{
+    return node < NUMA_MAX_NODES && (mask[node / (8 * sizeof(unsigned long))] >> (node % (8 * sizeof(unsigned long)))) & 1;
+}
+
+// mbind the whole mapping following OpenOptions::numa_policy.
+// Nothing to do (and no error) on a machine, or a cpuset, with a single memory node
+static ErrorCode apply_numa_policy(t_shmem_handle* handle, const OpenOptions& options, int& error)
+{
+    unsigned long allowed[NUMA_MASK_WORDS] = {};
+
+    if (syscall(SYS_get_mempolicy, nullptr, allowed, NUMA_MAX_NODES, nullptr, MPOL_F_MEMS_ALLOWED) != 0)
+    {
+        return SHMEM_OK; // kernel without NUMA support
+    }
+
+    unsigned long nodes = 0;
+
+    for (unsigned long node = 0; node < NUMA_MAX_NODES; ++node)
+    {
+        nodes += node_in_mask(allowed, node);
+    }
+
+    if (nodes <= 1)
+    {
+        return SHMEM_OK;
+    }
+
+    unsigned long mask[NUMA_MASK_WORDS] = {};
+    int mode = MPOL_DEFAULT;
+
+    switch (options.numa_policy)
+    {
+    case SHMEM_NUMA_BIND:
+        if (options.numa_node < 0 || !node_in_mask(allowed, (unsigned long)options.numa_node))
+        {
+            error = EINVAL;
+            return SHMEM_ERR_PARAM;
+        }
+        mask[options.numa_node / (8 * sizeof(unsigned long))] |= 1UL << (options.numa_node % (8 * sizeof(unsigned long)));
+        mode = MPOL_BIND;
+        break;
+
+    case SHMEM_NUMA_INTERLEAVE:
+        memcpy(mask, allowed, sizeof(mask));
+        mode = MPOL_INTERLEAVE;
+        break;
+
+    case SHMEM_NUMA_FIRST_TOUCH:
+        mode = MPOL_LOCAL;
+        break;
+
+    default:
+        return SHMEM_OK;
+    }
+
+    if (syscall(SYS_mbind, handle->shm, handle->total_size, mode, mode == MPOL_LOCAL ? nullptr : mask, NUMA_MAX_NODES, 0) != 0)
+    {
+        error = errno;
+        return SHMEM_ERR_MMAP;
+    }
+
+    return SHMEM_OK;
+}
+
+
+// options a new segment is created with, or an attacher asks for
+static Return validate_options(size_t user_data_size, const OpenOptions& options)
+{
+    Return ret;
+
+    if (user_data_size <= 0)
+    {
+        ret.error_code = SHMEM_ERR_PARAM;
+        ret.error_string = "Size is not grater then 0";
+        return ret;
+    }
+
+    if (options.sync_mode != SHMEM_SYNC_MUTEX && options.sync_mode != SHMEM_SYNC_SEQLOCK
+        && options.sync_mode != SHMEM_SYNC_TRIPLE_BUFFER && options.sync_mode != SHMEM_SYNC_RWLOCK)
+    {
+        ret.error_code = SHMEM_ERR_PARAM;
+        ret.error_string = "Unknown sync mode";
+        return ret;
+    }
+
+    if (options.lock_policy & ~(unsigned int)(SHMEM_LOCK_ADAPTIVE | SHMEM_LOCK_ROBUST | SHMEM_LOCK_PRIO_INHERIT))
+    {
+        ret.error_code = SHMEM_ERR_PARAM;
+        ret.error_string = "Unknown lock policy";
+        return ret;
+    }
+
+    if (options.sync_mode == SHMEM_SYNC_RWLOCK && (options.lock_policy & (SHMEM_LOCK_ROBUST | SHMEM_LOCK_PRIO_INHERIT)))
+    {
+        ret.error_code = SHMEM_ERR_PARAM;
+        ret.error_string = "Reader/writer locks can not be robust or priority inheriting";
+        return ret;
+    }
+
+    if (options.page_size != SHMEM_PAGE_DEFAULT && huge_page_size(options.page_size) == 0)
+    {
+        ret.error_code = SHMEM_ERR_PARAM;
+        ret.error_string = "Unknown page size";
+        return ret;
+    }
+
+    if (options.numa_policy != SHMEM_NUMA_DEFAULT && options.numa_policy != SHMEM_NUMA_BIND
+        && options.numa_policy != SHMEM_NUMA_INTERLEAVE && options.numa_policy != SHMEM_NUMA_FIRST_TOUCH)
+    {
+        ret.error_code = SHMEM_ERR_PARAM;
+        ret.error_string = "Unknown NUMA policy";
+        return ret;
+    }
+
+    if (options.prefault & ~(unsigned int)(SHMEM_PREFAULT_POPULATE | SHMEM_PREFAULT_LOCK | SHMEM_PREFAULT_LOCK_ON_FAULT | SHMEM_PREFAULT_PARALLEL))
+    {
+        ret.error_code = SHMEM_ERR_PARAM;
+        ret.error_string = "Unknown prefault flag";
+        return ret;
+    }
+
+    // stripes cover stripe_size() bytes each: the last one must still start inside the data
+    if (options.lock_stripes != 0 && (options.sync_mode != SHMEM_SYNC_MUTEX || user_data_size == 0
+        || (options.lock_stripes - 1) * stripe_size(user_data_size, options.lock_stripes) >= user_data_size))
+    {
+        ret.error_code = SHMEM_ERR_PARAM;
+        ret.error_string = "Lock stripes need the mutex sync mode and some data in every stripe";
+        return ret;
+    }
+
+    if (options.dirty_block_size != 0 && (options.sync_mode == SHMEM_SYNC_TRIPLE_BUFFER
+        || options.dirty_block_size < 64 || (options.dirty_block_size & (options.dirty_block_size - 1)) != 0))
+    {
+        ret.error_code = SHMEM_ERR_PARAM;
+        ret.error_string = "Dirty block size must be a power of two of at least 64 bytes, not in triple buffer mode";
+        return ret;
+    }
+
+    if (options.max_size != 0 && (options.max_size < user_data_size || options.sync_mode == SHMEM_SYNC_TRIPLE_BUFFER
+        || options.lock_stripes != 0 || options.dirty_block_size != 0 || options.page_size != SHMEM_PAGE_DEFAULT
+        || options.max_size > SIZE_MAX - sizeof(shmem_internal_t)))
+    {
+        ret.error_code = SHMEM_ERR_PARAM;
+        ret.error_string = "Resizable segments need a max size not below the size, default pages and no stripes, dirty blocks or triple buffer";
+        return ret;
+    }
+
+    if (options.persist_dir != nullptr && options.page_size != SHMEM_PAGE_DEFAULT)
+    {
+        ret.error_code = SHMEM_ERR_PARAM;
+        ret.error_string = "File-backed segments use default pages";
+        return ret;
+    }
+
+    ret.error_code = SHMEM_OK;
+    return ret;
+}
+
+// bytes of the segment file: header, data and whatever the options lay out after it
+static size_t segment_total_size(size_t user_data_size, const OpenOptions& options)
+{
+    size_t total_size = sizeof(shmem_internal_t) + user_data_size;
+
+    if (options.lock_stripes != 0 || options.dirty_block_size != 0)
+    {
+        total_size = sizeof(shmem_internal_t) + ((user_data_size + 63) & ~(size_t)63)
+            + options.lock_stripes * sizeof(lock_stripe_t)
+            + dirty_blocks(user_data_size, options.dirty_block_size) * sizeof(uint64_t);
+    }
+
+    if (options.sync_mode == SHMEM_SYNC_TRIPLE_BUFFER)
+    {
+        total_size = sizeof(shmem_internal_t) + 3 * buffer_stride(user_data_size);
+    }
+
+    return total_size;
+}
+
+// process-shared locks of a segment, following the policy and layout already in its header
+static int init_locks(t_shmem_handle* handle)
+{
+    int error;
+
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+
+    if (handle->shm->lock_policy & SHMEM_LOCK_ADAPTIVE)
+    {
+        pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_ADAPTIVE_NP);
+    }
+
+    if (handle->shm->lock_policy & SHMEM_LOCK_ROBUST)
+    {
+        pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+    }
+
+    if (handle->shm->lock_policy & SHMEM_LOCK_PRIO_INHERIT)
+    {
+        pthread_mutexattr_setprotocol(&attr, PTHREAD_PRIO_INHERIT);
+    }
+
+    error = pthread_mutex_init(&handle->shm->mutex, &attr);
+
+    for (uint32_t i = 0; i < handle->shm->lock_stripes && !error; ++i)
+    {
+        stripe_at(handle, i)->generation.store(0, std::memory_order_relaxed);
+        error = pthread_mutex_init(&stripe_at(handle, i)->mutex, &attr);
+    }
+
+    pthread_mutexattr_destroy(&attr);
+
+    if (!error && handle->shm->sync_mode == SHMEM_SYNC_RWLOCK)
+    {
+        pthread_rwlockattr_t rw_attr;
+        pthread_rwlockattr_init(&rw_attr);
+        pthread_rwlockattr_setpshared(&rw_attr, PTHREAD_PROCESS_SHARED);
+        // the default glibc policy prefers readers: a steady stream of them would starve writers
+        pthread_rwlockattr_setkind_np(&rw_attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+        error = pthread_rwlock_init(&handle->shm->rwlock, &rw_attr);
+        pthread_rwlockattr_destroy(&rw_attr);
+    }
+
+    return error;
+}
+
+// first opener: set up the locks and the header of a zero-filled segment.
+// Returns the pthread error, 0 on success
+static int init_segment(t_shmem_handle* handle, size_t user_data_size, const OpenOptions& options)
+{
+    // data_size first: stripe_at needs it
+    handle->shm->data_size = user_data_size;
+    handle->shm->lock_stripes = options.lock_stripes;
+    handle->shm->stripe_size = options.lock_stripes ? stripe_size(user_data_size, options.lock_stripes) : 0;
+    handle->shm->dirty_block_size = options.dirty_block_size; // block versions start at 0 (zero pages)
+    handle->shm->sync_mode = options.sync_mode;
+    handle->shm->lock_policy = options.lock_policy;
+    handle->shm->page_size = options.page_size;
+    handle->shm->backing = handle->backing;
+
+    int error = init_locks(handle);
+
+    if (error)
+    {
+        return error;
+    }
+
+    handle->shm->lock_timeout_ms = options.lock_timeout_ms < 0 ? -1 : options.lock_timeout_ms;
+    handle->shm->stats_enabled = options.stats ? 1 : 0; // counters start at 0 (zero pages)
+    handle->shm->max_size = options.max_size;
+    handle->shm->size_generation.store(0, std::memory_order_relaxed);
+    handle->shm->sequence.store(0, std::memory_order_relaxed);
+    handle->shm->latest.store(0, std::memory_order_relaxed);
+    for (auto& seq : handle->shm->buffer_sequence) seq.store(0, std::memory_order_relaxed);
+    for (auto& gen : handle->shm->buffer_generation) gen.store(0, std::memory_order_relaxed);
+    handle->shm->changes.store(0, std::memory_order_relaxed);
+    handle->shm->waiters.store(0, std::memory_order_relaxed);
+    // no memset: a file just created (shm_open / open(O_EXCL) / memfd_create / truncated to 0)
+    // is made of zero pages, image_magic and ready included
+
+    // last: attachers read no header field before they see it
+    handle->shm->ready.store(SEGMENT_READY, std::memory_order_release);
+
+    return 0;
+}
+
+
+
+// file-backed segments: OFD locks on two bytes of the file, owned by the handle's open file
+static const off_t FILE_LOCK_OPEN = 0;  // held while a handle opens the segment
+static const off_t FILE_LOCK_USERS = 1; // read locked by every open handle
+
+static const uint64_t IMAGE_MAGIC = 0x31474d494d48534d; // "MSHMIMG1"
+
+static bool file_lock(int fd, off_t byte, short type, bool wait)
+{
+    struct flock lock = {};
+    lock.l_type = type;
+    lock.l_whence = SEEK_SET;
+    lock.l_start = byte;
+    lock.l_len = 1;
+
+    int result;
+    do
+    {
+        result = fcntl(fd, wait ? F_OFD_SETLKW : F_OFD_SETLK, &lock);
+    }
+    while (result != 0 && wait && errno == EINTR);
+
+    return result == 0;
+}
+
+// FNV-1a over 64 bit words, folded: not cryptographic, it tells a torn or stale image from the flushed one
+static uint64_t checksum_bytes(uint64_t hash, const void* bytes, size_t size)
+{
+    const unsigned char* p = (const unsigned char*)bytes;
+
+    for (; size >= sizeof(uint64_t); p += sizeof(uint64_t), size -= sizeof(uint64_t))
+    {
+        uint64_t word;
+        memcpy(&word, p, sizeof(word));
+        hash = (hash ^ word) * 1099511628211ull;
+        hash ^= hash >> 32;
+    }
+
+    for (; size > 0; ++p, --size)
+    {
+        hash = (hash ^ *p) * 1099511628211ull;
+    }
+
+    return hash;
+}
+
+// what a flushed image is made of: the data (the three copies in triple buffer mode),
+// the block versions and the header fields readers rely on
+static uint64_t image_checksum(t_shmem_handle* handle)
+{
+    shmem_internal_t* shm = handle->shm;
+
+    uint64_t state[] = {
+        shm->data_size, shm->sync_mode, shm->lock_stripes, shm->dirty_block_size,
+        shm->sequence.load(std::memory_order_relaxed), shm->latest.load(std::memory_order_relaxed),
+        shm->buffer_sequence[0].load(std::memory_order_relaxed), shm->buffer_sequence[1].load(std::memory_order_relaxed),
+        shm->buffer_sequence[2].load(std::memory_order_relaxed), shm->buffer_generation[0].load(std::memory_order_relaxed),
+        shm->buffer_generation[1].load(std::memory_order_relaxed), shm->buffer_generation[2].load(std::memory_order_relaxed)
+    };
+
+    uint64_t hash = checksum_bytes(14695981039346656037ull, state, sizeof(state));
+
+    size_t data_bytes = shm->sync_mode == SHMEM_SYNC_TRIPLE_BUFFER ? 3 * buffer_stride(shm->data_size) : shm->data_size;
+    hash = checksum_bytes(hash, shm->data, data_bytes);
+
+    size_t blocks = dirty_blocks(shm->data_size, shm->dirty_block_size);
+
+    if (blocks != 0)
+    {
+        hash = checksum_bytes(hash, dirty_at(handle, 0), blocks * sizeof(uint64_t));
+    }
+
+    return hash;
+}
+
+// the file has no live user: a previous run left it. Go back to its last flushed image with
+// fresh locks (whoever held them is gone); false if there is no consistent image
+static bool restore_image(t_shmem_handle* handle)
+{
+    shmem_internal_t* shm = handle->shm;
+
+    if (shm->ready.load(std::memory_order_acquire) != SEGMENT_READY
+        || shm->image_magic != IMAGE_MAGIC || shm->image_header_size != sizeof(shmem_internal_t)
+        || shm->sync_mode > SHMEM_SYNC_RWLOCK || shm->data_size == 0)
+    {
+        return false;
+    }
+
+    // the layout must fit in the file before the checksum walks it
+    OpenOptions layout;
+    layout.sync_mode = (SyncMode)shm->sync_mode;
+    layout.lock_stripes = shm->lock_stripes;
+    layout.dirty_block_size = (size_t)shm->dirty_block_size;
+
+    if (shm->data_size > handle->total_size || validate_options((size_t)shm->data_size, layout).error_code != SHMEM_OK
+        || segment_total_size((size_t)shm->data_size, layout) > handle->total_size)
+    {
+        return false;
+    }
+
+    if (image_checksum(handle) != shm->image_checksum || init_locks(handle) != 0)
+    {
+        return false;
+    }
+
+    shm->changes.store(0, std::memory_order_relaxed);
+    shm->waiters.store(0, std::memory_order_relaxed);
+
+    return true;
+}
+
+// where a segment may live, derived from its name and the open options
+struct open_names_t
+{
+    const char* name = nullptr;
+    char local_name[512] = {};  // with the / prefix posix needs: the file is placed in /dev/shm
+    std::string huge_path;      // on the hugetlbfs mount of the requested page size, empty = none
+    std::string file_path;      // in persist_dir, empty = not persistent
+};
+
+static void make_open_names(open_names_t& names, const char* name, const OpenOptions& options)
+{
+    names.name = name;
+    snprintf(names.local_name, sizeof(names.local_name), "/%s", name);
+
+    size_t huge_page = huge_page_size(options.page_size);
+
+    if (huge_page)
+    {
+        std::string mount = hugetlbfs_mount(huge_page);
+
+        if (!mount.empty())
+        {
+            names.huge_path = mount + "/" + name;
+        }
+    }
+
+    if (options.persist_dir != nullptr)
+    {
+        names.file_path = std::string(options.persist_dir) + "/" + name;
+    }
+}
+
+// a creator that fails leaves nothing behind: attachers would wait for a header that never
+// comes. A persistent file is emptied instead, while fd still holds its open lock: openers
+// waiting on that lock then find a file to create the segment in, not an unlinked one
+static void discard_created(int fd, const open_names_t& names)
+{
+    if (names.file_path.empty())
+    {
+        shmem_delete(names.name);
+    }
+    else if (ftruncate(fd, 0) != 0)
+    {
+        unlink(names.file_path.c_str());
+    }
+}
+
+// undo whatever shmem_open did with the handle so far. discard: this opener created the segment
+static Return fail_open(mshm_handle& mshm, t_shmem_handle* handle, const open_names_t& names, ErrorCode code,
+                        const std::string& message, bool discard = false)
+{
+    if (handle->shm != nullptr)
+    {
+        unmap_segment(handle);
+    }
+
+    if (handle->h_fd >= 0)
+    {
+        if (discard) discard_created(handle->h_fd, names);
+        close(handle->h_fd);
+    }
+
+    delete handle;
+    mshm = nullptr;
+
+    return Return{code, message};
+}
+
+// open the image file of a persistent segment. One opener at a time (the open lock, released
+// once the handle counts as a user) tells a live segment from one a previous run left behind.
+// Returns the file descriptor, -1 = failure (errno)
+static int open_persistent(const open_names_t& names, int& init, bool& restore)
+{
+    int fd = open(names.file_path.c_str(), O_CREAT | O_RDWR | O_CLOEXEC, 0660);
+
+    if (fd < 0)
+    {
+        return -1;
+    }
+
+    init = 0;
+
+    if (!file_lock(fd, FILE_LOCK_OPEN, F_WRLCK, true))
+    {
+        int lock_errno = errno;
+        close(fd);
+        errno = lock_errno;
+        return -1;
+    }
+
+    if (file_lock(fd, FILE_LOCK_USERS, F_WRLCK, false))
+    {
+        struct stat st;
+        restore = fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(shmem_internal_t);
+        init = !restore;
+
+        if (init && ftruncate(fd, 0) != 0) // whatever a dead creator left: zero pages again
+        {
+            int truncate_errno = errno;
+            close(fd);
+            errno = truncate_errno;
+            return -1;
+        }
+    }
+
+    return fd;
+}
+
+// create the segment on hugetlbfs. With no huge pages left fall back to /dev/shm: the huge page
+// file stays until the fallback exists, so every opener finds one of the two; whoever attached
+// to it meanwhile sees it unlinked and looks again. Returns the file descriptor, mapped when the
+// huge pages were there, -1 = failure (errno)
+static int create_huge(t_shmem_handle* handle, const open_names_t& names, size_t huge_page, bool populate, int& init)
+{
+    int huge_fd = open(names.huge_path.c_str(), O_CREAT | O_RDWR | O_EXCL, 0660);
+
+    if (huge_fd < 0)
+    {
+        return -1;
+    }
+
+    init = 1;
+    size_t plain_size = handle->total_size;
+    handle->h_fd = huge_fd;
+    handle->total_size = (handle->total_size + huge_page - 1) & ~(huge_page - 1);
+    handle->backing = huge_page == HUGE_PAGE_1G ? SHMEM_BACKING_HUGETLB_1G : SHMEM_BACKING_HUGETLB_2M;
+
+    int error = 0;
+
+    if (map_segment(handle, true, false, populate, error) == SHMEM_OK)
+    {
+        return huge_fd;
+    }
+
+    handle->h_fd = -1;
+    handle->total_size = plain_size;
+    handle->backing = SHMEM_BACKING_PAGES;
+
+    int fd = shm_open(names.local_name, O_CREAT | O_RDWR | O_EXCL, 0660);
+
+    if (fd < 0 && errno == EEXIST)
+    {
+        fd = shm_open(names.local_name, O_RDWR, 0660);
+        init = 0;
+    }
+
+    int open_errno = errno;
+    unlink(names.huge_path.c_str());
+    close(huge_fd);
+    errno = open_errno;
+
+    return fd;
+}
+
+// find the segment, or create it, and map it. An opener that raced with a creator (or attached
+// to a huge page file its creator then abandoned) looks again. On failure the handle keeps the
+// file descriptor of a segment this opener created, for fail_open to discard
+static ErrorCode open_segment(t_shmem_handle* handle, const open_names_t& names, size_t user_data_size,
+                              const OpenOptions& options, bool populate, int& init, bool& restore, std::string& message)
+{
+    size_t huge_page = huge_page_size(options.page_size);
+
+    for (int attempt = 0; ; ++attempt)
+    {
+        if (!names.file_path.empty())
+        {
+            handle->persistent = true;
+            handle->h_fd = open_persistent(names, init, restore);
+        }
+        else
+        {
+            // attach wherever the creator placed it, whatever page size this opener asks for:
+            // the header check rejects a mismatch instead of creating a second segment
+            Backing found = SHMEM_BACKING_PAGES;
+            handle->h_fd = open_existing(names.local_name, names.name, found);
+
+            if (handle->h_fd >= 0)
+            {
+                init = 0;
+                handle->backing = found;
+            }
+            else
+            {
+                init = 1;
+
+                // create file descriptor for shared memory, -1 = failure
+                handle->h_fd = names.huge_path.empty() ? shm_open(names.local_name, O_CREAT | O_RDWR | O_EXCL, 0660)
+                                                       : create_huge(handle, names, huge_page, populate, init);
+
+                if (handle->h_fd < 0 && errno == EEXIST && attempt < OPEN_ATTEMPTS) // created meanwhile
+                {
+                    continue;
+                }
+            }
+        }
+
+        if (handle->h_fd < 0)
+        {
+            message = strerror(errno);
+            return SHMEM_ERR_OPEN;
+        }
+
+        int error = 0;
+        ErrorCode map_result = SHMEM_OK;
+
+        if (handle->shm == nullptr)
+        {
+            map_result = map_segment(handle, init, huge_page != 0 && !is_hugetlb(handle->backing), populate, error);
+        }
+
+        if (map_result != SHMEM_OK && (init || restore))
+        {
+            message = strerror(error);
+            return map_result;
+        }
+
+        if (!init && !restore && (map_result != SHMEM_OK || !wait_ready(handle)))
+        {
+            bool abandoned = is_unlinked(handle->h_fd);
+
+            if (handle->shm != nullptr) unmap_segment(handle);
+            close(handle->h_fd);
+            handle->shm = nullptr;
+            handle->h_fd = -1;
+
+            if (abandoned && attempt < OPEN_ATTEMPTS)
+            {
+                handle->total_size = segment_total_size(user_data_size, options);
+                handle->backing = SHMEM_BACKING_PAGES;
+                continue;
+            }
+
+            message = map_result != SHMEM_OK ? strerror(error) : "Shared memory was not initialized by its creator";
+            return map_result != SHMEM_OK ? map_result : SHMEM_ERR_NOT_OPEN;
+        }
+
+        return SHMEM_OK;
+    }
+}
+
+// an image that fails its checks gives nothing consistent to go back to: start over as the
+// creator of an empty file
+static ErrorCode restart_as_creator(t_shmem_handle* handle, size_t user_data_size, const OpenOptions& options,
+                                    bool populate, int& error)
+{
+    unmap_segment(handle);
+    handle->shm = nullptr;
+    handle->total_size = segment_total_size(user_data_size, options);
+
+    if (ftruncate(handle->h_fd, 0) != 0)
+    {
+        error = errno;
+        return SHMEM_ERR_FTRUNC;
+    }
+
+    return map_segment(handle, true, false, populate, error);
+}
+
+// the page options a creator applies before init_segment writes the header. The NUMA policy
+// belongs to the shared object: it is set before anything touches the pages
+static ErrorCode apply_page_options(t_shmem_handle* handle, const OpenOptions& options, bool init, bool populate, int& error)
+{
+    if (init && options.numa_policy != SHMEM_NUMA_DEFAULT)
+    {
+        ErrorCode numa_result = apply_numa_policy(handle, options, error);
+
+        if (numa_result != SHMEM_OK)
+        {
+            return numa_result;
+        }
+    }
+
+    if ((options.prefault & SHMEM_PREFAULT_POPULATE) && !populate)
+    {
+        populate_range((unsigned char*)handle->shm, (unsigned char*)handle->shm + handle->total_size, (size_t)sysconf(_SC_PAGESIZE));
+    }
+
+    return SHMEM_OK;
+}
+
+// an attacher must ask for the segment its creator made. Returns SHMEM_OK or why not
+static ErrorCode check_attach(const t_shmem_handle* handle, size_t user_data_size, const OpenOptions& options,
+                              std::string& message)
+{
+    const shmem_internal_t* shm = handle->shm;
+
+    if (shm->sync_mode != (uint32_t)options.sync_mode)
+    {
+        message = "Shared memory was created with a different sync mode";
+        return SHMEM_ERR_PARAM;
+    }
+
+    if (shm->page_size != (uint32_t)options.page_size || is_hugetlb(shm->backing) != is_hugetlb(handle->backing))
+    {
+        message = "Shared memory was created with a different page size";
+        return SHMEM_ERR_PARAM;
+    }
+
+    if (user_data_size > shm->data_size)
+    {
+        message = "Shared memory is smaller than requested: only shmem_resize can grow it";
+        return SHMEM_ERR_SIZE;
+    }
+
+    if (shm->dirty_block_size != options.dirty_block_size)
+    {
+        message = "Shared memory was created with a different dirty block size";
+        return SHMEM_ERR_PARAM;
+    }
+
+    if (shm->lock_policy != options.lock_policy || shm->lock_stripes != options.lock_stripes
+        || shm->lock_timeout_ms != (options.lock_timeout_ms < 0 ? -1 : options.lock_timeout_ms))
+    {
+        message = "Shared memory was created with a different lock policy";
+        return SHMEM_ERR_PARAM;
+    }
+
+    return SHMEM_OK;
+}
+
+// an attacher of a resizable segment maps it again with room to grow: nobody else uses this
+// handle yet
+static ErrorCode reserve_growth(t_shmem_handle* handle, bool populate, int& error)
+{
+    size_t reserved_size = sizeof(shmem_internal_t) + handle->shm->max_size;
+    unmap_segment(handle);
+    handle->shm = nullptr;
+    handle->reserved_size = reserved_size;
+
+    return map_segment(handle, false, false, populate, error);
+}
+
+Return mshm::shmem_open(mshm_handle& mshm, const char* name, size_t user_data_size, const OpenOptions& options)
+{
+    Return ret;
+
+    std::string name_error_description;
+
+    if(!is_valid_shm_name(name, &name_error_description))
+    {
+        mshm = nullptr;
+        ret.error_code = SHMEM_ERR_PARAM;
+        ret.error_string = name_error_description;
+        return ret;
+    }
+
+    ret = validate_options(user_data_size, options);
+
+    if (ret.error_code != SHMEM_OK)
+    {
+        mshm = nullptr;
+        return ret;
+    }
+
+    t_shmem_handle* handle = new t_shmem_handle();
+    handle->total_size = segment_total_size(user_data_size, options);
+    handle->reserved_size = options.max_size ? sizeof(shmem_internal_t) + options.max_size : 0;
+
+    open_names_t names;
+    make_open_names(names, name, options);
+
+    // with a NUMA policy the pages may only be faulted in once the policy is set
+    bool populate = (options.prefault & SHMEM_PREFAULT_POPULATE) && options.numa_policy == SHMEM_NUMA_DEFAULT;
+
+    int init = 1;
+    bool restore = false;
+    int error = 0;
+    std::string message;
+
+    ErrorCode code = open_segment(handle, names, user_data_size, options, populate, init, restore, message);
+
+    if (code != SHMEM_OK)
+    {
+        return fail_open(mshm, handle, names, code, message, init);
+    }
+
+    if (restore && !restore_image(handle))
+    {
+        restore = false;
+        init = 1;
+        code = restart_as_creator(handle, user_data_size, options, populate, error);
+
+        if (code != SHMEM_OK)
+        {
+            return fail_open(mshm, handle, names, code, strerror(error));
+        }
+    }
+
+    code = apply_page_options(handle, options, init, populate, error);
+
+    if (code != SHMEM_OK)
+    {
+        return fail_open(mshm, handle, names, code, strerror(error), init);
+    }
+
+    if (init) // if new shm, create the interprocess mutex
+    {
+        error = init_segment(handle, user_data_size, options);
+
+        if (error) // nobody can use a segment without its mutex: remove it
+        {
+            return fail_open(mshm, handle, names, SHMEM_ERR_MUTEX, strerror(error), true);
+        }
+    }
+    else
+    {
+        code = check_attach(handle, user_data_size, options, message);
+
+        if (code == SHMEM_OK && handle->shm->max_size != 0 && handle->reserved_size == 0)
+        {
+            code = reserve_growth(handle, populate, error);
+            message = strerror(error);
+        }
+
+        if (code != SHMEM_OK)
+        {
+            return fail_open(mshm, handle, names, code, message);
+        }
+    }
+
+    // data this handle can reach, grows with shmem_resize
+    code = sync_size(handle);
+
+    if (code != SHMEM_OK)
+    {
+        return fail_open(mshm, handle, names, code, shmem_error_string(code), init);
+    }
+
+    if (options.prefault & (SHMEM_PREFAULT_LOCK | SHMEM_PREFAULT_LOCK_ON_FAULT | SHMEM_PREFAULT_PARALLEL))
+    {
+        code = prefault_segment(handle, options, error);
+
+        if (code != SHMEM_OK)
+        {
+            return fail_open(mshm, handle, names, code, strerror(error), init);
+        }
+    }
+
+    if (handle->persistent)
+    {
+        // counted as a user before the next opener looks
+        file_lock(handle->h_fd, FILE_LOCK_USERS, F_RDLCK, true);
+        file_lock(handle->h_fd, FILE_LOCK_OPEN, F_UNLCK, false);
+    }
+
+    handle->created = init;
+    handle->restored = restore;
+    mshm = handle;
+    ret.error_code = SHMEM_OK;
+    ret.error_string = "No Error";
+
+    return ret;
+}
+
+
+// defined with the lock helpers below
+static ErrorCode flush_image(t_shmem_handle* handle, bool sync);
+
+Return mshm::shmem_close(mshm_handle mshm)
+{
+    Return ret = check_handle(mshm);
+
+    if (ret.error_code != SHMEM_OK)
+    {
+        return ret;
+    }
+
+    t_shmem_handle* handle = (t_shmem_handle*)(mshm);
+
+    // the last handle of a file-backed segment leaves a consistent image behind. Closers take
+    // turns on the open lock and drop their user lock first: of two concurrent closers the
+    // second one finds no user left, instead of both failing the upgrade
+    if (handle->persistent && file_lock(handle->h_fd, FILE_LOCK_OPEN, F_WRLCK, true))
+    {
+        file_lock(handle->h_fd, FILE_LOCK_USERS, F_UNLCK, false);
+
+        if (file_lock(handle->h_fd, FILE_LOCK_USERS, F_WRLCK, false))
+        {
+            flush_image(handle, true);
+        }
+
+        file_lock(handle->h_fd, FILE_LOCK_OPEN, F_UNLCK, false);
+    }
+
+    int error = munmap(handle->shm, mapping_span(handle)); // 0 = success
+
+    if (error)
+    {
+        ret.error_code = SHMEM_ERR_NOT_OPEN;
+        ret.error_string = strerror(errno);
+        return ret;
+    }
+
+    error = close(handle->h_fd); // 0 = success
+
+    if (error)
+    {
+        ret.error_code = SHMEM_ERR_NOT_OPEN;
+        ret.error_string = strerror(errno);
+        return ret;
+    }
+
+    handle->shm = NULL;
+    handle->h_fd = -1;
+    handle->total_size = 0;
+
+    return ret;
+}
+
+Return mshm::shmem_delete(const char* name)
+{
+    Return ret;
+
+    if (name == nullptr)
+    {
+        ret.error_code = SHMEM_ERR_PARAM;
+        ret.error_string = "Invalid parameters";
+        return ret;
+    }
+
+    int error = shm_unlink(name); // 0 = success
+
+    if (error)
+    {
+        ret.error_code = SHMEM_ERR_DELETE;
+        ret.error_string = strerror(errno);
+
+        // huge page segments live on hugetlbfs instead
+        for (size_t page_size : { HUGE_PAGE_2M, HUGE_PAGE_1G })
+        {
+            std::string mount = hugetlbfs_mount(page_size);
+
+            if (!mount.empty() && is_valid_shm_name(name) && unlink((mount + "/" + name).c_str()) == 0)
+            {
+                ret.error_code = SHMEM_OK;
+                ret.error_string = "No Error";
+                break;
+            }
+        }
+    }
+
+    return ret;
+}
+
+
+// map a segment file descriptor that did not come from shm_open: a sealed one read only,
+// a resizable one with room to grow, as shmem_open would
+static ErrorCode map_descriptor(t_shmem_handle* handle, int& error)
+{
+    int seals = fcntl(handle->h_fd, F_GET_SEALS); // -1 = not a memfd, never sealed
+
+    handle->sealed = seals > 0 && (seals & F_SEAL_WRITE);
+    handle->reserved_size = 0;
+    error = 0;
+
+    ErrorCode code = map_segment(handle, false, false, false, error);
+
+    if (code == SHMEM_OK && handle->shm->ready.load(std::memory_order_acquire) != SEGMENT_READY)
+    {
+        unmap_segment(handle);
+        code = SHMEM_ERR_NOT_OPEN;
+    }
+
+    if (code == SHMEM_OK && !handle->sealed && handle->shm->max_size != 0)
+    {
+        size_t reserved_size = sizeof(shmem_internal_t) + handle->shm->max_size;
+        unmap_segment(handle);
+        handle->shm = nullptr;
+        handle->reserved_size = reserved_size;
+        code = map_segment(handle, false, false, false, error);
+    }
+
+    if (code != SHMEM_OK)
+    {
+        handle->shm = nullptr;
+        return code;
+    }
+
+    handle->size_generation.store(UINT64_MAX, std::memory_order_relaxed);
+    code = sync_size(handle);
+
+    if (code != SHMEM_OK)
+    {
+        unmap_segment(handle);
+        handle->shm = nullptr;
+    }
+
+    return code;
+}
+
+
+Return mshm::shmem_create_anonymous(mshm_handle& mshm, size_t user_data_size, const OpenOptions& options)
+{
+    mshm = nullptr;
+
+    Return ret = validate_options(user_data_size, options);
+
+    if (ret.error_code != SHMEM_OK)
+    {
+        return ret;
+    }
+
+    if (options.page_size != SHMEM_PAGE_DEFAULT || options.persist_dir != nullptr)
+    {
+        ret.error_code = SHMEM_ERR_PARAM;
+        ret.error_string = "Anonymous segments use default pages and no file";
+        return ret;
+    }
+
+    t_shmem_handle* handle = new t_shmem_handle();
+    handle->total_size = segment_total_size(user_data_size, options);
+    handle->reserved_size = options.max_size ? sizeof(shmem_internal_t) + options.max_size : 0;
+
+    // no name anywhere: the segment lives as long as a descriptor or a mapping of it
+    handle->h_fd = memfd_create("mshm", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+
+    if (handle->h_fd < 0)
+    {
+        ret.error_code = SHMEM_ERR_OPEN;
+        ret.error_string = strerror(errno);
+        delete handle;
+        return ret;
+    }
+
+    int error = 0;
+    bool populate = (options.prefault & SHMEM_PREFAULT_POPULATE) && options.numa_policy == SHMEM_NUMA_DEFAULT;
+    ErrorCode code = map_segment(handle, true, false, populate, error);
+
+    if (code == SHMEM_OK && options.numa_policy != SHMEM_NUMA_DEFAULT)
+    {
+        code = apply_numa_policy(handle, options, error);
+
+        if (code == SHMEM_OK && (options.prefault & SHMEM_PREFAULT_POPULATE))
+        {
+            populate_range((unsigned char*)handle->shm, (unsigned char*)handle->shm + handle->total_size, (size_t)sysconf(_SC_PAGESIZE));
+        }
+    }
+
+    if (code == SHMEM_OK && (error = init_segment(handle, user_data_size, options)) != 0)
+    {
+        code = SHMEM_ERR_MUTEX;
+    }
+
+    if (code == SHMEM_OK && (code = sync_size(handle)) != SHMEM_OK)
+    {
+        error = ENOMEM;
+    }
+
+    if (code == SHMEM_OK && (options.prefault & (SHMEM_PREFAULT_LOCK | SHMEM_PREFAULT_LOCK_ON_FAULT | SHMEM_PREFAULT_PARALLEL)))
+    {
+        code = prefault_segment(handle, options, error);
+    }
+
+    if (code != SHMEM_OK)
+    {
+        if (handle->shm != nullptr) unmap_segment(handle);
+        close(handle->h_fd);
+        ret.error_code = code;
+        ret.error_string = strerror(error);
+        delete handle;
+        return ret;
+    }
+
+    handle->created = true;
+    mshm = handle;
+    ret.error_code = SHMEM_OK;
+    ret.error_string = "No Error";
+
+    return ret;
+}
+
+
+Return mshm::shmem_send_fd(mshm_handle mshm, int socket)
+{
+    Return ret = check_handle(mshm);
+
+    if (ret.error_code != SHMEM_OK)
+    {
+        return ret;
+    }
+
+    t_shmem_handle* handle = (t_shmem_handle*)(mshm);
+
+    // one byte of payload carries the descriptor
+    char byte = 0;
+    struct iovec iov = { &byte, 1 };
+
+    union
+    {
+        struct cmsghdr header;
+        char buffer[CMSG_SPACE(sizeof(int))];
+    } control;
+    memset(&control, 0, sizeof(control));
+
+    struct msghdr msg = {};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buffer;
+    msg.msg_controllen = sizeof(control.buffer);
+
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &handle->h_fd, sizeof(int));
+
+    ssize_t sent;
+    do
+    {
+        sent = sendmsg(socket, &msg, MSG_NOSIGNAL);
+    }
+    while (sent < 0 && errno == EINTR);
+
+    if (sent != 1)
+    {
+        ret.error_code = SHMEM_ERR_OPEN;
+        ret.error_string = sent < 0 ? strerror(errno) : "Segment descriptor was not sent";
+    }
+
+    return ret;
+}
+
+
+Return mshm::shmem_receive_fd(mshm_handle& mshm, int socket)
+{
+    Return ret;
+    mshm = nullptr;
+
+    char byte;
+    struct iovec iov = { &byte, 1 };
+
+    union
+    {
+        struct cmsghdr header;
+        char buffer[CMSG_SPACE(sizeof(int))];
+    } control;
+    memset(&control, 0, sizeof(control));
+
+    struct msghdr msg = {};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buffer;
+    msg.msg_controllen = sizeof(control.buffer);
+
+    ssize_t received;
+    do
+    {
+        received = recvmsg(socket, &msg, MSG_CMSG_CLOEXEC);
+    }
+    while (received < 0 && errno == EINTR);
+
+    if (received < 0)
+    {
+        ret.error_code = SHMEM_ERR_OPEN;
+        ret.error_string = strerror(errno);
+        return ret;
+    }
+
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+
+    if (received == 0 || cmsg == nullptr || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS
+        || cmsg->cmsg_len != CMSG_LEN(sizeof(int)))
+    {
+        ret.error_code = SHMEM_ERR_OPEN;
+        ret.error_string = "No segment descriptor received";
+        return ret;
+    }
+
+    t_shmem_handle* handle = new t_shmem_handle();
+    memcpy(&handle->h_fd, CMSG_DATA(cmsg), sizeof(int));
+
+    int error = 0;
+    ErrorCode code = map_descriptor(handle, error);
+
+    if (code != SHMEM_OK)
+    {
+        close(handle->h_fd);
+        ret.error_code = code;
+        ret.error_string = error ? strerror(error) : shmem_error_string(code);
+        delete handle;
+        return ret;
+    }
+
+    mshm = handle;
+    ret.error_code = SHMEM_OK;
+    ret.error_string = "No Error";
+
+    return ret;
+}
+
+
+Return mshm::shmem_seal(mshm_handle mshm)
+{
+    Return ret = check_handle(mshm);
+
+    if (ret.error_code != SHMEM_OK)
+    {
+        return ret;
+    }
+
+    t_shmem_handle* handle = (t_shmem_handle*)(mshm);
+
+    if (handle->sealed)
+    {
+        return ret;
+    }
+
+    if (fcntl(handle->h_fd, F_GET_SEALS) < 0)
+    {
+        ret.error_code = SHMEM_ERR_NOT_SUPPORTED;
+        ret.error_string = "Only segments of shmem_create_anonymous can be sealed";
+        return ret;
+    }
+
+    // the kernel refuses F_SEAL_WRITE while any writable shared mapping exists, ours included
+    unmap_segment(handle);
+    handle->shm = nullptr;
+
+    int seal_error = 0;
+
+    if (fcntl(handle->h_fd, F_ADD_SEALS, F_SEAL_WRITE | F_SEAL_GROW | F_SEAL_SHRINK | F_SEAL_SEAL) != 0)
+    {
+        seal_error = errno;
+    }
+
+    // sealed: read only from now on; refused: back to the writable mapping
+    int error = 0;
+    ErrorCode code = map_descriptor(handle, error);
+
+    if (code != SHMEM_OK)
+    {
+        close(handle->h_fd);
+        handle->h_fd = -1;
+        ret.error_code = code;
+        ret.error_string = error ? strerror(error) : shmem_error_string(code);
+        return ret;
+    }
+
+    if (seal_error == EBUSY)
+    {
+        ret.error_code = SHMEM_ERR_MMAP;
+        ret.error_string = "Another handle still maps the segment writable";
+    }
+    else if (seal_error != 0)
+    {
+        ret.error_code = SHMEM_ERR_NOT_SUPPORTED;
+        ret.error_string = strerror(seal_error);
+    }
+
+    return ret;
+}
+
+
+static inline long futex(std::atomic<uint32_t>* word, int op, uint32_t val, const struct timespec* timeout)
+{
+    // no FUTEX_PRIVATE_FLAG: the word is shared between processes
+    return syscall(SYS_futex, (uint32_t*)word, op, val, timeout, nullptr, 0);
+}
+
+// wake whoever sleeps in shmem_wait_changed. Waiters compare the generation, so the shared
+// futex word is only written when somebody sleeps on it
+static inline void notify_change(t_shmem_handle* handle)
+{
+    // the generation bump before the waiters check, pairs with the fence in shmem_wait_changed
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    if (handle->shm->waiters.load(std::memory_order_relaxed) != 0)
+    {
+        handle->shm->changes.fetch_add(1);
+        futex(&handle->shm->changes, FUTEX_WAKE, INT32_MAX, nullptr);
+    }
+}
+
+
+// stats: every helper is a single branch on the header flag when the segment has no stats
+static inline bool stats_enabled(t_shmem_handle* handle)
+{
+    return handle->shm->stats_enabled != 0;
+}
+
+static inline uint64_t stats_now(t_shmem_handle* handle)
+{
+    if (!stats_enabled(handle))
+    {
+        return 0;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ull + (uint64_t)now.tv_nsec;
+}
+
+// a lock was taken; wait_start != 0 if the try-lock failed and we had to wait
+static inline void stats_lock(t_shmem_handle* handle, uint64_t wait_start)
+{
+    if (!stats_enabled(handle))
+    {
+        return;
+    }
+
+    stats_block_t& stats = handle->shm->stats;
+    stats.lock_acquisitions.fetch_add(1, std::memory_order_relaxed);
+
+    if (wait_start != 0)
+    {
+        stats.contended_acquisitions.fetch_add(1, std::memory_order_relaxed);
+        stats.lock_wait_ns.fetch_add(stats_now(handle) - wait_start, std::memory_order_relaxed);
+    }
+}
+
+// called just before unlocking a lock taken at held_since
+static inline void stats_hold(t_shmem_handle* handle, uint64_t held_since)
+{
+    if (!stats_enabled(handle))
+    {
+        return;
+    }
+
+    uint64_t held = stats_now(handle) - held_since;
+    std::atomic<uint64_t>& max = handle->shm->stats.max_lock_hold_ns;
+    uint64_t current = max.load(std::memory_order_relaxed);
+
+    while (held > current && !max.compare_exchange_weak(current, held, std::memory_order_relaxed))
+    {
+    }
+}
+
+static inline void stats_copy(t_shmem_handle* handle, bool write, uint64_t bytes)
+{
+    if (!stats_enabled(handle))
+    {
+        return;
+    }
+
+    stats_block_t& stats = handle->shm->stats;
+    (write ? stats.writes : stats.reads).fetch_add(1, std::memory_order_relaxed);
+    (write ? stats.bytes_written : stats.bytes_read).fetch_add(bytes, std::memory_order_relaxed);
+}
+
+
+// locks the segment mutex following the policy stored in the header.
+// Returns true with the lock held: ret is SHMEM_ERR_OWNER_DEAD if the lock was recovered from a dead process
+static inline struct timespec lock_deadline(t_shmem_handle* handle)
+{
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += handle->shm->lock_timeout_ms / 1000;
+    deadline.tv_nsec += (long)(handle->shm->lock_timeout_ms % 1000) * 1000000;
+
+    if (deadline.tv_nsec >= 1000000000)
+    {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+    }
+
+    return deadline;
+}
+
+static bool lock_mutex(t_shmem_handle* handle, pthread_mutex_t* mutex, ErrorCode& code)
+{
+    // with stats, a failed try-lock is what makes an acquisition contended
+    int error = stats_enabled(handle) ? pthread_mutex_trylock(mutex) : EBUSY;
+    uint64_t wait_start = 0;
+
+    if (error == EBUSY)
+    {
+        wait_start = stats_now(handle);
+
+        if (handle->shm->lock_timeout_ms >= 0)
+        {
+            struct timespec deadline = lock_deadline(handle);
+            error = pthread_mutex_clocklock(mutex, CLOCK_MONOTONIC, &deadline); // 0 = success
+        }
+        else
+        {
+            error = pthread_mutex_lock(mutex); // 0 = success
+        }
+    }
+
+    if (error == 0 || error == EOWNERDEAD)
+    {
+        stats_lock(handle, wait_start);
+    }
+
+    if (error == EOWNERDEAD)
+    {
+        // robust mutex: the holder died, we own the lock now
+        pthread_mutex_consistent(mutex);
+
+        // a writer killed in the middle of a seqlock write would block readers forever
+        for (std::atomic<uint64_t>* sequence : { &handle->shm->sequence, &handle->shm->buffer_sequence[0],
+                                                 &handle->shm->buffer_sequence[1], &handle->shm->buffer_sequence[2] })
+        {
+            uint64_t seq = sequence->load(std::memory_order_relaxed);
+
+            if (seq & 1)
+            {
+                sequence->store(seq + 1, std::memory_order_release);
+            }
+        }
+
+        code = SHMEM_ERR_OWNER_DEAD;
+        return true;
+    }
+
+    if (error == ETIMEDOUT)
+    {
+        code = SHMEM_ERR_TIMEOUT;
+        return false;
+    }
+
+    if (error)
+    {
+        // EDEADLK, ENOTRECOVERABLE or not initialized
+        code = SHMEM_ERR_MUTEX;
+        return false;
+    }
+
+    return true;
+}
+
+static bool unlock_mutex(pthread_mutex_t* mutex, ErrorCode& code)
+{
+    int error = pthread_mutex_unlock(mutex); // 0 = success
+
+    if (error)
+    {
+        // EPERM: the calling thread does not own the mutex
+        code = SHMEM_ERR_MUTEX;
+        return false;
+    }
+
+    return true;
+}
+
+static inline bool lock_mutex(t_shmem_handle* handle, ErrorCode& code)
+{
+    return lock_mutex(handle, &handle->shm->mutex, code);
+}
+
+static inline bool unlock_mutex(t_shmem_handle* handle, ErrorCode& code)
+{
+    return unlock_mutex(&handle->shm->mutex, code);
+}
+
+// SHMEM_SYNC_RWLOCK: shared for readers, exclusive for writers
+static bool lock_rwlock(t_shmem_handle* handle, bool shared, ErrorCode& code)
+{
+    int error = EBUSY;
+    uint64_t wait_start = 0;
+
+    if (stats_enabled(handle))
+    {
+        error = shared ? pthread_rwlock_tryrdlock(&handle->shm->rwlock) : pthread_rwlock_trywrlock(&handle->shm->rwlock);
+    }
+
+    if (error == EBUSY)
+    {
+        wait_start = stats_now(handle);
+
+        if (handle->shm->lock_timeout_ms >= 0)
+        {
+            struct timespec deadline = lock_deadline(handle);
+            error = shared ? pthread_rwlock_clockrdlock(&handle->shm->rwlock, CLOCK_MONOTONIC, &deadline)
+                           : pthread_rwlock_clockwrlock(&handle->shm->rwlock, CLOCK_MONOTONIC, &deadline);
+        }
+        else
+        {
+            error = shared ? pthread_rwlock_rdlock(&handle->shm->rwlock) : pthread_rwlock_wrlock(&handle->shm->rwlock);
+        }
+    }
+
+    if (error == 0)
+    {
+        stats_lock(handle, wait_start);
+    }
+
+    if (error == ETIMEDOUT)
+    {
+        code = SHMEM_ERR_TIMEOUT;
+        return false;
+    }
+
+    if (error)
+    {
+        // EDEADLK, EAGAIN (too many readers) or not initialized
+        code = SHMEM_ERR_MUTEX;
+        return false;
+    }
+
+    return true;
+}
+
+// stripes covering [begin, end) of the data; without stripes the range is just the segment mutex
+static inline void stripe_range(t_shmem_handle* handle, uint64_t begin, uint64_t end, uint32_t& first, uint32_t& last)
+{
+    if (handle->shm->lock_stripes == 0)
+    {
+        first = last = 0;
+        return;
+    }
+
+    uint32_t max = handle->shm->lock_stripes - 1;
+    first = (uint32_t)(begin / handle->shm->stripe_size);
+    last = end > begin ? (uint32_t)((end - 1) / handle->shm->stripe_size) : first;
+    if (first > max) first = max;
+    if (last > max) last = max;
+}
+
+// always in address order, so two ranges can not deadlock.
+// shared: the caller only reads (matters for the reader/writer lock only)
+static bool lock_range(t_shmem_handle* handle, uint32_t first, uint32_t last, bool shared, ErrorCode& code)
+{
+    if (handle->shm->sync_mode == SHMEM_SYNC_RWLOCK)
+    {
+        return lock_rwlock(handle, shared, code);
+    }
+
+    if (handle->shm->lock_stripes == 0)
+    {
+        return lock_mutex(handle, code);
+    }
+
+    for (uint32_t i = first; i <= last; ++i)
+    {
+        if (!lock_mutex(handle, &stripe_at(handle, i)->mutex, code))
+        {
+            ErrorCode ignored;
+            while (i-- > first) unlock_mutex(&stripe_at(handle, i)->mutex, ignored);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static bool unlock_range(t_shmem_handle* handle, uint32_t first, uint32_t last, ErrorCode& code)
+{
+    if (handle->shm->sync_mode == SHMEM_SYNC_RWLOCK)
+    {
+        if (pthread_rwlock_unlock(&handle->shm->rwlock))
+        {
+            code = SHMEM_ERR_MUTEX;
+            return false;
+        }
+
+        return true;
+    }
+
+    if (handle->shm->lock_stripes == 0)
+    {
+        return unlock_mutex(handle, code);
+    }
+
+    bool success = true;
+
+    for (uint32_t i = last + 1; i-- > first; )
+    {
+        success = unlock_mutex(&stripe_at(handle, i)->mutex, code) && success;
+    }
+
+    return success;
+}
+
+template <typename Entry>
+static inline uint64_t entries_bytes(const Entry* entries, size_t count)
+{
+    uint64_t bytes = 0;
+    for (size_t i = 0; i < count; ++i) bytes += entries[i].size;
+    return bytes;
+}
+
+// smallest range covering every fragment of a scatter / gather call
+template <typename Entry>
+static inline void entries_span(const Entry* entries, size_t count, uint64_t& begin, uint64_t& end)
+{
+    begin = count ? entries[0].offset : 0;
+    end = begin;
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        if (entries[i].offset < begin) begin = entries[i].offset;
+        if (entries[i].offset + entries[i].size > end) end = entries[i].offset + entries[i].size;
+    }
+}
+
+// seqlock writer side, called with the mutex held: the mutex only serializes writers, readers just watch the sequence
+static inline void seq_write_begin(std::atomic<uint64_t>& sequence)
+{
+    uint64_t seq = sequence.load(std::memory_order_relaxed);
+    sequence.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+}
+
+static inline void seq_write_end(std::atomic<uint64_t>& sequence)
+{
+    uint64_t seq = sequence.load(std::memory_order_relaxed);
+    sequence.store(seq + 1, std::memory_order_release);
+}
+
+// seqlock reader side: wait until no writer is in progress
+static inline uint64_t seq_read_begin(std::atomic<uint64_t>& sequence)
+{
+    uint64_t seq = sequence.load(std::memory_order_acquire);
+
+    while (seq & 1)
+    {
+        internal::cpu_relax();
+        seq = sequence.load(std::memory_order_acquire);
+    }
+
+    return seq;
+}
+
+// true if nothing was written since seq_read_begin returned seq
+static inline bool seq_read_validate(std::atomic<uint64_t>& sequence, uint64_t seq)
+{
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return sequence.load(std::memory_order_relaxed) == seq;
+}
+
+
+// triple buffer: copy i starts at data + i * stride
+static inline unsigned char* triple_buffer(t_shmem_handle* handle, uint32_t index)
+{
+    return &handle->shm->data[index * buffer_stride(handle->shm->data_size)];
+}
+
+// a sealed segment never changes again: its current data, read without any lock
+static inline const unsigned char* sealed_data(t_shmem_handle* handle, uint64_t& generation)
+{
+    if (handle->shm->sync_mode == SHMEM_SYNC_TRIPLE_BUFFER)
+    {
+        uint32_t index = handle->shm->latest.load(std::memory_order_acquire);
+        generation = handle->shm->buffer_generation[index].load(std::memory_order_relaxed);
+        return triple_buffer(handle, index);
+    }
+
+    generation = handle->shm->sequence.load(std::memory_order_acquire) / 2;
+    return handle->shm->data;
+}
+
+static inline uint32_t triple_index(t_shmem_handle* handle, const void* ptr)
+{
+    return (uint32_t)(((const unsigned char*)ptr - handle->shm->data) / buffer_stride(handle->shm->data_size));
+}
+
+// called with the mutex held: the back buffer is the one published two writes ago,
+// so a slow reader gets a whole write period before its copy is reused (and then just retries)
+static inline uint32_t triple_back_begin(t_shmem_handle* handle)
+{
+    uint32_t back = (handle->shm->latest.load(std::memory_order_relaxed) + 1) % 3;
+    seq_write_begin(handle->shm->buffer_sequence[back]);
+    return back;
+}
+
+// striped writers count their writes on the first stripe they hold, so writers of disjoint
+// stripes share no cache line. Block versions need one order for the whole segment: with
+// dirty_block_size the striped writers fall back to the header sequence
+static inline bool stripe_generations(t_shmem_handle* handle)
+{
+    return handle->shm->lock_stripes != 0 && handle->shm->dirty_block_size == 0;
+}
+
+// called with the mutex (or stripe first) held in mutex and triple buffer mode: count a
+// completed write, so that every mode reports the generation as sequence / 2 (seqlock gets
+// it for free). With stripe generations the result is not a version and must not be used
+static inline uint64_t bump_generation(t_shmem_handle* handle, uint32_t first = 0)
+{
+    if (stripe_generations(handle))
+    {
+        // only the holder of the stripe writes it: no locked instruction needed
+        std::atomic<uint64_t>& generation = stripe_at(handle, first)->generation;
+        generation.store(generation.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        return 0;
+    }
+
+    // fetch_add: striped writers with block versions bump it concurrently
+    return (handle->shm->sequence.fetch_add(2, std::memory_order_relaxed) + 2) / 2;
+}
+
+// completed writes so far: every write bumps exactly one counter, so the sum grows on every
+// write and two equal values saw the same data
+static inline uint64_t current_generation(t_shmem_handle* handle)
+{
+    if (stripe_generations(handle))
+    {
+        uint64_t sum = 0;
+
+        for (uint32_t i = 0; i < handle->shm->lock_stripes; ++i)
+        {
+            sum += stripe_at(handle, i)->generation.load(std::memory_order_acquire);
+        }
+
+        return sum;
+    }
+
+    return handle->shm->sequence.load(std::memory_order_acquire) / 2;
+}
+
+// generation a seqlock write in progress (odd sequence) will publish
+static inline uint64_t seq_write_generation(t_shmem_handle* handle)
+{
+    return (handle->shm->sequence.load(std::memory_order_relaxed) + 1) / 2;
+}
+
+// stamp the blocks of [begin, end) with the generation of the write covering them
+static inline void mark_dirty(t_shmem_handle* handle, uint64_t begin, uint64_t end, uint64_t generation)
+{
+    size_t block_size = handle->shm->dirty_block_size;
+
+    if (block_size == 0 || end <= begin)
+    {
+        return;
+    }
+
+    for (uint64_t i = begin / block_size; i <= (end - 1) / block_size; ++i)
+    {
+        dirty_at(handle, i)->store(generation, std::memory_order_relaxed);
+    }
+}
+
+static inline void triple_publish(t_shmem_handle* handle, uint32_t back)
+{
+    handle->shm->buffer_generation[back].store(bump_generation(handle), std::memory_order_relaxed);
+    seq_write_end(handle->shm->buffer_sequence[back]);
+    handle->shm->latest.store(back, std::memory_order_release);
+}
+
+// reader side: locate the newest complete snapshot, returns its index and sequence
+static inline uint32_t triple_read_begin(t_shmem_handle* handle, uint64_t& seq)
+{
+    for (;;)
+    {
+        uint32_t index = handle->shm->latest.load(std::memory_order_acquire);
+        seq = handle->shm->buffer_sequence[index].load(std::memory_order_acquire);
+
+        if (!(seq & 1))
+        {
+            return index;
+        }
+
+        internal::cpu_relax();
+    }
+}
+
+
+// copy path of a write whose arguments are checked: shmem_write_ec, shmem_write_unchecked_ec
+static inline ErrorCode write_data(t_shmem_handle* handle, const void* src, size_t size, uint64_t offset) noexcept
+{
+    ErrorCode code = SHMEM_OK;
+
+    uint32_t first, last;
+    stripe_range(handle, offset, offset + size, first, last);
+
+    if (!lock_range(handle, first, last, false, code))
+    {
+        return code;
+    }
+
+    uint64_t held_since = stats_now(handle);
+
+    if (handle->shm->sync_mode == SHMEM_SYNC_SEQLOCK)
+    {
+        seq_write_begin(handle->shm->sequence);
+        memcpy(&handle->shm->data[offset], src, size);
+        mark_dirty(handle, offset, offset + size, seq_write_generation(handle));
+        seq_write_end(handle->shm->sequence);
+    }
+    else if (handle->shm->sync_mode == SHMEM_SYNC_TRIPLE_BUFFER)
+    {
+        // fill the back buffer carrying forward the bytes this write does not touch
+        const unsigned char* front = triple_buffer(handle, handle->shm->latest.load(std::memory_order_relaxed));
+        uint32_t back_index = triple_back_begin(handle);
+        unsigned char* back = triple_buffer(handle, back_index);
+
+        memcpy(back, front, offset);
+        memcpy(&back[offset], src, size);
+        memcpy(&back[offset + size], &front[offset + size], handle->shm->data_size - offset - size);
+
+        triple_publish(handle, back_index);
+    }
+    else
+    {
+        memcpy(&handle->shm->data[offset], src, size);
+        mark_dirty(handle, offset, offset + size, bump_generation(handle, first));
+    }
+
+    stats_hold(handle, held_since);
+    stats_copy(handle, true, size);
+
+    if (unlock_range(handle, first, last, code))
+    {
+        notify_change(handle);
+    }
+
+    return code;
+}
+
+ErrorCode mshm::shmem_write_ec(mshm_handle mshm, const void* src, size_t size, uint64_t offset) noexcept
+{
+    ErrorCode code = check_handle_ec(mshm);
+
+    if (code != SHMEM_OK)
+    {
+        return code;
+    }
+
+    if (src == nullptr)
+    {
+        return SHMEM_ERR_PARAM;
+    }
+
+    t_shmem_handle* handle = (t_shmem_handle*)(mshm);
+
+    if (handle->sealed)
+    {
+        return SHMEM_ERR_NOT_SUPPORTED;
+    }
+
+    size_t data_size = mapped_data_size(handle);
+
+    if (offset > data_size || size > data_size - offset)
+    {
+        return SHMEM_ERR_PARAM;
+    }
+
+    return write_data(handle, src, size, offset);
+}
+
+ErrorCode mshm::shmem_write_unchecked_ec(mshm_handle mshm, const void* src, size_t size, uint64_t offset) noexcept
+{
+    t_shmem_handle* handle = (t_shmem_handle*)(mshm);
+
+    // a flag of the handle, not of the arguments: the mapping is read-only
+    if (handle->sealed)
+    {
+        return SHMEM_ERR_NOT_SUPPORTED;
+    }
+
+    return write_data(handle, src, size, offset);
+}
+
+
+ErrorCode mshm::shmem_writev_ec(mshm_handle mshm, const WriteEntry* entries, size_t count) noexcept
+{
+    ErrorCode code = check_handle_ec(mshm);
+
+    if (code != SHMEM_OK)
+    {
+        return code;
+    }
+
+    if (entries == nullptr && count > 0)
+    {
+        return SHMEM_ERR_PARAM;
+    }
+
+    t_shmem_handle* handle = (t_shmem_handle*)(mshm);
+
+    if (handle->sealed)
+    {
+        return SHMEM_ERR_NOT_SUPPORTED;
+    }
+
+    size_t data_size = mapped_data_size(handle);
+
+    // validate everything before touching the segment: all fragments or none
+    for (size_t i = 0; i < count; ++i)
+    {
+        if (entries[i].src == nullptr)
+        {
+            return SHMEM_ERR_PARAM;
+        }
+
+        if (entries[i].offset > data_size || entries[i].size > data_size - entries[i].offset)
+        {
+            return SHMEM_ERR_PARAM;
+        }
+    }
+
+    uint64_t begin, end;
+    uint32_t first, last;
+    entries_span(entries, count, begin, end);
+    stripe_range(handle, begin, end, first, last);
+
+    if (!lock_range(handle, first, last, false, code))
+    {
+        return code;
+    }
+
+    uint64_t held_since = stats_now(handle);
+    unsigned char* data = handle->shm->data;
+    uint32_t back_index = 0;
+
+    if (handle->shm->sync_mode == SHMEM_SYNC_SEQLOCK)
+    {
+        seq_write_begin(handle->shm->sequence);
+    }
+    else if (handle->shm->sync_mode == SHMEM_SYNC_TRIPLE_BUFFER)
+    {
+        const unsigned char* front = triple_buffer(handle, handle->shm->latest.load(std::memory_order_relaxed));
+        back_index = triple_back_begin(handle);
+        data = triple_buffer(handle, back_index);
+        memcpy(data, front, handle->shm->data_size);
+    }
+
+    uint64_t bytes = 0;
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        memcpy(&data[entries[i].offset], entries[i].src, entries[i].size);
+        bytes += entries[i].size;
+    }
+
+    // readers see every fragment or none of them
+    if (handle->shm->sync_mode == SHMEM_SYNC_SEQLOCK)
+    {
+        uint64_t generation = seq_write_generation(handle);
+        for (size_t i = 0; i < count; ++i) mark_dirty(handle, entries[i].offset, entries[i].offset + entries[i].size, generation);
+        seq_write_end(handle->shm->sequence);
+    }
+    else if (handle->shm->sync_mode == SHMEM_SYNC_TRIPLE_BUFFER)
+    {
+        triple_publish(handle, back_index);
+    }
+    else
+    {
+        uint64_t generation = bump_generation(handle, first);
+        for (size_t i = 0; i < count; ++i) mark_dirty(handle, entries[i].offset, entries[i].offset + entries[i].size, generation);
+    }
+
+    stats_hold(handle, held_since);
+    stats_copy(handle, true, bytes);
+
+    if (unlock_range(handle, first, last, code))
+    {
+        notify_change(handle);
+    }
+
+    return code;
+}
+
+
+// copy path of a read whose arguments are checked: shmem_read_ec, shmem_read_unchecked_ec
+static inline ErrorCode read_data(t_shmem_handle* handle, void* dst, size_t size, uint64_t offset) noexcept
+{
+    ErrorCode code = SHMEM_OK;
+
+    if (handle->sealed)
+    {
+        uint64_t generation;
+        memcpy(dst, &sealed_data(handle, generation)[offset], size);
+        return code;
+    }
+
+    if (handle->shm->sync_mode == SHMEM_SYNC_SEQLOCK)
+    {
+        // optimistic copy: retry while a writer is in progress or has completed meanwhile
+        uint64_t seq;
+        do
+        {
+            seq = seq_read_begin(handle->shm->sequence);
+            memcpy(dst, &handle->shm->data[offset], size);
+        }
+        while (!seq_read_validate(handle->shm->sequence, seq));
+
+        stats_copy(handle, false, size);
+        return code;
+    }
+
+    if (handle->shm->sync_mode == SHMEM_SYNC_TRIPLE_BUFFER)
+    {
+        // newest complete snapshot, retry only if the writer lapped us
+        uint64_t seq;
+        uint32_t index;
+        do
+        {
+            index = triple_read_begin(handle, seq);
+            memcpy(dst, &triple_buffer(handle, index)[offset], size);
+        }
+        while (!seq_read_validate(handle->shm->buffer_sequence[index], seq));
+
+        stats_copy(handle, false, size);
+        return code;
+    }
+
+    uint32_t first, last;
+    stripe_range(handle, offset, offset + size, first, last);
+
+    if (!lock_range(handle, first, last, true, code))
+    {
+        return code;
+    }
+
+    uint64_t held_since = stats_now(handle);
+
+    memcpy(dst, &handle->shm->data[offset], size);
+
+    stats_hold(handle, held_since);
+    stats_copy(handle, false, size);
+
+    unlock_range(handle, first, last, code);
+
+    return code;
+}
+
+ErrorCode mshm::shmem_read_ec(mshm_handle mshm, void* dst, size_t size, uint64_t offset) noexcept
+{
+    ErrorCode code = check_handle_ec(mshm);
+
+    if (code != SHMEM_OK)
+    {
+        return code;
+    }
+
+    if (dst == nullptr)
+    {
+        return SHMEM_ERR_PARAM;
+    }
+
+    t_shmem_handle* handle = (t_shmem_handle*)(mshm);
+
+    size_t data_size = mapped_data_size(handle);
+
+    if (offset > data_size || size > data_size - offset)
+    {
+        return SHMEM_ERR_PARAM;
+    }
+
+    return read_data(handle, dst, size, offset);
+}
+
+ErrorCode mshm::shmem_read_unchecked_ec(mshm_handle mshm, void* dst, size_t size, uint64_t offset) noexcept
+{
+    return read_data((t_shmem_handle*)(mshm), dst, size, offset);
+}
+
+
+ErrorCode mshm::shmem_readv_ec(mshm_handle mshm, const ReadEntry* entries, size_t count, uint64_t& generation) noexcept
+{
+    ErrorCode code = check_handle_ec(mshm);
+
+    if (code != SHMEM_OK)
+    {
+        return code;
+    }
+
+    if (entries == nullptr && count > 0)
+    {
+        return SHMEM_ERR_PARAM;
+    }
+
+    t_shmem_handle* handle = (t_shmem_handle*)(mshm);
+    size_t data_size = mapped_data_size(handle);
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        if (entries[i].dst == nullptr)
+        {
+            return SHMEM_ERR_PARAM;
+        }
+
+        if (entries[i].offset > data_size || entries[i].size > data_size - entries[i].offset)
+        {
+            return SHMEM_ERR_PARAM;
+        }
+    }
+
+    if (handle->sealed)
+    {
+        const unsigned char* data = sealed_data(handle, generation);
+
+        for (size_t i = 0; i < count; ++i)
+        {
+            memcpy(entries[i].dst, &data[entries[i].offset], entries[i].size);
+        }
+
+        return code;
+    }
+
+    if (handle->shm->sync_mode == SHMEM_SYNC_SEQLOCK)
+    {
+        // the whole gather is retried, so all fragments come from the same write
+        uint64_t seq;
+        do
+        {
+            seq = seq_read_begin(handle->shm->sequence);
+
+            for (size_t i = 0; i < count; ++i)
+            {
+                memcpy(entries[i].dst, &handle->shm->data[entries[i].offset], entries[i].size);
+            }
+        }
+        while (!seq_read_validate(handle->shm->sequence, seq));
+
+        stats_copy(handle, false, entries_bytes(entries, count));
+        generation = seq / 2;
+        return code;
+    }
+
+    if (handle->shm->sync_mode == SHMEM_SYNC_TRIPLE_BUFFER)
+    {
+        uint64_t seq;
+        uint64_t gen;
+        uint32_t index;
+        do
+        {
+            index = triple_read_begin(handle, seq);
+            gen = handle->shm->buffer_generation[index].load(std::memory_order_relaxed);
+            const unsigned char* data = triple_buffer(handle, index);
+
+            for (size_t i = 0; i < count; ++i)
+            {
+                memcpy(entries[i].dst, &data[entries[i].offset], entries[i].size);
+            }
+        }
+        while (!seq_read_validate(handle->shm->buffer_sequence[index], seq));
+
+        stats_copy(handle, false, entries_bytes(entries, count));
+        generation = gen;
+        return code;
+    }
+
+    uint64_t begin, end;
+    uint32_t first, last;
+    entries_span(entries, count, begin, end);
+    stripe_range(handle, begin, end, first, last);
+
+    if (!lock_range(handle, first, last, true, code))
+    {
+        return code;
+    }
+
+    uint64_t held_since = stats_now(handle);
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        memcpy(entries[i].dst, &handle->shm->data[entries[i].offset], entries[i].size);
+    }
+
+    generation = current_generation(handle);
+
+    stats_hold(handle, held_since);
+    stats_copy(handle, false, entries_bytes(entries, count));
+
+    unlock_range(handle, first, last, code);
+
+    return code;
+}
+
+
+ErrorCode mshm::shmem_read_changed_ec(mshm_handle mshm, void* dst, uint64_t& version) noexcept
+{
+    ErrorCode code = check_handle_ec(mshm);
+
+    if (code != SHMEM_OK)
+    {
+        return code;
+    }
+
+    if (dst == nullptr)
+    {
+        return SHMEM_ERR_PARAM;
+    }
+
+    t_shmem_handle* handle = (t_shmem_handle*)(mshm);
+    size_t block_size = handle->shm->dirty_block_size;
+
+    if (block_size == 0)
+    {
+        return SHMEM_ERR_NOT_SUPPORTED;
+    }
+
+    size_t data_size = handle->shm->data_size;
+    size_t blocks = dirty_blocks(data_size, block_size);
+    uint64_t since = version;
+
+    auto copy_changed = [&]()
+    {
+        for (size_t i = 0; i < blocks; ++i)
+        {
+            if (dirty_at(handle, i)->load(std::memory_order_relaxed) > since)
+            {
+                size_t begin = i * block_size;
+                size_t size = begin + block_size > data_size ? data_size - begin : block_size;
+                memcpy((unsigned char*)dst + begin, &handle->shm->data[begin], size);
+            }
+        }
+    };
+
+    if (handle->sealed)
+    {
+        copy_changed();
+        sealed_data(handle, version);
+        return code;
+    }
+
+    if (handle->shm->sync_mode == SHMEM_SYNC_SEQLOCK)
+    {
+        // a write landing meanwhile stamps its blocks past since, so the retry copies them again
+        uint64_t seq;
+        do
+        {
+            seq = seq_read_begin(handle->shm->sequence);
+            copy_changed();
+        }
+        while (!seq_read_validate(handle->shm->sequence, seq));
+
+        version = seq / 2;
+        return code;
+    }
+
+    uint32_t first, last;
+    stripe_range(handle, 0, data_size, first, last);
+
+    if (!lock_range(handle, first, last, true, code))
+    {
+        return code;
+    }
+
+    copy_changed();
+    version = handle->shm->sequence.load(std::memory_order_relaxed) / 2;
+
+    unlock_range(handle, first, last, code);
+
+    return code;
+}
+
+
+ErrorCode mshm::shmem_acquire_view_ec(mshm_handle mshm, View& view, ViewMode mode, size_t size, uint64_t offset) noexcept
+{
+    ErrorCode code = check_handle_ec(mshm);
+
+    view = View();
+
+    if (code != SHMEM_OK)
+    {
+        return code;
+    }
+
+    if (mode != SHMEM_VIEW_READ && mode != SHMEM_VIEW_WRITE)
+    {
+        return SHMEM_ERR_PARAM;
+    }
+
+    t_shmem_handle* handle = (t_shmem_handle*)(mshm);
+
+    size_t data_size = mapped_data_size(handle);
+
+    if (size == 0 || offset > data_size || size > data_size - offset)
+    {
+        return SHMEM_ERR_PARAM;
+    }
+
+    unsigned char* base = handle->shm->data;
+
+    if (handle->sealed)
+    {
+        if (mode == SHMEM_VIEW_WRITE)
+        {
+            return SHMEM_ERR_NOT_SUPPORTED;
+        }
+
+        // nothing can change under the view: no lock, nothing to validate on release
+        base = (unsigned char*)sealed_data(handle, view.sequence);
+    }
+    else if (mode == SHMEM_VIEW_READ && handle->shm->sync_mode == SHMEM_SYNC_SEQLOCK)
+    {
+        // no lock: shmem_release_view tells if a writer got in meanwhile
+        view.sequence = seq_read_begin(handle->shm->sequence);
+    }
+    else if (mode == SHMEM_VIEW_READ && handle->shm->sync_mode == SHMEM_SYNC_TRIPLE_BUFFER)
+    {
+        base = triple_buffer(handle, triple_read_begin(handle, view.sequence));
+    }
+    else
+    {
+        uint32_t first, last;
+        stripe_range(handle, offset, offset + size, first, last);
+
+        if (!lock_range(handle, first, last, mode == SHMEM_VIEW_READ, code))
+        {
+            return code;
+        }
+
+        if (mode == SHMEM_VIEW_WRITE && handle->shm->sync_mode == SHMEM_SYNC_SEQLOCK)
+        {
+            seq_write_begin(handle->shm->sequence);
+        }
+        else if (mode == SHMEM_VIEW_WRITE && handle->shm->sync_mode == SHMEM_SYNC_TRIPLE_BUFFER)
+        {
+            // the caller edits a full copy of the current snapshot, published on release
+            const unsigned char* front = triple_buffer(handle, handle->shm->latest.load(std::memory_order_relaxed));
+            base = triple_buffer(handle, triple_back_begin(handle));
+            memcpy(base, front, handle->shm->data_size);
+        }
+    }
+
+    view.shm = mshm;
+    view.data = &base[offset];
+    view.size = size;
+    view.mode = mode;
+
+    return code;
+}
+
+
+ErrorCode mshm::shmem_release_view_ec(View& view) noexcept
+{
+    ErrorCode code = check_handle_ec(view.shm);
+
+    if (code != SHMEM_OK)
+    {
+        return code;
+    }
+
+    t_shmem_handle* handle = (t_shmem_handle*)(view.shm);
+
+    if (handle->sealed)
+    {
+        // read only, taken without lock
+    }
+    else if (view.mode == SHMEM_VIEW_READ && (handle->shm->sync_mode == SHMEM_SYNC_SEQLOCK || handle->shm->sync_mode == SHMEM_SYNC_TRIPLE_BUFFER))
+    {
+        std::atomic<uint64_t>& sequence = handle->shm->sync_mode == SHMEM_SYNC_SEQLOCK
+            ? handle->shm->sequence
+            : handle->shm->buffer_sequence[triple_index(handle, view.data)];
+
+        if (!seq_read_validate(sequence, view.sequence))
+        {
+            code = SHMEM_ERR_COPY;
+        }
+    }
+    else
+    {
+        uint64_t offset = (unsigned char*)view.data - handle->shm->data;
+        uint32_t first, last;
+        stripe_range(handle, offset, offset + view.size, first, last);
+
+        if (view.mode == SHMEM_VIEW_WRITE && handle->shm->sync_mode == SHMEM_SYNC_SEQLOCK)
+        {
+            mark_dirty(handle, offset, offset + view.size, seq_write_generation(handle));
+            seq_write_end(handle->shm->sequence);
+        }
+        else if (view.mode == SHMEM_VIEW_WRITE && handle->shm->sync_mode == SHMEM_SYNC_TRIPLE_BUFFER)
+        {
+            triple_publish(handle, triple_index(handle, view.data));
+        }
+        else if (view.mode == SHMEM_VIEW_WRITE)
+        {
+            mark_dirty(handle, offset, offset + view.size, bump_generation(handle, first));
+        }
+
+        if (unlock_range(handle, first, last, code) && view.mode == SHMEM_VIEW_WRITE)
+        {
+            notify_change(handle);
+        }
+    }
+
+    view = View();
+
+    return code;
+}
+
+
+// Return API: thin wrappers, the message comes from the static table
+Return mshm::shmem_write(mshm_handle mshm, const void* src, size_t size, uint64_t offset)
+{
+    return internal::make_return(shmem_write_ec(mshm, src, size, offset));
+}
+
+Return mshm::shmem_writev(mshm_handle mshm, const WriteEntry* entries, size_t count)
+{
+    return internal::make_return(shmem_writev_ec(mshm, entries, count));
+}
+
+Return mshm::shmem_read(mshm_handle mshm, void* dst, size_t size, uint64_t offset)
+{
+    return internal::make_return(shmem_read_ec(mshm, dst, size, offset));
+}
+
+Return mshm::shmem_readv(mshm_handle mshm, const ReadEntry* entries, size_t count, uint64_t& generation)
+{
+    return internal::make_return(shmem_readv_ec(mshm, entries, count, generation));
+}
+
+Return mshm::shmem_read_changed(mshm_handle mshm, void* dst, uint64_t& version)
+{
+    return internal::make_return(shmem_read_changed_ec(mshm, dst, version));
+}
+
+Return mshm::shmem_acquire_view(mshm_handle mshm, View& view, ViewMode mode, size_t size, uint64_t offset)
+{
+    return internal::make_return(shmem_acquire_view_ec(mshm, view, mode, size, offset));
+}
+
+Return mshm::shmem_release_view(View& view)
+{
+    return internal::make_return(shmem_release_view_ec(view));
+}
+
+
+Return mshm::shmem_stats(mshm_handle mshm, Stats& stats)
+{
+    Return ret = check_handle(mshm);
+
+    if (ret.error_code != SHMEM_OK)
+    {
+        return ret;
+    }
+
+    t_shmem_handle* handle = (t_shmem_handle*)(mshm);
+
+    if (!stats_enabled(handle))
+    {
+        ret.error_code = SHMEM_ERR_NOT_SUPPORTED;
+        ret.error_string = "Shared memory was created without stats";
+        return ret;
+    }
+
+    // relaxed loads: a snapshot for monitoring, counters may move while we read them
+    const stats_block_t& block = handle->shm->stats;
+    stats.reads = block.reads.load(std::memory_order_relaxed);
+    stats.writes = block.writes.load(std::memory_order_relaxed);
+    stats.bytes_read = block.bytes_read.load(std::memory_order_relaxed);
+    stats.bytes_written = block.bytes_written.load(std::memory_order_relaxed);
+    stats.lock_acquisitions = block.lock_acquisitions.load(std::memory_order_relaxed);
+    stats.contended_acquisitions = block.contended_acquisitions.load(std::memory_order_relaxed);
+    stats.lock_wait_ns = block.lock_wait_ns.load(std::memory_order_relaxed);
+    stats.max_lock_hold_ns = block.max_lock_hold_ns.load(std::memory_order_relaxed);
+
+    return ret;
+}
+
+
+Return mshm::shmem_wait_changed(mshm_handle mshm, uint32_t& last_seen, int timeout_ms, unsigned int spin_us)
+{
+    Return ret = check_handle(mshm);
+
+    if (ret.error_code != SHMEM_OK)
+    {
+        return ret;
+    }
+
+    t_shmem_handle* handle = (t_shmem_handle*)(mshm);
+
+    // a sealed segment never changes again, and its header is mapped read-only: no waiting
+    if (handle->sealed)
+    {
+        uint32_t current = (uint32_t)current_generation(handle);
+
+        if (current == last_seen)
+        {
+            ret.error_code = SHMEM_ERR_TIMEOUT;
+            ret.error_string = "A sealed segment is never written again";
+            return ret;
+        }
+
+        last_seen = current;
+        return ret;
+    }
+
+    std::atomic<uint32_t>& changes = handle->shm->changes;
+
+    auto now = std::chrono::steady_clock::now();
+    auto deadline = now + std::chrono::milliseconds(timeout_ms < 0 ? 0 : timeout_ms);
+    auto spin_deadline = now + std::chrono::microseconds(spin_us);
+
+    uint32_t current = (uint32_t)current_generation(handle);
+
+    // spin phase: no syscall, lowest latency
+    while (current == last_seen && spin_us > 0)
+    {
+        internal::cpu_relax();
+        current = (uint32_t)current_generation(handle);
+
+        if (current == last_seen && std::chrono::steady_clock::now() >= spin_deadline)
+        {
+            break;
+        }
+    }
+
+    // sleep phase
+    while (current == last_seen)
+    {
+        struct timespec timeout;
+        struct timespec* p_timeout = nullptr;
+
+        if (timeout_ms >= 0)
+        {
+            auto left = std::chrono::duration_cast<std::chrono::nanoseconds>(deadline - std::chrono::steady_clock::now()).count();
+
+            if (left <= 0)
+            {
+                ret.error_code = SHMEM_ERR_TIMEOUT;
+                ret.error_string = "No write happened before the timeout";
+                return ret;
+            }
+
+            timeout.tv_sec = left / 1000000000;
+            timeout.tv_nsec = left % 1000000000;
+            p_timeout = &timeout;
+        }
+
+        // announce ourselves before checking the generation: a writer either sees the waiter
+        // and bumps changes, or its write is visible here (pairs with notify_change)
+        handle->shm->waiters.fetch_add(1);
+        uint32_t word = changes.load();
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        // the kernel only puts us to sleep if no writer bumped changes since word
+        if ((uint32_t)current_generation(handle) == last_seen)
+        {
+            futex(&changes, FUTEX_WAIT, word, p_timeout);
+        }
+
+        handle->shm->waiters.fetch_sub(1);
+
+        current = (uint32_t)current_generation(handle);
+    }
+
+    last_seen = current;
+
+    return ret;
+}
+
+Return mshm::shmem_resize(mshm_handle mshm, size_t size)
+{
+    Return ret = check_handle(mshm);
+
+    if (ret.error_code != SHMEM_OK)
+    {
+        return ret;
+    }
+
+    t_shmem_handle* handle = (t_shmem_handle*)(mshm);
+
+    if (handle->shm->max_size == 0)
+    {
+        ret.error_code = SHMEM_ERR_NOT_SUPPORTED;
+        ret.error_string = "Shared memory was not created resizable (OpenOptions::max_size)";
+        return ret;
+    }
+
+    if (handle->sealed)
+    {
+        ret.error_code = SHMEM_ERR_NOT_SUPPORTED;
+        ret.error_string = "Shared memory is sealed";
+        return ret;
+    }
+
+    if (size > handle->shm->max_size)
+    {
+        ret.error_code = SHMEM_ERR_PARAM;
+        ret.error_string = "Size exceeds the max size given at creation";
+        return ret;
+    }
+
+    // one resize at a time, and no writer in the middle of a copy
+    ErrorCode code = SHMEM_OK;
+
+    if (!lock_range(handle, 0, 0, false, code))
+    {
+        return internal::make_return(code);
+    }
+
+    if (size < handle->shm->data_size)
+    {
+        ret.error_code = SHMEM_ERR_PARAM;
+        ret.error_string = "Segments can only grow";
+    }
+    else if (size > handle->shm->data_size && pthread_mutex_lock(&handle->resize_mutex) != 0)
+    {
+        ret.error_code = SHMEM_ERR_MUTEX;
+        ret.error_string = "Can not lock the mapping of the handle";
+    }
+    else if (size > handle->shm->data_size)
+    {
+        if (ftruncate(handle->h_fd, sizeof(shmem_internal_t) + size) != 0)
+        {
+            ret.error_code = SHMEM_ERR_FTRUNC;
+            ret.error_string = strerror(errno);
+        }
+        else if ((code = grow_mapping(handle, sizeof(shmem_internal_t) + size)) != SHMEM_OK)
+        {
+            ret = internal::make_return(code);
+        }
+        else
+        {
+            // the size first: a handle that sees the new generation must see the new size
+            handle->shm->data_size = size;
+            uint64_t generation = handle->shm->size_generation.fetch_add(1, std::memory_order_release) + 1;
+
+            handle->data_size.store(size, std::memory_order_release);
+            handle->size_generation.store(generation, std::memory_order_release);
+        }
+
+        pthread_mutex_unlock(&handle->resize_mutex);
+    }
+
+    ErrorCode unlock_code = SHMEM_OK;
+    unlock_range(handle, 0, 0, unlock_code);
+
+    if (ret.error_code == SHMEM_OK && unlock_code != SHMEM_OK)
+    {
+        ret = internal::make_return(unlock_code);
+    }
+
+    return ret;
+}
+
+size_t mshm::shmem_size(mshm_handle mshm)
+{
+    if (check_handle_ec(mshm) != SHMEM_OK)
+    {
+        return 0;
+    }
+
+    return mapped_data_size((t_shmem_handle*)mshm);
+}
+
+
+// record the checksum of the data with writers kept out. sync: the whole file reaches the disk
+// before they get back in, so that what is on disk is what the checksum describes
+static ErrorCode flush_image(t_shmem_handle* handle, bool sync)
+{
+    ErrorCode code = SHMEM_OK;
+    uint32_t last = handle->shm->lock_stripes ? handle->shm->lock_stripes - 1 : 0;
+
+    mapped_data_size(handle); // a resize by another handle: flush the new tail too
+
+    // exclusive even in rwlock mode: concurrent flushes write image_checksum and image_magic
+    if (!lock_range(handle, 0, last, false, code))
+    {
+        return code;
+    }
+
+    // a writer died in the middle of a copy: this is no consistent image
+    if (code == SHMEM_OK)
+    {
+        handle->shm->image_checksum = image_checksum(handle);
+        handle->shm->image_header_size = sizeof(shmem_internal_t);
+        handle->shm->image_magic = IMAGE_MAGIC;
+
+        if (sync && msync(handle->shm, handle->total_size, MS_SYNC) != 0)
+        {
+            code = SHMEM_ERR_MMAP;
+        }
+    }
+
+    unlock_range(handle, 0, last, code);
+
+    return code;
+}
+
+
+Return mshm::shmem_flush(mshm_handle mshm, uint64_t offset, size_t size, bool async)
+{
+    Return ret = check_handle(mshm);
+
+    if (ret.error_code != SHMEM_OK)
+    {
+        return ret;
+    }
+
+    t_shmem_handle* handle = (t_shmem_handle*)(mshm);
+    size_t data_size = mapped_data_size(handle);
+
+    if (offset > data_size || size > data_size - offset)
+    {
+        ret.error_code = SHMEM_ERR_PARAM;
+        ret.error_string = "Range exceeds the segment";
+        return ret;
+    }
+
+    if (size == 0)
+    {
+        size = data_size - offset;
+    }
+
+    // every flush of a file-backed segment records the image: a crash right after it restores
+    // what was flushed. Only a synchronous flush of everything also syncs it under the lock
+    if (handle->persistent)
+    {
+        bool whole = !async && offset == 0 && size == data_size;
+        ErrorCode code = flush_image(handle, whole);
+
+        if (code != SHMEM_OK || whole)
+        {
+            return internal::make_return(code);
+        }
+
+        // the header holds the checksum just recorded
+        if (msync(handle->shm, sizeof(shmem_internal_t), async ? MS_ASYNC : MS_SYNC) != 0)
+        {
+            ret.error_code = SHMEM_ERR_MMAP;
+            ret.error_string = strerror(errno);
+            return ret;
+        }
+    }
+
+    // the pages of the range: in triple buffer mode the bytes live in any of the copies
+    uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+    uintptr_t begin = (uintptr_t)&handle->shm->data[offset];
+    uintptr_t end = begin + size;
+
+    if (handle->shm->sync_mode == SHMEM_SYNC_TRIPLE_BUFFER)
+    {
+        begin = (uintptr_t)handle->shm->data;
+        end = (uintptr_t)handle->shm + handle->total_size;
+    }
+
+    begin &= ~(page - 1);
+
+    if (msync((void*)begin, end - begin, async ? MS_ASYNC : MS_SYNC) != 0)
+    {
+        ret.error_code = SHMEM_ERR_MMAP;
+        ret.error_string = strerror(errno);
+    }
+
+    return ret;
+}
+
+
+bool mshm::shmem_restored(mshm_handle mshm)
+{
+    if (check_handle_ec(mshm) != SHMEM_OK)
+    {
+        return false;
+    }
+
+    return ((t_shmem_handle*)mshm)->restored;
+}
+
+Backing mshm::shmem_backing(mshm_handle mshm)
+{
+    if (check_handle(mshm).error_code != SHMEM_OK)
+    {
+        return SHMEM_BACKING_PAGES;
+    }
+
+    return ((t_shmem_handle*)mshm)->backing;
+}
+
+Return mshm::shmem_numa_residency(mshm_handle mshm, std::vector<size_t>& pages_per_node)
+{
+    Return ret = check_handle(mshm);
+
+    pages_per_node.clear();
+
+    if (ret.error_code != SHMEM_OK)
+    {
+        return ret;
+    }
+
+    t_shmem_handle* handle = (t_shmem_handle*)(mshm);
+
+    size_t page = handle->backing == SHMEM_BACKING_HUGETLB_1G ? HUGE_PAGE_1G
+                : handle->backing == SHMEM_BACKING_HUGETLB_2M ? HUGE_PAGE_2M : (size_t)sysconf(_SC_PAGESIZE);
+    size_t pages = (handle->total_size + page - 1) / page;
+
+    const size_t batch = 1024;
+    void* addresses[batch];
+    int status[batch];
+
+    for (size_t first = 0; first < pages; first += batch)
+    {
+        size_t count = std::min(batch, pages - first);
+
+        for (size_t i = 0; i < count; ++i)
+        {
+            addresses[i] = (unsigned char*)handle->shm + (first + i) * page;
+        }
+
+        // no target nodes: only reports where each page lives
+        if (syscall(SYS_move_pages, 0, count, addresses, nullptr, status, 0) != 0)
+        {
+            ret.error_code = SHMEM_ERR_NOT_SUPPORTED;
+            ret.error_string = strerror(errno);
+            pages_per_node.clear();
+            return ret;
+        }
+
+        for (size_t i = 0; i < count; ++i)
+        {
+            if (status[i] < 0)
+            {
+                continue; // not faulted in yet
+            }
+
+            if ((size_t)status[i] >= pages_per_node.size())
+            {
+                pages_per_node.resize(status[i] + 1, 0);
+            }
+
+            pages_per_node[status[i]]++;
+        }
+    }
+
+    return ret;
+}
+
+
+unsigned char* mshm::internal::segment_data(mshm_handle mshm)
+{
+    return ((t_shmem_handle*)mshm)->shm->data;
+}
+
+size_t mshm::internal::segment_size(mshm_handle mshm)
+{
+    return ((t_shmem_handle*)mshm)->shm->data_size;
+}
+
+bool mshm::internal::segment_created(mshm_handle mshm)
+{
+    return ((t_shmem_handle*)mshm)->created;
+}
@@ -0,0 +1,376 @@
+#include "mshm.h"
+#include "mshm_internal.h"
+
+#include <string.h>
+#include <atomic>
+
+
+using namespace mshm;
+
+static const uint32_t MAP_READY = 0x4d53484d; // "MSHM"
+static const uint32_t MAP_STRIPES = 64;
+
+enum BucketState : uint32_t
+{
+    BUCKET_EMPTY,
+    BUCKET_FULL,
+    BUCKET_TOMBSTONE
+};
+
+struct map_bucket_t
+{
+    std::atomic<uint32_t> version;             // seqlock del bucket: dispari = scrittura in corso
+    std::atomic<uint32_t> state;               // BucketState
+    uint64_t hash;
+    unsigned char data[];                      // chiave seguita dal valore
+};
+
+struct alignas(64) map_stripe_t
+{
+    std::atomic<uint32_t> lock;                // spinlock degli scrittori con la stessa chiave
+};
+
+struct map_header_t
+{
+    alignas(64) std::atomic<uint64_t> count;
+    alignas(64) std::atomic<uint32_t> ready;   // scritto dal creatore quando i campi sotto sono validi
+    uint64_t key_size;
+    uint64_t value_size;
+    uint64_t capacity;
+    map_stripe_t stripes[MAP_STRIPES];
+    alignas(64) unsigned char buckets[];
+};
+
+struct t_map_handle
+{
+    mshm_handle segment = nullptr;
+    map_header_t* map = nullptr;
+    size_t key_size = 0;
+    size_t value_size = 0;
+    size_t bucket_stride = 0;
+    uint64_t mask = 0;
+};
+
+
+// buckets are whole cache lines: a lookup that hits its home bucket touches one or two lines
+static inline size_t bucket_stride(size_t key_size, size_t value_size)
+{
+    return (sizeof(map_bucket_t) + key_size + value_size + 63) & ~(size_t)63;
+}
+
+static inline map_bucket_t* bucket_at(t_map_handle* m, uint64_t index)
+{
+    return (map_bucket_t*)&m->map->buckets[(index & m->mask) * m->bucket_stride];
+}
+
+// FNV-1a
+static inline uint64_t hash_key(const void* key, size_t size)
+{
+    const unsigned char* bytes = (const unsigned char*)key;
+    uint64_t hash = 14695981039346656037ull;
+
+    for (size_t i = 0; i < size; ++i)
+    {
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+    }
+
+    return hash;
+}
+
+static void lock_stripe(t_map_handle* m, uint64_t hash)
+{
+    std::atomic<uint32_t>& lock = m->map->stripes[hash % MAP_STRIPES].lock;
+    internal::Backoff backoff(-1);
+
+    while (lock.exchange(1, std::memory_order_acquire) != 0)
+    {
+        while (lock.load(std::memory_order_relaxed) != 0)
+        {
+            backoff.pause();
+        }
+    }
+}
+
+static void unlock_stripe(t_map_handle* m, uint64_t hash)
+{
+    m->map->stripes[hash % MAP_STRIPES].lock.store(0, std::memory_order_release);
+}
+
+// writer side of the bucket seqlock; fails if another writer holds it
+static inline bool lock_bucket(map_bucket_t* bucket)
+{
+    uint32_t version = bucket->version.load(std::memory_order_relaxed);
+
+    if ((version & 1) || !bucket->version.compare_exchange_strong(version, version + 1, std::memory_order_acquire))
+    {
+        return false;
+    }
+
+    std::atomic_thread_fence(std::memory_order_release);
+    return true;
+}
+
+static inline void unlock_bucket(map_bucket_t* bucket)
+{
+    bucket->version.fetch_add(1, std::memory_order_release);
+}
+
+// called with the stripe of hash held: only this writer can add or remove that key
+static map_bucket_t* find_locked(t_map_handle* m, uint64_t hash, const void* key, map_bucket_t** free_bucket)
+{
+    *free_bucket = nullptr;
+    uint64_t home = hash & m->mask;
+
+    for (uint64_t i = 0; i <= m->mask; ++i)
+    {
+        map_bucket_t* bucket = bucket_at(m, home + i);
+        uint32_t state = bucket->state.load(std::memory_order_acquire);
+
+        if (state == BUCKET_FULL && bucket->hash == hash && memcmp(bucket->data, key, m->key_size) == 0)
+        {
+            return bucket;
+        }
+
+        if (state != BUCKET_FULL && *free_bucket == nullptr)
+        {
+            *free_bucket = bucket;
+        }
+
+        if (state == BUCKET_EMPTY)
+        {
+            return nullptr; // end of the probe chain
+        }
+    }
+
+    return nullptr;
+}
+
+
+Return mshm::shmem_map_open(mshm_map& map, const char* name, size_t key_size, size_t value_size, size_t capacity)
+{
+    Return ret;
+    map = nullptr;
+
+    if (key_size == 0 || capacity < 2 || (capacity & (capacity - 1)) != 0)
+    {
+        ret.error_code = SHMEM_ERR_PARAM;
+        ret.error_string = "Key size must be grater then 0 and capacity a power of two (at least 2)";
+        return ret;
+    }
+
+    if (key_size > SIZE_MAX / 4 || value_size > SIZE_MAX / 4
+        || capacity > (SIZE_MAX - sizeof(map_header_t)) / bucket_stride(key_size, value_size))
+    {
+        ret.error_code = SHMEM_ERR_PARAM;
+        ret.error_string = "Map size is too big";
+        return ret;
+    }
+
+    size_t total_size = sizeof(map_header_t) + bucket_stride(key_size, value_size) * capacity;
+
+    mshm_handle segment = nullptr;
+    map_header_t* header = nullptr;
+    ret = internal::open_structure(segment, header, name, total_size, &map_header_t::ready, MAP_READY,
+                                   "Map", "Map was created with a different key size, value size or capacity");
+
+    if (ret.error_code != SHMEM_OK)
+    {
+        return ret;
+    }
+
+    if (internal::segment_created(segment))
+    {
+        // zero pages: every bucket is already BUCKET_EMPTY with version 0
+        header->key_size = key_size;
+        header->value_size = value_size;
+        header->capacity = capacity;
+        header->ready.store(MAP_READY, std::memory_order_release);
+    }
+    else if (header->key_size != key_size || header->value_size != value_size || header->capacity != capacity)
+    {
+        shmem_close(segment);
+        ret.error_code = SHMEM_ERR_PARAM;
+        ret.error_string = "Map was created with a different key size, value size or capacity";
+        return ret;
+    }
+
+    t_map_handle* handle = new t_map_handle();
+    handle->segment = segment;
+    handle->map = header;
+    handle->key_size = key_size;
+    handle->value_size = value_size;
+    handle->bucket_stride = bucket_stride(key_size, value_size);
+    handle->mask = capacity - 1;
+
+    map = handle;
+
+    return ret;
+}
+
+
+Return mshm::shmem_map_close(mshm_map map)
+{
+    Return ret;
+
+    if (map == nullptr)
+    {
+        ret.error_code = SHMEM_ERR_NOT_OPEN;
+        ret.error_string = "Handle is NULL";
+        return ret;
+    }
+
+    t_map_handle* handle = (t_map_handle*)(map);
+
+    ret = shmem_close(handle->segment);
+
+    if (ret.error_code != SHMEM_OK)
+    {
+        return ret;
+    }
+
+    delete handle;
+
+    return ret;
+}
+
+
+bool mshm::shmem_map_put(mshm_map map, const void* key, const void* value)
+{
+    t_map_handle* m = (t_map_handle*)(map);
+    uint64_t hash = hash_key(key, m->key_size);
+
+    lock_stripe(m, hash);
+
+    map_bucket_t* free_bucket;
+    map_bucket_t* bucket = find_locked(m, hash, key, &free_bucket);
+
+    if (bucket != nullptr)
+    {
+        // update in place; bucket locks only race with writers of other stripes, and briefly
+        while (!lock_bucket(bucket)) internal::cpu_relax();
+        memcpy(&bucket->data[m->key_size], value, m->value_size);
+        unlock_bucket(bucket);
+
+        unlock_stripe(m, hash);
+        return true;
+    }
+
+    // claim a free bucket: a writer of another stripe may take it first, then keep probing
+    uint64_t index = free_bucket ? ((unsigned char*)free_bucket - m->map->buckets) / m->bucket_stride : 0;
+    bool inserted = false;
+
+    for (uint64_t i = 0; free_bucket != nullptr && i <= m->mask && !inserted; ++i)
+    {
+        bucket = bucket_at(m, index + i);
+
+        if (bucket->state.load(std::memory_order_acquire) == BUCKET_FULL || !lock_bucket(bucket))
+        {
+            continue;
+        }
+
+        if (bucket->state.load(std::memory_order_relaxed) != BUCKET_FULL)
+        {
+            bucket->hash = hash;
+            memcpy(bucket->data, key, m->key_size);
+            memcpy(&bucket->data[m->key_size], value, m->value_size);
+            bucket->state.store(BUCKET_FULL, std::memory_order_release);
+            inserted = true;
+        }
+
+        unlock_bucket(bucket);
+    }
+
+    if (inserted)
+    {
+        m->map->count.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    unlock_stripe(m, hash);
+    return inserted;
+}
+
+
+bool mshm::shmem_map_get(mshm_map map, const void* key, void* value)
+{
+    t_map_handle* m = (t_map_handle*)(map);
+    uint64_t hash = hash_key(key, m->key_size);
+    uint64_t home = hash & m->mask;
+
+    for (uint64_t i = 0; i <= m->mask; ++i)
+    {
+        map_bucket_t* bucket = bucket_at(m, home + i);
+
+        for (;;)
+        {
+            uint32_t version = bucket->version.load(std::memory_order_acquire);
+
+            if (version & 1)
+            {
+                internal::cpu_relax();
+                continue;
+            }
+
+            uint32_t state = bucket->state.load(std::memory_order_acquire);
+            bool match = state == BUCKET_FULL && bucket->hash == hash && memcmp(bucket->data, key, m->key_size) == 0;
+
+            if (match)
+            {
+                memcpy(value, &bucket->data[m->key_size], m->value_size);
+            }
+
+            std::atomic_thread_fence(std::memory_order_acquire);
+
+            if (bucket->version.load(std::memory_order_relaxed) != version)
+            {
+                continue; // torn: a writer got in, read the bucket again
+            }
+
+            if (match)
+            {
+                return true;
+            }
+
+            if (state == BUCKET_EMPTY)
+            {
+                return false;
+            }
+
+            break;
+        }
+    }
+
+    return false;
+}
+
+
+bool mshm::shmem_map_erase(mshm_map map, const void* key)
+{
+    t_map_handle* m = (t_map_handle*)(map);
+    uint64_t hash = hash_key(key, m->key_size);
+
+    lock_stripe(m, hash);
+
+    map_bucket_t* free_bucket;
+    map_bucket_t* bucket = find_locked(m, hash, key, &free_bucket);
+
+    if (bucket != nullptr)
+    {
+        while (!lock_bucket(bucket)) internal::cpu_relax();
+        bucket->state.store(BUCKET_TOMBSTONE, std::memory_order_release); // keeps later chains reachable
+        unlock_bucket(bucket);
+
+        m->map->count.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    unlock_stripe(m, hash);
+    return bucket != nullptr;
+}
+
+
+size_t mshm::shmem_map_size(mshm_map map)
+{
+    t_map_handle* m = (t_map_handle*)(map);
+
+    return (size_t)m->map->count.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,242 @@
+#include "mshm.h"
+#include "mshm_internal.h"
+
+#include <string.h>
+#include <atomic>
+
+
+using namespace mshm;
+
+static const uint32_t QUEUE_READY = 0x4d534851; // "MSHQ"
+
+struct queue_slot_t
+{
+    std::atomic<uint64_t> sequence;           // == posizione: libero per il producer, == posizione + 1: pieno
+    unsigned char data[];
+};
+
+struct queue_header_t
+{
+    alignas(64) std::atomic<uint64_t> enqueue_pos;
+    alignas(64) std::atomic<uint64_t> dequeue_pos;
+    alignas(64) std::atomic<uint32_t> ready;  // scritto dal creatore quando i campi sotto sono validi
+    uint64_t msg_size;
+    uint64_t capacity;
+    alignas(64) unsigned char slots[];
+};
+
+struct t_queue_handle
+{
+    mshm_handle segment = nullptr;
+    queue_header_t* queue = nullptr;
+    size_t msg_size = 0;
+    size_t slot_stride = 0;
+    uint64_t mask = 0;
+};
+
+
+static inline size_t slot_stride(size_t msg_size)
+{
+    return (sizeof(queue_slot_t) + msg_size + 7) & ~(size_t)7;
+}
+
+static inline queue_slot_t* slot_at(t_queue_handle* q, uint64_t pos)
+{
+    return (queue_slot_t*)&q->queue->slots[(pos & q->mask) * q->slot_stride];
+}
+
+
+Return mshm::shmem_queue_open(mshm_queue& queue, const char* name, size_t msg_size, size_t capacity)
+{
+    Return ret;
+    queue = nullptr;
+
+    if (msg_size == 0 || capacity < 2 || (capacity & (capacity - 1)) != 0)
+    {
+        ret.error_code = SHMEM_ERR_PARAM;
+        ret.error_string = "Message size must be grater then 0 and capacity a power of two (at least 2)";
+        return ret;
+    }
+
+    if (msg_size > SIZE_MAX / 2 || capacity > (SIZE_MAX - sizeof(queue_header_t)) / slot_stride(msg_size))
+    {
+        ret.error_code = SHMEM_ERR_PARAM;
+        ret.error_string = "Queue size is too big";
+        return ret;
+    }
+
+    size_t total_size = sizeof(queue_header_t) + slot_stride(msg_size) * capacity;
+
+    mshm_handle segment = nullptr;
+    queue_header_t* header = nullptr;
+    ret = internal::open_structure(segment, header, name, total_size, &queue_header_t::ready, QUEUE_READY,
+                                   "Queue", "Queue was created with a different message size or capacity");
+
+    if (ret.error_code != SHMEM_OK)
+    {
+        return ret;
+    }
+
+    if (!internal::segment_created(segment) && (header->msg_size != msg_size || header->capacity != capacity))
+    {
+        shmem_close(segment);
+        ret.error_code = SHMEM_ERR_PARAM;
+        ret.error_string = "Queue was created with a different message size or capacity";
+        return ret;
+    }
+
+    t_queue_handle* handle = new t_queue_handle();
+    handle->segment = segment;
+    handle->queue = header;
+    handle->msg_size = msg_size;
+    handle->slot_stride = slot_stride(msg_size);
+    handle->mask = capacity - 1;
+
+    if (internal::segment_created(segment))
+    {
+        for (uint64_t i = 0; i < capacity; ++i)
+        {
+            slot_at(handle, i)->sequence.store(i, std::memory_order_relaxed);
+        }
+
+        header->msg_size = msg_size;
+        header->capacity = capacity;
+        header->ready.store(QUEUE_READY, std::memory_order_release);
+    }
+
+    queue = handle;
+
+    return ret;
+}
+
+
+Return mshm::shmem_queue_close(mshm_queue queue)
+{
+    Return ret;
+
+    if (queue == nullptr)
+    {
+        ret.error_code = SHMEM_ERR_NOT_OPEN;
+        ret.error_string = "Handle is NULL";
+        return ret;
+    }
+
+    t_queue_handle* handle = (t_queue_handle*)(queue);
+
+    ret = shmem_close(handle->segment);
+
+    if (ret.error_code != SHMEM_OK)
+    {
+        return ret;
+    }
+
+    delete handle;
+
+    return ret;
+}
+
+
+bool mshm::shmem_queue_try_enqueue(mshm_queue queue, const void* msg)
+{
+    t_queue_handle* q = (t_queue_handle*)(queue);
+
+    queue_slot_t* slot;
+    uint64_t pos = q->queue->enqueue_pos.load(std::memory_order_relaxed);
+
+    for (;;)
+    {
+        slot = slot_at(q, pos);
+        uint64_t seq = slot->sequence.load(std::memory_order_acquire);
+        int64_t diff = (int64_t)seq - (int64_t)pos;
+
+        if (diff == 0)
+        {
+            if (q->queue->enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+            {
+                break;
+            }
+        }
+        else if (diff < 0)
+        {
+            return false; // full
+        }
+        else
+        {
+            pos = q->queue->enqueue_pos.load(std::memory_order_relaxed);
+        }
+    }
+
+    memcpy(slot->data, msg, q->msg_size);
+    slot->sequence.store(pos + 1, std::memory_order_release);
+
+    return true;
+}
+
+
+bool mshm::shmem_queue_try_dequeue(mshm_queue queue, void* msg)
+{
+    t_queue_handle* q = (t_queue_handle*)(queue);
+
+    queue_slot_t* slot;
+    uint64_t pos = q->queue->dequeue_pos.load(std::memory_order_relaxed);
+
+    for (;;)
+    {
+        slot = slot_at(q, pos);
+        uint64_t seq = slot->sequence.load(std::memory_order_acquire);
+        int64_t diff = (int64_t)seq - (int64_t)(pos + 1);
+
+        if (diff == 0)
+        {
+            if (q->queue->dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+            {
+                break;
+            }
+        }
+        else if (diff < 0)
+        {
+            return false; // empty
+        }
+        else
+        {
+            pos = q->queue->dequeue_pos.load(std::memory_order_relaxed);
+        }
+    }
+
+    memcpy(msg, slot->data, q->msg_size);
+    slot->sequence.store(pos + q->mask + 1, std::memory_order_release);
+
+    return true;
+}
+
+
+bool mshm::shmem_queue_enqueue(mshm_queue queue, const void* msg, int timeout_ms)
+{
+    internal::Backoff backoff(timeout_ms);
+
+    while (!shmem_queue_try_enqueue(queue, msg))
+    {
+        if (!backoff.pause())
+        {
+            return shmem_queue_try_enqueue(queue, msg);
+        }
+    }
+
+    return true;
+}
+
+
+bool mshm::shmem_queue_dequeue(mshm_queue queue, void* msg, int timeout_ms)
+{
+    internal::Backoff backoff(timeout_ms);
+
+    while (!shmem_queue_try_dequeue(queue, msg))
+    {
+        if (!backoff.pause())
+        {
+            return shmem_queue_try_dequeue(queue, msg);
+        }
+    }
+
+    return true;
+}
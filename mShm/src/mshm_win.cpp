@@ -1,6 +1,7 @@
 ﻿#define _CRT_SECURE_NO_WARNINGS
 
 #include "mshm.h"
+#include "mshm_internal.h"
 
 #include <windows.h>
 #include <strsafe.h>
@@ -11,6 +12,8 @@ using namespace mshm;
 struct t_shmem_internal
 {
     size_t data_size;
+    uint64_t generation;                         // completed writes, updated under the mutex
+    unsigned char reserved[64 - sizeof(size_t) - sizeof(uint64_t)]; // keeps data cache line aligned
     unsigned char data[];
 };
 
@@ -20,6 +23,7 @@ struct t_shmem_handle
     HANDLE h_map = nullptr;
     HANDLE h_mutex = nullptr;
     size_t total_size = 0;
+    bool created = false;
 };
 
 
@@ -46,6 +50,23 @@ std::string get_last_error_message()
     return msg;
 }
 
+static inline ErrorCode validate_mshm_handle_ec(mshm_handle mshm) noexcept
+{
+    if (mshm == nullptr)
+    {
+        return SHMEM_ERR_NOT_OPEN;
+    }
+
+    t_shmem_handle* handle = (t_shmem_handle*)(mshm);
+
+    if (handle->shm == nullptr || handle->h_map == NULL)
+    {
+        return SHMEM_ERR_NOT_OPEN;
+    }
+
+    return SHMEM_OK;
+}
+
 Return validate_mshm_handle(mshm_handle mshm)
 {
     Return ret;
@@ -108,7 +129,7 @@ bool is_valid_shm_name(const std::string& name, std::string* error = nullptr)
     return true;
 }
 
-Return mshm::shmem_open(mshm_handle& mshm, const char* name, size_t user_data_size)
+Return mshm::shmem_open(mshm_handle& mshm, const char* name, size_t user_data_size, const OpenOptions& options)
 {
     Return ret;
 
@@ -130,6 +151,31 @@ Return mshm::shmem_open(mshm_handle& mshm, const char* name, size_t user_data_si
         return ret;
     }
 
+    if (options.sync_mode != SHMEM_SYNC_MUTEX)
+    {
+        mshm = nullptr;
+        ret.error_code = SHMEM_ERR_NOT_SUPPORTED;
+        ret.error_string = "Only the mutex sync mode is supported on windows";
+        return ret;
+    }
+
+    if (options.lock_policy != SHMEM_LOCK_DEFAULT || options.lock_timeout_ms >= 0 || options.lock_stripes != 0
+        || options.dirty_block_size != 0 || options.stats || options.max_size != 0 || options.persist_dir != nullptr)
+    {
+        mshm = nullptr;
+        ret.error_code = SHMEM_ERR_NOT_SUPPORTED;
+        ret.error_string = "Lock policies, lock stripes, dirty blocks, stats, resizing and file-backed segments are not supported on windows";
+        return ret;
+    }
+
+    if (options.page_size != SHMEM_PAGE_DEFAULT || options.prefault != SHMEM_PREFAULT_NONE || options.numa_policy != SHMEM_NUMA_DEFAULT)
+    {
+        mshm = nullptr;
+        ret.error_code = SHMEM_ERR_NOT_SUPPORTED;
+        ret.error_string = "Huge pages, prefaulting and NUMA placement are not supported on windows";
+        return ret;
+    }
+
     t_shmem_handle* handle = new t_shmem_handle();
     handle->total_size = sizeof(t_shmem_internal) + user_data_size;
 
@@ -215,9 +261,11 @@ Return mshm::shmem_open(mshm_handle& mshm, const char* name, size_t user_data_si
     if (init) 
     {
         handle->shm->data_size = user_data_size;
+        handle->shm->generation = 0;
         memset(handle->shm->data, 0, user_data_size);
     }
 
+    handle->created = init;
     mshm = handle;
     ret.error_code = SHMEM_OK;
     ret.error_string = "No Error";
@@ -273,117 +321,438 @@ Return mshm::shmem_close(mshm_handle mshm)
 }
 
 
-Return mshm::shmem_write(mshm_handle mshm, const void* src, size_t size, uint64_t offset)
+Return mshm::shmem_resize(mshm_handle mshm, size_t size)
 {
-    Return ret = validate_mshm_handle(mshm);
+    return internal::make_return(SHMEM_ERR_NOT_SUPPORTED);
+}
 
-    if (ret.error_code != SHMEM_OK)
+
+Return mshm::shmem_create_anonymous(mshm_handle& mshm, size_t size, const OpenOptions& options)
+{
+    mshm = nullptr;
+    return internal::make_return(SHMEM_ERR_NOT_SUPPORTED);
+}
+
+
+Return mshm::shmem_send_fd(mshm_handle mshm, int socket)
+{
+    return internal::make_return(SHMEM_ERR_NOT_SUPPORTED);
+}
+
+
+Return mshm::shmem_receive_fd(mshm_handle& mshm, int socket)
+{
+    mshm = nullptr;
+    return internal::make_return(SHMEM_ERR_NOT_SUPPORTED);
+}
+
+
+Return mshm::shmem_seal(mshm_handle mshm)
+{
+    return internal::make_return(SHMEM_ERR_NOT_SUPPORTED);
+}
+
+
+Return mshm::shmem_flush(mshm_handle mshm, uint64_t offset, size_t size, bool async)
+{
+    return internal::make_return(SHMEM_ERR_NOT_SUPPORTED);
+}
+
+
+bool mshm::shmem_restored(mshm_handle mshm)
+{
+    return false;
+}
+
+
+size_t mshm::shmem_size(mshm_handle mshm)
+{
+    if (validate_mshm_handle_ec(mshm) != SHMEM_OK)
     {
-        return ret;
+        return 0;
+    }
+
+    return ((t_shmem_handle*)mshm)->shm->data_size;
+}
+
+
+Backing mshm::shmem_backing(mshm_handle mshm)
+{
+    return SHMEM_BACKING_PAGES;
+}
+
+
+Return mshm::shmem_numa_residency(mshm_handle mshm, std::vector<size_t>& pages_per_node)
+{
+    Return ret;
+    pages_per_node.clear();
+    ret.error_code = SHMEM_ERR_NOT_SUPPORTED;
+    ret.error_string = "NUMA residency is not supported on windows";
+
+    return ret;
+}
+
+
+// copy path of a write whose arguments are checked: shmem_write_ec, shmem_write_unchecked_ec
+static inline ErrorCode write_data(t_shmem_handle* handle, const void* src, size_t size, uint64_t offset) noexcept
+{
+    ErrorCode code = SHMEM_OK;
+
+    DWORD wait = WaitForSingleObject(handle->h_mutex, INFINITE);
+
+    // if(wait == WAIT_TIMEOUT) --> INFINITE timeout. This case should not happen ever
+
+    if (wait == WAIT_ABANDONED)
+    {
+        return SHMEM_ERR_MUTEX;
+    }
+
+    if (wait == WAIT_FAILED)
+    {
+        return SHMEM_ERR_MUTEX;
+    }
+
+    memcpy(&handle->shm->data[offset], src, size);
+    handle->shm->generation++;
+
+    BOOL success = ReleaseMutex(handle->h_mutex);
+
+    if (!success)
+    {
+        return SHMEM_ERR_MUTEX;
+    }
+
+    return code;
+}
+
+ErrorCode mshm::shmem_write_ec(mshm_handle mshm, const void* src, size_t size, uint64_t offset) noexcept
+{
+    ErrorCode code = validate_mshm_handle_ec(mshm);
+
+    if (code != SHMEM_OK)
+    {
+        return code;
     }
 
     if (src == nullptr)
     {
-        ret.error_code = SHMEM_ERR_PARAM;
-        ret.error_string = "src in NULL";
-        return ret;
+        return SHMEM_ERR_PARAM;
     }
 
     t_shmem_handle* handle = (t_shmem_handle*)(mshm);
 
-    if (offset + size > handle->shm->data_size)
+    if (offset > handle->shm->data_size || size > handle->shm->data_size - offset)
     {
-        ret.error_code = SHMEM_ERR_PARAM;
-        ret.error_string = "Size plus offset is exceed the shmem size";
-        return ret;
+        return SHMEM_ERR_PARAM;
+    }
+
+    return write_data(handle, src, size, offset);
+}
+
+ErrorCode mshm::shmem_write_unchecked_ec(mshm_handle mshm, const void* src, size_t size, uint64_t offset) noexcept
+{
+    return write_data((t_shmem_handle*)(mshm), src, size, offset);
+}
+
+ErrorCode mshm::shmem_writev_ec(mshm_handle mshm, const WriteEntry* entries, size_t count) noexcept
+{
+    ErrorCode code = validate_mshm_handle_ec(mshm);
+
+    if (code != SHMEM_OK)
+    {
+        return code;
+    }
+
+    if (entries == nullptr && count > 0)
+    {
+        return SHMEM_ERR_PARAM;
+    }
+
+    t_shmem_handle* handle = (t_shmem_handle*)(mshm);
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        if (entries[i].src == nullptr)
+        {
+            return SHMEM_ERR_PARAM;
+        }
+
+        if (entries[i].offset > handle->shm->data_size || entries[i].size > handle->shm->data_size - entries[i].offset)
+        {
+            return SHMEM_ERR_PARAM;
+        }
     }
 
     DWORD wait = WaitForSingleObject(handle->h_mutex, INFINITE);
 
+    if (wait == WAIT_ABANDONED)
+    {
+        return SHMEM_ERR_MUTEX;
+    }
+
+    if (wait == WAIT_FAILED)
+    {
+        return SHMEM_ERR_MUTEX;
+    }
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        memcpy(&handle->shm->data[entries[i].offset], entries[i].src, entries[i].size);
+    }
+
+    handle->shm->generation++;
+
+    BOOL success = ReleaseMutex(handle->h_mutex);
+
+    if (!success)
+    {
+        return SHMEM_ERR_MUTEX;
+    }
+
+    return code;
+}
+
+// copy path of a read whose arguments are checked: shmem_read_ec, shmem_read_unchecked_ec
+static inline ErrorCode read_data(t_shmem_handle* handle, void* dst, size_t size, uint64_t offset) noexcept
+{
+    ErrorCode code = SHMEM_OK;
+
+    DWORD wait = WaitForSingleObject(handle->h_mutex, INFINITE);
+
     // if(wait == WAIT_TIMEOUT) --> INFINITE timeout. This case should not happen ever
 
     if (wait == WAIT_ABANDONED)
     {
-        ret.error_code = SHMEM_ERR_MUTEX;
-        ret.error_string = "Mutex was not released by the thread that owned the mutex before the owning thread terminated";
-        return ret;
+        return SHMEM_ERR_MUTEX;
     }
 
     if (wait == WAIT_FAILED)
     {
-        ret.error_code = SHMEM_ERR_MUTEX;
-        ret.error_string = get_last_error_message();
-        return ret;
+        return SHMEM_ERR_MUTEX;
     }
 
-    memcpy(&handle->shm->data[offset], src, size);
+    memcpy(dst, &handle->shm->data[offset], size);
 
     BOOL success = ReleaseMutex(handle->h_mutex);
 
     if (!success)
     {
-        ret.error_code = SHMEM_ERR_MUTEX;
-        ret.error_string = get_last_error_message();
-        return ret;
+        return SHMEM_ERR_MUTEX;
     }
 
-    return ret;
+    return code;
 }
 
-Return mshm::shmem_read(mshm_handle mshm, void* dst, size_t size, uint64_t offset)
+ErrorCode mshm::shmem_read_ec(mshm_handle mshm, void* dst, size_t size, uint64_t offset) noexcept
 {
-    Return ret = validate_mshm_handle(mshm);
+    ErrorCode code = validate_mshm_handle_ec(mshm);
 
-    if (ret.error_code != SHMEM_OK)
+    if (code != SHMEM_OK)
     {
-        return ret;
+        return code;
     }
 
     if (dst == nullptr)
     {
-        ret.error_code = SHMEM_ERR_PARAM;
-        ret.error_string = "dst in NULL";
-        return ret;
+        return SHMEM_ERR_PARAM;
     }
 
     t_shmem_handle* handle = (t_shmem_handle*)(mshm);
     
-    if (offset + size > handle->shm->data_size)
+    if (offset > handle->shm->data_size || size > handle->shm->data_size - offset)
     {
-        ret.error_code = SHMEM_ERR_PARAM;
-        ret.error_string = "Size plus offset exceed the shmem size";
-        return ret;
+        return SHMEM_ERR_PARAM;
+    }
+
+    return read_data(handle, dst, size, offset);
+}
+
+ErrorCode mshm::shmem_read_unchecked_ec(mshm_handle mshm, void* dst, size_t size, uint64_t offset) noexcept
+{
+    return read_data((t_shmem_handle*)(mshm), dst, size, offset);
+}
+
+ErrorCode mshm::shmem_readv_ec(mshm_handle mshm, const ReadEntry* entries, size_t count, uint64_t& generation) noexcept
+{
+    ErrorCode code = validate_mshm_handle_ec(mshm);
+
+    if (code != SHMEM_OK)
+    {
+        return code;
+    }
+
+    if (entries == nullptr && count > 0)
+    {
+        return SHMEM_ERR_PARAM;
+    }
+
+    t_shmem_handle* handle = (t_shmem_handle*)(mshm);
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        if (entries[i].dst == nullptr)
+        {
+            return SHMEM_ERR_PARAM;
+        }
+
+        if (entries[i].offset > handle->shm->data_size || entries[i].size > handle->shm->data_size - entries[i].offset)
+        {
+            return SHMEM_ERR_PARAM;
+        }
     }
 
     DWORD wait = WaitForSingleObject(handle->h_mutex, INFINITE);
 
-    // if(wait == WAIT_TIMEOUT) --> INFINITE timeout. This case should not happen ever
+    if (wait == WAIT_ABANDONED)
+    {
+        return SHMEM_ERR_MUTEX;
+    }
+
+    if (wait == WAIT_FAILED)
+    {
+        return SHMEM_ERR_MUTEX;
+    }
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        memcpy(entries[i].dst, &handle->shm->data[entries[i].offset], entries[i].size);
+    }
+
+    generation = handle->shm->generation;
+
+    BOOL success = ReleaseMutex(handle->h_mutex);
+
+    if (!success)
+    {
+        return SHMEM_ERR_MUTEX;
+    }
+
+    return code;
+}
+
+ErrorCode mshm::shmem_read_changed_ec(mshm_handle mshm, void* dst, uint64_t& version) noexcept
+{
+    return SHMEM_ERR_NOT_SUPPORTED;
+}
+
+ErrorCode mshm::shmem_acquire_view_ec(mshm_handle mshm, View& view, ViewMode mode, size_t size, uint64_t offset) noexcept
+{
+    ErrorCode code = validate_mshm_handle_ec(mshm);
+
+    view = View();
+
+    if (code != SHMEM_OK)
+    {
+        return code;
+    }
+
+    if (mode != SHMEM_VIEW_READ && mode != SHMEM_VIEW_WRITE)
+    {
+        return SHMEM_ERR_PARAM;
+    }
+
+    t_shmem_handle* handle = (t_shmem_handle*)(mshm);
+
+    if (offset > handle->shm->data_size || size > handle->shm->data_size - offset)
+    {
+        return SHMEM_ERR_PARAM;
+    }
+
+    DWORD wait = WaitForSingleObject(handle->h_mutex, INFINITE);
 
     if (wait == WAIT_ABANDONED)
     {
-        ret.error_code = SHMEM_ERR_MUTEX;
-        ret.error_string = "Mutex was not released by the thread that owned the mutex before the owning thread terminated";
-        return ret;
+        return SHMEM_ERR_MUTEX;
     }
 
     if (wait == WAIT_FAILED)
     {
-        ret.error_code = SHMEM_ERR_MUTEX;
-        ret.error_string = get_last_error_message();
-        return ret;
+        return SHMEM_ERR_MUTEX;
     }
 
-    memcpy(dst, &handle->shm->data[offset], size);
+    view.shm = mshm;
+    view.data = &handle->shm->data[offset];
+    view.size = size;
+    view.mode = mode;
+
+    return code;
+}
+
+ErrorCode mshm::shmem_release_view_ec(View& view) noexcept
+{
+    ErrorCode code = validate_mshm_handle_ec(view.shm);
+
+    if (code != SHMEM_OK)
+    {
+        return code;
+    }
+
+    t_shmem_handle* handle = (t_shmem_handle*)(view.shm);
+
+    if (view.mode == SHMEM_VIEW_WRITE)
+    {
+        handle->shm->generation++;
+    }
 
     BOOL success = ReleaseMutex(handle->h_mutex);
 
+    view = View();
+
     if (!success)
     {
-        ret.error_code = SHMEM_ERR_MUTEX;
-        ret.error_string = get_last_error_message();
-        return ret;
+        return SHMEM_ERR_MUTEX;
     }
 
+    return code;
+}
+
+// Return API: thin wrappers, the message comes from the static table
+Return mshm::shmem_write(mshm_handle mshm, const void* src, size_t size, uint64_t offset)
+{
+    return internal::make_return(shmem_write_ec(mshm, src, size, offset));
+}
+
+Return mshm::shmem_writev(mshm_handle mshm, const WriteEntry* entries, size_t count)
+{
+    return internal::make_return(shmem_writev_ec(mshm, entries, count));
+}
+
+Return mshm::shmem_read(mshm_handle mshm, void* dst, size_t size, uint64_t offset)
+{
+    return internal::make_return(shmem_read_ec(mshm, dst, size, offset));
+}
+
+Return mshm::shmem_readv(mshm_handle mshm, const ReadEntry* entries, size_t count, uint64_t& generation)
+{
+    return internal::make_return(shmem_readv_ec(mshm, entries, count, generation));
+}
+
+Return mshm::shmem_read_changed(mshm_handle mshm, void* dst, uint64_t& version)
+{
+    return internal::make_return(shmem_read_changed_ec(mshm, dst, version));
+}
+
+Return mshm::shmem_acquire_view(mshm_handle mshm, View& view, ViewMode mode, size_t size, uint64_t offset)
+{
+    return internal::make_return(shmem_acquire_view_ec(mshm, view, mode, size, offset));
+}
+
+Return mshm::shmem_release_view(View& view)
+{
+    return internal::make_return(shmem_release_view_ec(view));
+}
+
+Return mshm::shmem_stats(mshm_handle mshm, Stats& stats)
+{
+    return internal::make_return(SHMEM_ERR_NOT_SUPPORTED);
+}
+
+Return mshm::shmem_wait_changed(mshm_handle mshm, uint32_t& last_seen, int timeout_ms, unsigned int spin_us)
+{
+    Return ret;
+    ret.error_code = SHMEM_ERR_NOT_SUPPORTED;
+    ret.error_string = "Change notification is not supported on windows";
+
     return ret;
 }
 
@@ -395,3 +764,19 @@ Return mshm::shmem_delete(const char* name)
 
     return ret;
 }
+
+
+unsigned char* mshm::internal::segment_data(mshm_handle mshm)
+{
+    return ((t_shmem_handle*)mshm)->shm->data;
+}
+
+size_t mshm::internal::segment_size(mshm_handle mshm)
+{
+    return ((t_shmem_handle*)mshm)->shm->data_size;
+}
+
+bool mshm::internal::segment_created(mshm_handle mshm)
+{
+    return ((t_shmem_handle*)mshm)->created;
+}
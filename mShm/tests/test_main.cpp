@@ -7,6 +7,18 @@
 #include <thread>
 #include <atomic>
 #include <vector>
+#include <chrono>
+
+#ifndef _WIN32
+#include <sys/wait.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <unistd.h>
+#endif
 
 struct TestStruct
 {
@@ -28,6 +40,7 @@ TEST(ShmOpen, BasicOpenClose)
 
     ret = mshm::shmem_close(handle);
     EXPECT_EQ(ret.error_code, mshm::SHMEM_OK);
+    mshm::shmem_delete("mshm_test_basic");
 }
 
 TEST(ShmOpen, EmptyName)
@@ -79,6 +92,7 @@ TEST(ShmOpen, ValidNameWithUnderscoreAndDash)
     EXPECT_NE(handle, nullptr);
 
     mshm::shmem_close(handle);
+    mshm::shmem_delete("valid_name-123");
 }
 
 TEST(ShmOpen, ZeroSize)
@@ -95,6 +109,74 @@ TEST(ShmOpen, CloseNullHandle)
     EXPECT_EQ(ret.error_code, mshm::SHMEM_ERR_NOT_OPEN);
 }
 
+TEST(ShmOpen, ConcurrentOpenersSeeAFinishedHeader)
+{
+    // the creator may still be filling the header when the others map the file
+    for (int round = 0; round < 200; ++round)
+    {
+        std::atomic<int> failures{0};
+        std::atomic<bool> go{false};
+        std::vector<std::thread> openers;
+
+        for (int t = 0; t < 4; ++t)
+        {
+            openers.emplace_back([&]()
+            {
+                while (!go.load()) std::this_thread::yield();
+
+                mshm::mshm_handle handle = nullptr;
+                uint64_t value = 0;
+                if (mshm::shmem_open(handle, "mshm_test_concurrent_open", 4096).error_code != mshm::SHMEM_OK
+                    || mshm::shmem_write_ec(handle, &value, sizeof(value)) != mshm::SHMEM_OK)
+                {
+                    ++failures;
+                }
+                mshm::shmem_close(handle);
+            });
+        }
+
+        go.store(true);
+        for (auto& opener : openers) opener.join();
+        mshm::shmem_delete("mshm_test_concurrent_open");
+
+        ASSERT_EQ(failures.load(), 0) << "round " << round;
+    }
+}
+
+#ifndef _WIN32
+TEST(ShmOpen, FailedCreatorLeavesNoName)
+{
+    // the creator can not size the file: it must not leave a name behind that attachers wait on
+    pid_t child = fork();
+
+    if (child == 0)
+    {
+        signal(SIGXFSZ, SIG_IGN);
+        struct rlimit limit = { 4096, 4096 };
+        setrlimit(RLIMIT_FSIZE, &limit);
+
+        mshm::mshm_handle handle = nullptr;
+        _exit(mshm::shmem_open(handle, "mshm_test_failed_creator", 1 << 20).error_code == mshm::SHMEM_ERR_FTRUNC ? 0 : 1);
+    }
+
+    int status = 0;
+    waitpid(child, &status, 0);
+    ASSERT_TRUE(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+    int fd = shm_open("/mshm_test_failed_creator", O_RDWR, 0660);
+    EXPECT_LT(fd, 0);
+    if (fd >= 0) close(fd);
+
+    auto begin = std::chrono::steady_clock::now();
+    mshm::mshm_handle handle = nullptr;
+    ASSERT_EQ(mshm::shmem_open(handle, "mshm_test_failed_creator", 4096).error_code, mshm::SHMEM_OK);
+    EXPECT_LT(std::chrono::steady_clock::now() - begin, std::chrono::milliseconds(500));
+
+    mshm::shmem_close(handle);
+    mshm::shmem_delete("mshm_test_failed_creator");
+}
+#endif
+
 // ============================================================
 // Fixture for write / read tests
 // Each test gets a fresh shared memory segment.
@@ -112,6 +194,7 @@ protected:
     void TearDown() override
     {
         mshm::shmem_close(handle);
+        mshm::shmem_delete("mshm_test_rw");
     }
 
     mshm::mshm_handle handle = nullptr;
@@ -281,6 +364,7 @@ TEST(ShmMultiHandle, TwoHandlesSeeSharedData)
 
     mshm::shmem_close(h1);
     mshm::shmem_close(h2);
+    mshm::shmem_delete(name);
 }
 
 // ============================================================
@@ -317,4 +401,2429 @@ TEST(ShmConcurrent, ConcurrentReadWrite)
     reader.join();
 
     mshm::shmem_close(handle);
+    mshm::shmem_delete("mshm_test_concurrent");
+}
+
+// ============================================================
+// Seqlock sync mode
+// ============================================================
+
+#ifndef _WIN32
+struct SeqStruct
+{
+    uint64_t a;
+    uint64_t b;
+    uint64_t c;
+};
+
+TEST(ShmSeqlock, WriteAndReadRoundtrip)
+{
+    mshm::OpenOptions options;
+    options.sync_mode = mshm::SHMEM_SYNC_SEQLOCK;
+
+    mshm::mshm_handle handle = nullptr;
+    auto ret = mshm::shmem_open(handle, "mshm_test_seqlock_rt", sizeof(TestStruct), options);
+    ASSERT_EQ(ret.error_code, mshm::SHMEM_OK);
+
+    TestStruct src{42, 3.14};
+    ret = mshm::shmem_write(handle, &src, sizeof(TestStruct));
+    EXPECT_EQ(ret.error_code, mshm::SHMEM_OK);
+
+    TestStruct dst{};
+    ret = mshm::shmem_read(handle, &dst, sizeof(TestStruct));
+    EXPECT_EQ(ret.error_code, mshm::SHMEM_OK);
+    EXPECT_EQ(dst.foo, 42);
+    EXPECT_DOUBLE_EQ(dst.bar, 3.14);
+
+    mshm::shmem_close(handle);
+    mshm::shmem_delete("mshm_test_seqlock_rt");
+}
+
+TEST(ShmSeqlock, AttachWithDifferentModeFails)
+{
+    mshm::OpenOptions options;
+    options.sync_mode = mshm::SHMEM_SYNC_SEQLOCK;
+
+    mshm::mshm_handle h1 = nullptr, h2 = nullptr;
+    auto ret = mshm::shmem_open(h1, "mshm_test_seqlock_mode", sizeof(int), options);
+    ASSERT_EQ(ret.error_code, mshm::SHMEM_OK);
+
+    ret = mshm::shmem_open(h2, "mshm_test_seqlock_mode", sizeof(int));
+    EXPECT_EQ(ret.error_code, mshm::SHMEM_ERR_PARAM);
+    EXPECT_EQ(h2, nullptr);
+
+    mshm::shmem_close(h1);
+    mshm::shmem_delete("mshm_test_seqlock_mode");
+}
+
+TEST(ShmSeqlock, ReaderNeverSeesTornWrite)
+{
+    mshm::OpenOptions options;
+    options.sync_mode = mshm::SHMEM_SYNC_SEQLOCK;
+
+    mshm::mshm_handle handle = nullptr;
+    auto ret = mshm::shmem_open(handle, "mshm_test_seqlock_torn", sizeof(SeqStruct), options);
+    ASSERT_EQ(ret.error_code, mshm::SHMEM_OK);
+
+    std::atomic<bool> stop{false};
+
+    std::thread writer([&]() {
+        for (uint64_t i = 0; i < 100000; ++i)
+        {
+            SeqStruct src{i, i, i};
+            mshm::shmem_write(handle, &src, sizeof(SeqStruct));
+        }
+        stop = true;
+    });
+
+    std::thread reader([&]() {
+        SeqStruct dst{};
+        while (!stop)
+        {
+            auto r = mshm::shmem_read(handle, &dst, sizeof(SeqStruct));
+            ASSERT_EQ(r.error_code, mshm::SHMEM_OK);
+            ASSERT_EQ(dst.a, dst.b);
+            ASSERT_EQ(dst.b, dst.c);
+        }
+    });
+
+    writer.join();
+    reader.join();
+
+    mshm::shmem_close(handle);
+    mshm::shmem_delete("mshm_test_seqlock_torn");
+}
+#endif
+
+// ============================================================
+// SPSC channel
+// ============================================================
+
+TEST(ShmChannel, InvalidCapacity)
+{
+    mshm::mshm_channel channel = nullptr;
+    auto ret = mshm::shmem_channel_open(channel, "mshm_test_chan_cap", sizeof(int), 100);
+    EXPECT_EQ(ret.error_code, mshm::SHMEM_ERR_PARAM);
+    EXPECT_EQ(channel, nullptr);
+}
+
+TEST(ShmChannel, PushPopAndFull)
+{
+    mshm::mshm_channel channel = nullptr;
+    auto ret = mshm::shmem_channel_open(channel, "mshm_test_chan_full", sizeof(int), 4);
+    ASSERT_EQ(ret.error_code, mshm::SHMEM_OK);
+
+    int val = 0;
+    EXPECT_FALSE(mshm::shmem_channel_pop(channel, &val));
+
+    for (int i = 0; i < 4; ++i)
+    {
+        EXPECT_TRUE(mshm::shmem_channel_push(channel, &i));
+    }
+    EXPECT_FALSE(mshm::shmem_channel_push(channel, &val));
+    EXPECT_EQ(mshm::shmem_channel_size(channel), 4u);
+
+    for (int i = 0; i < 4; ++i)
+    {
+        EXPECT_TRUE(mshm::shmem_channel_pop(channel, &val));
+        EXPECT_EQ(val, i);
+    }
+
+    mshm::shmem_channel_close(channel);
+    mshm::shmem_delete("mshm_test_chan_full");
+}
+
+TEST(ShmChannel, BatchWrapsAround)
+{
+    mshm::mshm_channel channel = nullptr;
+    auto ret = mshm::shmem_channel_open(channel, "mshm_test_chan_batch", sizeof(int), 8);
+    ASSERT_EQ(ret.error_code, mshm::SHMEM_OK);
+
+    int in[8] = {0, 1, 2, 3, 4, 5, 6, 7};
+    int out[8] = {};
+
+    EXPECT_EQ(mshm::shmem_channel_push_batch(channel, in, 6), 6u);
+    EXPECT_EQ(mshm::shmem_channel_pop_batch(channel, out, 6), 6u);
+
+    // the next batch crosses the end of the ring, and only 8 slots are free
+    EXPECT_EQ(mshm::shmem_channel_push_batch(channel, in, 8), 8u);
+    EXPECT_EQ(mshm::shmem_channel_push_batch(channel, in, 1), 0u);
+    EXPECT_EQ(mshm::shmem_channel_pop_batch(channel, out, 16), 8u);
+
+    for (int i = 0; i < 8; ++i)
+    {
+        EXPECT_EQ(out[i], i);
+    }
+
+    mshm::shmem_channel_close(channel);
+    mshm::shmem_delete("mshm_test_chan_batch");
+}
+
+TEST(ShmChannel, AttachWithDifferentLayoutFails)
+{
+    mshm::mshm_channel c1 = nullptr, c2 = nullptr;
+    auto ret = mshm::shmem_channel_open(c1, "mshm_test_chan_layout", sizeof(int), 8);
+    ASSERT_EQ(ret.error_code, mshm::SHMEM_OK);
+
+    ret = mshm::shmem_channel_open(c2, "mshm_test_chan_layout", sizeof(double), 8);
+    EXPECT_NE(ret.error_code, mshm::SHMEM_OK);
+    EXPECT_EQ(c2, nullptr);
+
+    mshm::shmem_channel_close(c1);
+    mshm::shmem_delete("mshm_test_chan_layout");
+}
+
+TEST(ShmChannel, ProducerConsumerKeepOrder)
+{
+    const uint64_t count = 200000;
+
+    mshm::mshm_channel producer = nullptr, consumer = nullptr;
+    auto ret = mshm::shmem_channel_open(producer, "mshm_test_chan_spsc", sizeof(uint64_t), 1024);
+    ASSERT_EQ(ret.error_code, mshm::SHMEM_OK);
+    ret = mshm::shmem_channel_open(consumer, "mshm_test_chan_spsc", sizeof(uint64_t), 1024);
+    ASSERT_EQ(ret.error_code, mshm::SHMEM_OK);
+
+    std::thread writer([&]() {
+        uint64_t batch[32];
+        uint64_t next = 0;
+        while (next < count)
+        {
+            size_t n = 0;
+            for (; n < 32 && next + n < count; ++n)
+            {
+                batch[n] = next + n;
+            }
+            next += mshm::shmem_channel_push_batch(producer, batch, n);
+        }
+    });
+
+    uint64_t expected = 0;
+    uint64_t out[64];
+    while (expected < count)
+    {
+        size_t n = mshm::shmem_channel_pop_batch(consumer, out, 64);
+        for (size_t i = 0; i < n; ++i)
+        {
+            ASSERT_EQ(out[i], expected++);
+        }
+    }
+
+    writer.join();
+
+    mshm::shmem_channel_close(producer);
+    mshm::shmem_channel_close(consumer);
+    mshm::shmem_delete("mshm_test_chan_spsc");
+}
+
+// ============================================================
+// MPMC queue
+// ============================================================
+
+TEST(ShmQueue, InvalidCapacity)
+{
+    mshm::mshm_queue queue = nullptr;
+    auto ret = mshm::shmem_queue_open(queue, "mshm_test_queue_cap", sizeof(int), 3);
+    EXPECT_EQ(ret.error_code, mshm::SHMEM_ERR_PARAM);
+    EXPECT_EQ(queue, nullptr);
+}
+
+TEST(ShmQueue, TryEnqueueDequeueAndFull)
+{
+    mshm::mshm_queue queue = nullptr;
+    auto ret = mshm::shmem_queue_open(queue, "mshm_test_queue_full", sizeof(int), 4);
+    ASSERT_EQ(ret.error_code, mshm::SHMEM_OK);
+
+    int val = 0;
+    EXPECT_FALSE(mshm::shmem_queue_try_dequeue(queue, &val));
+
+    for (int i = 0; i < 4; ++i)
+    {
+        EXPECT_TRUE(mshm::shmem_queue_try_enqueue(queue, &i));
+    }
+    EXPECT_FALSE(mshm::shmem_queue_try_enqueue(queue, &val));
+    EXPECT_FALSE(mshm::shmem_queue_enqueue(queue, &val, 10)); // times out
+
+    for (int i = 0; i < 4; ++i)
+    {
+        EXPECT_TRUE(mshm::shmem_queue_dequeue(queue, &val, 10));
+        EXPECT_EQ(val, i);
+    }
+    EXPECT_FALSE(mshm::shmem_queue_dequeue(queue, &val, 10));
+
+    mshm::shmem_queue_close(queue);
+    mshm::shmem_delete("mshm_test_queue_full");
+}
+
+TEST(ShmQueue, ManyProducersManyConsumers)
+{
+    const int producers = 3, consumers = 3;
+    const uint64_t per_producer = 20000;
+    const char* name = "mshm_test_queue_mpmc";
+
+    std::vector<mshm::mshm_queue> handles(producers + consumers, nullptr);
+    for (auto& h : handles)
+    {
+        auto ret = mshm::shmem_queue_open(h, name, sizeof(uint64_t), 64);
+        ASSERT_EQ(ret.error_code, mshm::SHMEM_OK);
+    }
+
+    std::atomic<uint64_t> sum{0};
+    std::atomic<uint64_t> received{0};
+    std::vector<std::thread> threads;
+
+    for (int p = 0; p < producers; ++p)
+    {
+        threads.emplace_back([&, p]() {
+            for (uint64_t i = 1; i <= per_producer; ++i)
+            {
+                mshm::shmem_queue_enqueue(handles[p], &i);
+            }
+        });
+    }
+
+    for (int c = 0; c < consumers; ++c)
+    {
+        threads.emplace_back([&, c]() {
+            uint64_t val = 0;
+            while (received.load() < producers * per_producer)
+            {
+                if (mshm::shmem_queue_dequeue(handles[producers + c], &val, 1))
+                {
+                    sum += val;
+                    ++received;
+                }
+            }
+        });
+    }
+
+    for (auto& t : threads)
+    {
+        t.join();
+    }
+
+    EXPECT_EQ(received.load(), producers * per_producer);
+    EXPECT_EQ(sum.load(), producers * per_producer * (per_producer + 1) / 2);
+
+    for (auto& h : handles)
+    {
+        mshm::shmem_queue_close(h);
+    }
+    mshm::shmem_delete(name);
+}
+
+// ============================================================
+// Zero-copy views
+// ============================================================
+
+TEST_F(ShmWriteRead, WriteViewThenRead)
+{
+    mshm::View view;
+    auto ret = mshm::shmem_acquire_view(handle, view, mshm::SHMEM_VIEW_WRITE, sizeof(double), offsetof(TestStruct, bar));
+    ASSERT_EQ(ret.error_code, mshm::SHMEM_OK);
+    ASSERT_NE(view.data, nullptr);
+    EXPECT_EQ(view.size, sizeof(double));
+
+    *(double*)view.data = 6.28;
+
+    ret = mshm::shmem_release_view(view);
+    EXPECT_EQ(ret.error_code, mshm::SHMEM_OK);
+    EXPECT_EQ(view.data, nullptr);
+
+    TestStruct dst{};
+    mshm::shmem_read(handle, &dst, sizeof(TestStruct));
+    EXPECT_DOUBLE_EQ(dst.bar, 6.28);
+}
+
+TEST_F(ShmWriteRead, ReadViewSeesWrite)
+{
+    TestStruct src{5, 0.5};
+    mshm::shmem_write(handle, &src, sizeof(TestStruct));
+
+    mshm::View view;
+    auto ret = mshm::shmem_acquire_view(handle, view, mshm::SHMEM_VIEW_READ, sizeof(TestStruct));
+    ASSERT_EQ(ret.error_code, mshm::SHMEM_OK);
+    EXPECT_EQ(((const TestStruct*)view.data)->foo, 5);
+
+    ret = mshm::shmem_release_view(view);
+    EXPECT_EQ(ret.error_code, mshm::SHMEM_OK);
+}
+
+TEST_F(ShmWriteRead, ViewExceedsBuffer)
+{
+    mshm::View view;
+    auto ret = mshm::shmem_acquire_view(handle, view, mshm::SHMEM_VIEW_READ, sizeof(TestStruct), 1);
+    EXPECT_EQ(ret.error_code, mshm::SHMEM_ERR_PARAM);
+    EXPECT_EQ(view.data, nullptr);
+}
+
+#ifndef _WIN32
+TEST(ShmSeqlock, ReadViewDetectsConcurrentWrite)
+{
+    mshm::OpenOptions options;
+    options.sync_mode = mshm::SHMEM_SYNC_SEQLOCK;
+
+    mshm::mshm_handle handle = nullptr;
+    auto ret = mshm::shmem_open(handle, "mshm_test_seqlock_view", sizeof(int), options);
+    ASSERT_EQ(ret.error_code, mshm::SHMEM_OK);
+
+    mshm::View view;
+    ret = mshm::shmem_acquire_view(handle, view, mshm::SHMEM_VIEW_READ, sizeof(int));
+    ASSERT_EQ(ret.error_code, mshm::SHMEM_OK);
+
+    // readers hold no lock, so the writer is not blocked
+    int val = 3;
+    ret = mshm::shmem_write(handle, &val, sizeof(int));
+    EXPECT_EQ(ret.error_code, mshm::SHMEM_OK);
+
+    ret = mshm::shmem_release_view(view);
+    EXPECT_EQ(ret.error_code, mshm::SHMEM_ERR_COPY);
+
+    ret = mshm::shmem_acquire_view(handle, view, mshm::SHMEM_VIEW_READ, sizeof(int));
+    ASSERT_EQ(ret.error_code, mshm::SHMEM_OK);
+    EXPECT_EQ(*(const int*)view.data, 3);
+    ret = mshm::shmem_release_view(view);
+    EXPECT_EQ(ret.error_code, mshm::SHMEM_OK);
+
+    mshm::shmem_close(handle);
+    mshm::shmem_delete("mshm_test_seqlock_view");
+}
+#endif
+
+// ============================================================
+// Change notification
+// ============================================================
+
+#ifndef _WIN32
+TEST_F(ShmWriteRead, WaitChangedTimesOut)
+{
+    uint32_t last_seen = 0; // fresh segment: nothing written yet
+    auto ret = mshm::shmem_wait_changed(handle, last_seen, 20);
+    EXPECT_EQ(ret.error_code, mshm::SHMEM_ERR_TIMEOUT);
+    EXPECT_EQ(last_seen, 0u);
+}
+
+TEST_F(ShmWriteRead, WaitChangedReturnsOnWrite)
+{
+    uint32_t last_seen = 0;
+
+    std::thread writer([&]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        int val = 7;
+        mshm::shmem_write(handle, &val, sizeof(int));
+    });
+
+    auto ret = mshm::shmem_wait_changed(handle, last_seen, 5000);
+    EXPECT_EQ(ret.error_code, mshm::SHMEM_OK);
+    EXPECT_EQ(last_seen, 1u);
+
+    writer.join();
+
+    int val = 0;
+    mshm::shmem_read(handle, &val, sizeof(int));
+    EXPECT_EQ(val, 7);
+}
+
+TEST_F(ShmWriteRead, WaitChangedWithSpinBudget)
+{
+    uint32_t last_seen = 0;
+
+    int val = 1;
+    mshm::shmem_write(handle, &val, sizeof(int));
+
+    auto ret = mshm::shmem_wait_changed(handle, last_seen, 1000, 100);
+    EXPECT_EQ(ret.error_code, mshm::SHMEM_OK);
 }
+#endif
+
+// ============================================================
+// Lock policies
+// ============================================================
+
+#ifndef _WIN32
+TEST(ShmLockPolicy, AdaptiveRoundtrip)
+{
+    mshm::OpenOptions options;
+    options.lock_policy = mshm::SHMEM_LOCK_ADAPTIVE;
+
+    mshm::mshm_handle handle = nullptr;
+    auto ret = mshm::shmem_open(handle, "mshm_test_lock_adaptive", sizeof(int), options);
+    ASSERT_EQ(ret.error_code, mshm::SHMEM_OK);
+
+    int val_w = 11, val_r = 0;
+    EXPECT_EQ(mshm::shmem_write(handle, &val_w, sizeof(int)).error_code, mshm::SHMEM_OK);
+    EXPECT_EQ(mshm::shmem_read(handle, &val_r, sizeof(int)).error_code, mshm::SHMEM_OK);
+    EXPECT_EQ(val_r, 11);
+
+    mshm::shmem_close(handle);
+    mshm::shmem_delete("mshm_test_lock_adaptive");
+}
+
+TEST(ShmLockPolicy, AttachWithDifferentPolicyFails)
+{
+    mshm::OpenOptions options;
+    options.lock_policy = mshm::SHMEM_LOCK_ROBUST;
+
+    mshm::mshm_handle h1 = nullptr, h2 = nullptr;
+    auto ret = mshm::shmem_open(h1, "mshm_test_lock_mismatch", sizeof(int), options);
+    ASSERT_EQ(ret.error_code, mshm::SHMEM_OK);
+
+    ret = mshm::shmem_open(h2, "mshm_test_lock_mismatch", sizeof(int));
+    EXPECT_EQ(ret.error_code, mshm::SHMEM_ERR_PARAM);
+    EXPECT_EQ(h2, nullptr);
+
+    mshm::shmem_close(h1);
+    mshm::shmem_delete("mshm_test_lock_mismatch");
+}
+
+TEST(ShmLockPolicy, TimedLockExpires)
+{
+    mshm::OpenOptions options;
+    options.lock_timeout_ms = 20;
+
+    mshm::mshm_handle handle = nullptr;
+    auto ret = mshm::shmem_open(handle, "mshm_test_lock_timed", sizeof(int), options);
+    ASSERT_EQ(ret.error_code, mshm::SHMEM_OK);
+
+    mshm::View view;
+    ret = mshm::shmem_acquire_view(handle, view, mshm::SHMEM_VIEW_WRITE, sizeof(int));
+    ASSERT_EQ(ret.error_code, mshm::SHMEM_OK);
+
+    std::thread other([&]() {
+        int val = 1;
+        auto r = mshm::shmem_write(handle, &val, sizeof(int));
+        EXPECT_EQ(r.error_code, mshm::SHMEM_ERR_TIMEOUT);
+    });
+    other.join();
+
+    mshm::shmem_release_view(view);
+
+    mshm::shmem_close(handle);
+    mshm::shmem_delete("mshm_test_lock_timed");
+}
+
+TEST(ShmLockPolicy, RobustRecoversFromDeadOwner)
+{
+    mshm::OpenOptions options;
+    options.sync_mode = mshm::SHMEM_SYNC_SEQLOCK;
+    options.lock_policy = mshm::SHMEM_LOCK_ROBUST;
+
+    mshm::mshm_handle handle = nullptr;
+    auto ret = mshm::shmem_open(handle, "mshm_test_lock_robust", sizeof(int), options);
+    ASSERT_EQ(ret.error_code, mshm::SHMEM_OK);
+
+    pid_t pid = fork();
+    ASSERT_GE(pid, 0);
+
+    if (pid == 0)
+    {
+        // die in the middle of a write, holding the mutex
+        mshm::View view;
+        mshm::shmem_acquire_view(handle, view, mshm::SHMEM_VIEW_WRITE, sizeof(int));
+        _exit(0);
+    }
+
+    int status = 0;
+    waitpid(pid, &status, 0);
+
+    int val = 5;
+    ret = mshm::shmem_write(handle, &val, sizeof(int));
+    EXPECT_EQ(ret.error_code, mshm::SHMEM_ERR_OWNER_DEAD);
+
+    ret = mshm::shmem_write(handle, &val, sizeof(int));
+    EXPECT_EQ(ret.error_code, mshm::SHMEM_OK);
+
+    // the seqlock sequence was repaired, readers do not spin forever
+    int out = 0;
+    ret = mshm::shmem_read(handle, &out, sizeof(int));
+    EXPECT_EQ(ret.error_code, mshm::SHMEM_OK);
+    EXPECT_EQ(out, 5);
+
+    mshm::shmem_close(handle);
+    mshm::shmem_delete("mshm_test_lock_robust");
+}
+
+TEST(ShmLockPolicy, PriorityInheritance)
+{
+    mshm::OpenOptions options;
+    options.lock_policy = mshm::SHMEM_LOCK_PRIO_INHERIT | mshm::SHMEM_LOCK_ROBUST;
+
+    mshm::mshm_handle handle = nullptr;
+    auto ret = mshm::shmem_open(handle, "mshm_test_lock_pi", sizeof(int), options);
+    ASSERT_EQ(ret.error_code, mshm::SHMEM_OK);
+
+    int val_w = 3, val_r = 0;
+    EXPECT_EQ(mshm::shmem_write(handle, &val_w, sizeof(int)).error_code, mshm::SHMEM_OK);
+    EXPECT_EQ(mshm::shmem_read(handle, &val_r, sizeof(int)).error_code, mshm::SHMEM_OK);
+    EXPECT_EQ(val_r, 3);
+
+    mshm::shmem_close(handle);
+    mshm::shmem_delete("mshm_test_lock_pi");
+}
+#endif
+
+// ============================================================
+// Triple buffer sync mode
+// ============================================================
+
+#ifndef _WIN32
+class ShmTripleBuffer : public ::testing::Test
+{
+protected:
+    void SetUp() override
+    {
+        mshm::OpenOptions options;
+        options.sync_mode = mshm::SHMEM_SYNC_TRIPLE_BUFFER;
+
+        auto ret = mshm::shmem_open(handle, "mshm_test_triple", sizeof(SeqStruct), options);
+        ASSERT_EQ(ret.error_code, mshm::SHMEM_OK);
+    }
+
+    void TearDown() override
+    {
+        mshm::shmem_close(handle);
+        mshm::shmem_delete("mshm_test_triple");
+    }
+
+    mshm::mshm_handle handle = nullptr;
+};
+
+TEST_F(ShmTripleBuffer, PartialWritesCarryUntouchedBytes)
+{
+    SeqStruct src{1, 2, 3};
+    ASSERT_EQ(mshm::shmem_write(handle, &src, sizeof(SeqStruct)).error_code, mshm::SHMEM_OK);
+
+    // each partial write lands in a different copy: the other fields must follow
+    for (uint64_t i = 10; i < 16; ++i)
+    {
+        ASSERT_EQ(mshm::shmem_write(handle, &i, sizeof(uint64_t), offsetof(SeqStruct, b)).error_code, mshm::SHMEM_OK);
+
+        SeqStruct dst{};
+        ASSERT_EQ(mshm::shmem_read(handle, &dst, sizeof(SeqStruct)).error_code, mshm::SHMEM_OK);
+        EXPECT_EQ(dst.a, 1u);
+        EXPECT_EQ(dst.b, i);
+        EXPECT_EQ(dst.c, 3u);
+    }
+}
+
+TEST_F(ShmTripleBuffer, WriteViewPublishesOnRelease)
+{
+    SeqStruct src{1, 2, 3};
+    mshm::shmem_write(handle, &src, sizeof(SeqStruct));
+
+    mshm::View view;
+    ASSERT_EQ(mshm::shmem_acquire_view(handle, view, mshm::SHMEM_VIEW_WRITE, sizeof(uint64_t), offsetof(SeqStruct, c)).error_code, mshm::SHMEM_OK);
+    *(uint64_t*)view.data = 30;
+
+    // not visible until released
+    SeqStruct dst{};
+    mshm::shmem_read(handle, &dst, sizeof(SeqStruct));
+    EXPECT_EQ(dst.c, 3u);
+
+    ASSERT_EQ(mshm::shmem_release_view(view).error_code, mshm::SHMEM_OK);
+
+    mshm::shmem_read(handle, &dst, sizeof(SeqStruct));
+    EXPECT_EQ(dst.a, 1u);
+    EXPECT_EQ(dst.c, 30u);
+
+    ASSERT_EQ(mshm::shmem_acquire_view(handle, view, mshm::SHMEM_VIEW_READ, sizeof(SeqStruct)).error_code, mshm::SHMEM_OK);
+    EXPECT_EQ(((const SeqStruct*)view.data)->c, 30u);
+    EXPECT_EQ(mshm::shmem_release_view(view).error_code, mshm::SHMEM_OK);
+}
+
+TEST_F(ShmTripleBuffer, ReaderAlwaysSeesCompleteSnapshot)
+{
+    std::atomic<bool> stop{false};
+
+    std::thread writer([&]() {
+        for (uint64_t i = 0; i < 100000; ++i)
+        {
+            SeqStruct src{i, i, i};
+            mshm::shmem_write(handle, &src, sizeof(SeqStruct));
+        }
+        stop = true;
+    });
+
+    std::thread reader([&]() {
+        SeqStruct dst{};
+        uint64_t last = 0;
+        while (!stop)
+        {
+            ASSERT_EQ(mshm::shmem_read(handle, &dst, sizeof(SeqStruct)).error_code, mshm::SHMEM_OK);
+            ASSERT_EQ(dst.a, dst.b);
+            ASSERT_EQ(dst.b, dst.c);
+            ASSERT_GE(dst.a, last); // snapshots never go back in time
+            last = dst.a;
+        }
+    });
+
+    writer.join();
+    reader.join();
+}
+#endif
+
+// ============================================================
+// Huge page backing
+// ============================================================
+
+#ifndef _WIN32
+TEST(ShmHugePages, DefaultIsRegularPages)
+{
+    mshm::mshm_handle handle = nullptr;
+    auto ret = mshm::shmem_open(handle, "mshm_test_pages_default", sizeof(int));
+    ASSERT_EQ(ret.error_code, mshm::SHMEM_OK);
+    EXPECT_EQ(mshm::shmem_backing(handle), mshm::SHMEM_BACKING_PAGES);
+
+    mshm::shmem_close(handle);
+    mshm::shmem_delete("mshm_test_pages_default");
+}
+
+TEST(ShmHugePages, HugeRequestFallsBackGracefully)
+{
+    mshm::OpenOptions options;
+    options.page_size = mshm::SHMEM_PAGE_HUGE_2M;
+
+    mshm::mshm_handle h1 = nullptr, h2 = nullptr;
+    auto ret = mshm::shmem_open(h1, "mshm_test_pages_huge", 3 << 20, options);
+    ASSERT_EQ(ret.error_code, mshm::SHMEM_OK);
+
+    // whatever the machine gives: hugetlbfs, THP or plain pages
+    mshm::Backing backing = mshm::shmem_backing(h1);
+    EXPECT_NE(backing, mshm::SHMEM_BACKING_HUGETLB_1G);
+
+    // a second opener finds the segment wherever it was placed
+    ret = mshm::shmem_open(h2, "mshm_test_pages_huge", 3 << 20, options);
+    ASSERT_EQ(ret.error_code, mshm::SHMEM_OK);
+    EXPECT_EQ(mshm::shmem_backing(h2), backing);
+
+    uint64_t val_w = 0x1234, val_r = 0;
+    mshm::shmem_write(h1, &val_w, sizeof(val_w), (3 << 20) - sizeof(val_w));
+    mshm::shmem_read(h2, &val_r, sizeof(val_r), (3 << 20) - sizeof(val_r));
+    EXPECT_EQ(val_r, val_w);
+
+    mshm::shmem_close(h1);
+    mshm::shmem_close(h2);
+    EXPECT_EQ(mshm::shmem_delete("mshm_test_pages_huge").error_code, mshm::SHMEM_OK);
+}
+
+TEST(ShmHugePages, PageSizeIsPartOfTheSegment)
+{
+    mshm::OpenOptions options;
+    options.page_size = mshm::SHMEM_PAGE_HUGE_2M;
+
+    mshm::mshm_handle huge = nullptr, plain = nullptr;
+    ASSERT_EQ(mshm::shmem_open(huge, "mshm_test_pages_mismatch", 3 << 20, options).error_code, mshm::SHMEM_OK);
+
+    // found wherever it was placed and refused, never a second segment under the same name
+    EXPECT_EQ(mshm::shmem_open(plain, "mshm_test_pages_mismatch", 3 << 20).error_code, mshm::SHMEM_ERR_PARAM);
+    EXPECT_EQ(plain, nullptr);
+
+    mshm::shmem_close(huge);
+    EXPECT_EQ(mshm::shmem_delete("mshm_test_pages_mismatch").error_code, mshm::SHMEM_OK);
+    EXPECT_NE(mshm::shmem_delete("mshm_test_pages_mismatch").error_code, mshm::SHMEM_OK);
+}
+#endif
+
+// ============================================================
+// Prefault options
+// ============================================================
+
+#ifndef _WIN32
+static size_t resident_pages(const void* addr, size_t size)
+{
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    uintptr_t begin = (uintptr_t)addr & ~(uintptr_t)(page - 1);
+    uintptr_t end = ((uintptr_t)addr + size + page - 1) & ~(uintptr_t)(page - 1);
+
+    std::vector<unsigned char> vec((end - begin) / page);
+    if (mincore((void*)begin, end - begin, vec.data()) != 0)
+    {
+        return 0;
+    }
+
+    size_t resident = 0;
+    for (unsigned char v : vec) resident += v & 1;
+    return resident;
+}
+
+TEST(ShmPrefault, UnknownFlag)
+{
+    mshm::OpenOptions options;
+    options.prefault = 1u << 30;
+
+    mshm::mshm_handle handle = nullptr;
+    auto ret = mshm::shmem_open(handle, "mshm_test_prefault_bad", sizeof(int), options);
+    EXPECT_EQ(ret.error_code, mshm::SHMEM_ERR_PARAM);
+}
+
+TEST(ShmPrefault, ParallelPrefaultMakesEveryPageResident)
+{
+    const size_t size = 16 << 20;
+
+    mshm::OpenOptions options;
+    options.prefault = mshm::SHMEM_PREFAULT_PARALLEL;
+    options.prefault_threads = 4;
+
+    mshm::mshm_handle handle = nullptr;
+    auto ret = mshm::shmem_open(handle, "mshm_test_prefault_par", size, options);
+    ASSERT_EQ(ret.error_code, mshm::SHMEM_OK);
+
+    mshm::View view;
+    ASSERT_EQ(mshm::shmem_acquire_view(handle, view, mshm::SHMEM_VIEW_READ, size).error_code, mshm::SHMEM_OK);
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    EXPECT_GE(resident_pages(view.data, size), size / page);
+
+    // prefaulting never changes the content
+    EXPECT_EQ(((const unsigned char*)view.data)[size - 1], 0);
+    mshm::shmem_release_view(view);
+
+    mshm::shmem_close(handle);
+    mshm::shmem_delete("mshm_test_prefault_par");
+}
+
+TEST(ShmPrefault, PopulateAndLock)
+{
+    const size_t size = 1 << 20;
+
+    for (unsigned int flags : { (unsigned int)mshm::SHMEM_PREFAULT_POPULATE,
+                                (unsigned int)mshm::SHMEM_PREFAULT_LOCK,
+                                (unsigned int)(mshm::SHMEM_PREFAULT_LOCK_ON_FAULT | mshm::SHMEM_PREFAULT_PARALLEL) })
+    {
+        mshm::OpenOptions options;
+        options.prefault = flags;
+
+        mshm::mshm_handle handle = nullptr;
+        auto ret = mshm::shmem_open(handle, "mshm_test_prefault_lock", size, options);
+
+        if (ret.error_code != mshm::SHMEM_OK)
+        {
+            // pinning needs CAP_IPC_LOCK or enough RLIMIT_MEMLOCK
+            EXPECT_NE(flags, (unsigned int)mshm::SHMEM_PREFAULT_POPULATE);
+            EXPECT_EQ(handle, nullptr);
+            continue;
+        }
+
+        uint64_t val_w = flags, val_r = 0;
+        mshm::shmem_write(handle, &val_w, sizeof(val_w), size - sizeof(val_w));
+        mshm::shmem_read(handle, &val_r, sizeof(val_r), size - sizeof(val_r));
+        EXPECT_EQ(val_r, val_w);
+
+        mshm::shmem_close(handle);
+        mshm::shmem_delete("mshm_test_prefault_lock");
+    }
+}
+#endif
+
+// ============================================================
+// NUMA placement
+// ============================================================
+
+#ifndef _WIN32
+TEST(ShmNuma, PoliciesOpenAnywhere)
+{
+    for (mshm::NumaPolicy policy : { mshm::SHMEM_NUMA_BIND, mshm::SHMEM_NUMA_INTERLEAVE, mshm::SHMEM_NUMA_FIRST_TOUCH })
+    {
+        mshm::OpenOptions options;
+        options.numa_policy = policy;
+        options.numa_node = 0;
+        options.prefault = mshm::SHMEM_PREFAULT_POPULATE;
+
+        mshm::mshm_handle handle = nullptr;
+        auto ret = mshm::shmem_open(handle, "mshm_test_numa", 1 << 20, options);
+        ASSERT_EQ(ret.error_code, mshm::SHMEM_OK) << ret.error_string;
+
+        uint64_t val_w = policy, val_r = 0;
+        mshm::shmem_write(handle, &val_w, sizeof(val_w));
+        mshm::shmem_read(handle, &val_r, sizeof(val_r));
+        EXPECT_EQ(val_r, val_w);
+
+        mshm::shmem_close(handle);
+        mshm::shmem_delete("mshm_test_numa");
+    }
+}
+
+TEST(ShmNuma, ResidencyCountsTouchedPages)
+{
+    const size_t size = 1 << 20;
+
+    mshm::OpenOptions options;
+    options.prefault = mshm::SHMEM_PREFAULT_PARALLEL;
+
+    mshm::mshm_handle handle = nullptr;
+    auto ret = mshm::shmem_open(handle, "mshm_test_numa_residency", size, options);
+    ASSERT_EQ(ret.error_code, mshm::SHMEM_OK);
+
+    std::vector<size_t> pages_per_node;
+    ret = mshm::shmem_numa_residency(handle, pages_per_node);
+
+    if (ret.error_code == mshm::SHMEM_OK)
+    {
+        size_t total = 0;
+        for (size_t pages : pages_per_node) total += pages;
+        EXPECT_GE(total, size / (size_t)sysconf(_SC_PAGESIZE));
+    }
+    else
+    {
+        // move_pages may be filtered out in containers
+        EXPECT_EQ(ret.error_code, mshm::SHMEM_ERR_NOT_SUPPORTED);
+    }
+
+    mshm::shmem_close(handle);
+    mshm::shmem_delete("mshm_test_numa_residency");
+}
+#endif
+
+// ============================================================
+// Scatter write
+// ============================================================
+
+TEST_F(ShmWriteRead, WritevUpdatesEveryField)
+{
+    int foo = 21;
+    double bar = 4.5;
+    mshm::WriteEntry entries[] = {
+        { &foo, sizeof(foo), offsetof(TestStruct, foo) },
+        { &bar, sizeof(bar), offsetof(TestStruct, bar) },
+    };
+
+    auto ret = mshm::shmem_writev(handle, entries, 2);
+    EXPECT_EQ(ret.error_code, mshm::SHMEM_OK);
+
+    TestStruct dst{};
+    mshm::shmem_read(handle, &dst, sizeof(TestStruct));
+    EXPECT_EQ(dst.foo, 21);
+    EXPECT_DOUBLE_EQ(dst.bar, 4.5);
+}
+
+TEST_F(ShmWriteRead, WritevInvalidEntryWritesNothing)
+{
+    int foo = 21;
+    double bar = 4.5;
+    mshm::WriteEntry entries[] = {
+        { &foo, sizeof(foo), offsetof(TestStruct, foo) },
+        { &bar, sizeof(bar), sizeof(TestStruct) },          // out of bounds
+    };
+
+    auto ret = mshm::shmem_writev(handle, entries, 2);
+    EXPECT_EQ(ret.error_code, mshm::SHMEM_ERR_PARAM);
+
+    TestStruct dst{1, 1.0};
+    mshm::shmem_read(handle, &dst, sizeof(TestStruct));
+    EXPECT_EQ(dst.foo, 0);
+
+    entries[1] = { nullptr, sizeof(bar), offsetof(TestStruct, bar) };
+    ret = mshm::shmem_writev(handle, entries, 2);
+    EXPECT_EQ(ret.error_code, mshm::SHMEM_ERR_PARAM);
+}
+
+#ifndef _WIN32
+TEST(ShmSeqlock, WritevIsPublishedAtomically)
+{
+    mshm::OpenOptions options;
+    options.sync_mode = mshm::SHMEM_SYNC_SEQLOCK;
+
+    mshm::mshm_handle handle = nullptr;
+    auto ret = mshm::shmem_open(handle, "mshm_test_seqlock_writev", sizeof(SeqStruct), options);
+    ASSERT_EQ(ret.error_code, mshm::SHMEM_OK);
+
+    std::atomic<bool> stop{false};
+
+    std::thread writer([&]() {
+        for (uint64_t i = 0; i < 50000; ++i)
+        {
+            // three separate fields, one update
+            mshm::WriteEntry entries[] = {
+                { &i, sizeof(i), offsetof(SeqStruct, a) },
+                { &i, sizeof(i), offsetof(SeqStruct, b) },
+                { &i, sizeof(i), offsetof(SeqStruct, c) },
+            };
+            mshm::shmem_writev(handle, entries, 3);
+        }
+        stop = true;
+    });
+
+    std::thread reader([&]() {
+        SeqStruct dst{};
+        while (!stop)
+        {
+            ASSERT_EQ(mshm::shmem_read(handle, &dst, sizeof(SeqStruct)).error_code, mshm::SHMEM_OK);
+            ASSERT_EQ(dst.a, dst.b);
+            ASSERT_EQ(dst.b, dst.c);
+        }
+    });
+
+    writer.join();
+    reader.join();
+
+    mshm::shmem_close(handle);
+    mshm::shmem_delete("mshm_test_seqlock_writev");
+}
+
+TEST_F(ShmTripleBuffer, WritevCarriesUntouchedBytes)
+{
+    SeqStruct src{1, 2, 3};
+    mshm::shmem_write(handle, &src, sizeof(SeqStruct));
+
+    uint64_t a = 10, c = 30;
+    mshm::WriteEntry entries[] = {
+        { &a, sizeof(a), offsetof(SeqStruct, a) },
+        { &c, sizeof(c), offsetof(SeqStruct, c) },
+    };
+    ASSERT_EQ(mshm::shmem_writev(handle, entries, 2).error_code, mshm::SHMEM_OK);
+
+    SeqStruct dst{};
+    mshm::shmem_read(handle, &dst, sizeof(SeqStruct));
+    EXPECT_EQ(dst.a, 10u);
+    EXPECT_EQ(dst.b, 2u);
+    EXPECT_EQ(dst.c, 30u);
+}
+#endif
+
+// ============================================================
+// Gather read
+// ============================================================
+
+TEST_F(ShmWriteRead, ReadvReturnsFieldsAndGeneration)
+{
+    uint64_t before = 0;
+    ASSERT_EQ(mshm::shmem_readv(handle, nullptr, 0, before).error_code, mshm::SHMEM_OK);
+
+    TestStruct src{42, 2.5};
+    mshm::shmem_write(handle, &src, sizeof(TestStruct));
+
+    int foo = 0;
+    double bar = 0;
+    mshm::ReadEntry entries[] = {
+        { &bar, sizeof(bar), offsetof(TestStruct, bar) },
+        { &foo, sizeof(foo), offsetof(TestStruct, foo) },
+    };
+
+    uint64_t generation = 0;
+    ASSERT_EQ(mshm::shmem_readv(handle, entries, 2, generation).error_code, mshm::SHMEM_OK);
+    EXPECT_EQ(foo, 42);
+    EXPECT_DOUBLE_EQ(bar, 2.5);
+    EXPECT_EQ(generation, before + 1);
+
+    entries[1].offset = sizeof(TestStruct);
+    EXPECT_EQ(mshm::shmem_readv(handle, entries, 2, generation).error_code, mshm::SHMEM_ERR_PARAM);
+}
+
+#ifndef _WIN32
+TEST(ShmSeqlock, ReadvSeesOneWrite)
+{
+    mshm::OpenOptions options;
+    options.sync_mode = mshm::SHMEM_SYNC_SEQLOCK;
+
+    mshm::mshm_handle handle = nullptr;
+    auto ret = mshm::shmem_open(handle, "mshm_test_seqlock_readv", sizeof(SeqStruct), options);
+    ASSERT_EQ(ret.error_code, mshm::SHMEM_OK);
+
+    std::atomic<bool> stop{false};
+
+    std::thread writer([&]() {
+        for (uint64_t i = 1; i <= 50000; ++i)
+        {
+            SeqStruct src{i, i, i};
+            mshm::shmem_write(handle, &src, sizeof(SeqStruct));
+        }
+        stop = true;
+    });
+
+    std::thread reader([&]() {
+        uint64_t a = 0, c = 0, generation = 0;
+        mshm::ReadEntry entries[] = {
+            { &a, sizeof(a), offsetof(SeqStruct, a) },
+            { &c, sizeof(c), offsetof(SeqStruct, c) },
+        };
+        while (!stop)
+        {
+            ASSERT_EQ(mshm::shmem_readv(handle, entries, 2, generation).error_code, mshm::SHMEM_OK);
+            ASSERT_EQ(a, c);
+            ASSERT_EQ(a, generation); // write i is generation i
+        }
+    });
+
+    writer.join();
+    reader.join();
+
+    mshm::shmem_close(handle);
+    mshm::shmem_delete("mshm_test_seqlock_readv");
+}
+
+TEST_F(ShmTripleBuffer, ReadvReportsSnapshotGeneration)
+{
+    for (uint64_t i = 1; i <= 5; ++i)
+    {
+        SeqStruct src{i, i, i};
+        mshm::shmem_write(handle, &src, sizeof(SeqStruct));
+    }
+
+    uint64_t b = 0, generation = 0;
+    mshm::ReadEntry entry{ &b, sizeof(b), offsetof(SeqStruct, b) };
+    ASSERT_EQ(mshm::shmem_readv(handle, &entry, 1, generation).error_code, mshm::SHMEM_OK);
+    EXPECT_EQ(b, 5u);
+    EXPECT_EQ(generation, 5u);
+}
+#endif
+
+// ============================================================
+// Lock stripes
+// ============================================================
+
+#ifndef _WIN32
+TEST(ShmLockStripes, WriteReadAcrossStripes)
+{
+    mshm::OpenOptions options;
+    options.lock_stripes = 4;
+
+    std::vector<unsigned char> src(1000), dst(1000);
+    for (size_t i = 0; i < src.size(); ++i) src[i] = (unsigned char)i;
+
+    mshm::mshm_handle handle = nullptr;
+    ASSERT_EQ(mshm::shmem_open(handle, "mshm_test_stripes", src.size(), options).error_code, mshm::SHMEM_OK);
+
+    // one stripe, several stripes, the whole segment
+    EXPECT_EQ(mshm::shmem_write(handle, src.data(), 10, 5).error_code, mshm::SHMEM_OK);
+    EXPECT_EQ(mshm::shmem_write(handle, src.data(), 600, 200).error_code, mshm::SHMEM_OK);
+    EXPECT_EQ(mshm::shmem_write(handle, src.data(), src.size()).error_code, mshm::SHMEM_OK);
+    EXPECT_EQ(mshm::shmem_read(handle, dst.data(), dst.size()).error_code, mshm::SHMEM_OK);
+    EXPECT_EQ(src, dst);
+
+    mshm::View view;
+    ASSERT_EQ(mshm::shmem_acquire_view(handle, view, mshm::SHMEM_VIEW_WRITE, 300, 500).error_code, mshm::SHMEM_OK);
+    memset(view.data, 0xAB, view.size);
+    ASSERT_EQ(mshm::shmem_release_view(view).error_code, mshm::SHMEM_OK);
+
+    unsigned char byte = 0;
+    mshm::shmem_read(handle, &byte, 1, 799);
+    EXPECT_EQ(byte, 0xAB);
+
+    // stripes are part of the layout
+    mshm::mshm_handle other = nullptr;
+    EXPECT_EQ(mshm::shmem_open(other, "mshm_test_stripes", src.size()).error_code, mshm::SHMEM_ERR_PARAM);
+
+    mshm::shmem_close(handle);
+    mshm::shmem_delete("mshm_test_stripes");
+}
+
+TEST(ShmLockStripes, RejectsNonMutexModes)
+{
+    mshm::OpenOptions options;
+    options.lock_stripes = 4;
+    options.sync_mode = mshm::SHMEM_SYNC_SEQLOCK;
+
+    mshm::mshm_handle handle = nullptr;
+    EXPECT_EQ(mshm::shmem_open(handle, "mshm_test_stripes_mode", 1024, options).error_code, mshm::SHMEM_ERR_PARAM);
+
+    options.sync_mode = mshm::SHMEM_SYNC_MUTEX;
+    options.lock_stripes = 100; // more stripes than cache lines
+    EXPECT_EQ(mshm::shmem_open(handle, "mshm_test_stripes_mode", 1024, options).error_code, mshm::SHMEM_ERR_PARAM);
+
+    // 640 bytes in 7 stripes: blocks of 128 bytes, the last two would start past the data
+    options.lock_stripes = 7;
+    EXPECT_EQ(mshm::shmem_open(handle, "mshm_test_stripes_mode", 640, options).error_code, mshm::SHMEM_ERR_PARAM);
+
+    options.lock_stripes = 5;
+    ASSERT_EQ(mshm::shmem_open(handle, "mshm_test_stripes_mode", 640, options).error_code, mshm::SHMEM_OK);
+    mshm::shmem_close(handle);
+    mshm::shmem_delete("mshm_test_stripes_mode");
+}
+
+TEST(ShmLockStripes, GenerationCountsWritesOnEveryStripe)
+{
+    mshm::OpenOptions options;
+    options.lock_stripes = 4;
+
+    mshm::mshm_handle handle = nullptr;
+    ASSERT_EQ(mshm::shmem_open(handle, "mshm_test_stripes_generation", 4096, options).error_code, mshm::SHMEM_OK);
+
+    uint32_t last_seen = 0;
+    uint64_t value = 1, generation = 0;
+    mshm::ReadEntry entry = { &value, sizeof(value), 0 };
+
+    // writes on different stripes, and one spanning them all
+    mshm::shmem_write(handle, &value, sizeof(value), 0);
+    mshm::shmem_write(handle, &value, sizeof(value), 3000);
+    mshm::shmem_write(handle, &value, sizeof(value), 1020);
+    ASSERT_EQ(mshm::shmem_readv(handle, &entry, 1, generation).error_code, mshm::SHMEM_OK);
+    EXPECT_EQ(generation, 3u);
+    EXPECT_EQ(mshm::shmem_wait_changed(handle, last_seen, 0).error_code, mshm::SHMEM_OK);
+    EXPECT_EQ(last_seen, 3u);
+
+    // a waiter is woken by a write on any stripe
+    std::thread writer([&]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        mshm::shmem_write(handle, &value, sizeof(value), 2048);
+    });
+
+    EXPECT_EQ(mshm::shmem_wait_changed(handle, last_seen, 5000).error_code, mshm::SHMEM_OK);
+    EXPECT_EQ(last_seen, 4u);
+    writer.join();
+
+    mshm::shmem_close(handle);
+    mshm::shmem_delete("mshm_test_stripes_generation");
+}
+
+TEST(ShmLockStripes, DisjointWritersDoNotBlockEachOther)
+{
+    mshm::OpenOptions options;
+    options.lock_stripes = 2;
+    options.lock_timeout_ms = 50;
+
+    mshm::mshm_handle handle = nullptr;
+    ASSERT_EQ(mshm::shmem_open(handle, "mshm_test_stripes_disjoint", 4096, options).error_code, mshm::SHMEM_OK);
+
+    // hold the first half open for writing, the second half must still be writable
+    mshm::View view;
+    ASSERT_EQ(mshm::shmem_acquire_view(handle, view, mshm::SHMEM_VIEW_WRITE, 2048, 0).error_code, mshm::SHMEM_OK);
+
+    std::thread other([&]() {
+        uint64_t value = 7;
+        EXPECT_EQ(mshm::shmem_write(handle, &value, sizeof(value), 3000).error_code, mshm::SHMEM_OK);
+        EXPECT_EQ(mshm::shmem_write(handle, &value, sizeof(value), 100).error_code, mshm::SHMEM_ERR_TIMEOUT);
+        mshm::WriteEntry spanning[] = { { &value, sizeof(value), 3000 }, { &value, sizeof(value), 100 } };
+        EXPECT_EQ(mshm::shmem_writev(handle, spanning, 2).error_code, mshm::SHMEM_ERR_TIMEOUT);
+    });
+    other.join();
+
+    ASSERT_EQ(mshm::shmem_release_view(view).error_code, mshm::SHMEM_OK);
+
+    uint64_t value = 0;
+    mshm::shmem_read(handle, &value, sizeof(value), 3000);
+    EXPECT_EQ(value, 7u);
+
+    mshm::shmem_close(handle);
+    mshm::shmem_delete("mshm_test_stripes_disjoint");
+}
+#endif
+
+// ============================================================
+// Reader / writer lock mode
+// ============================================================
+
+#ifndef _WIN32
+TEST(ShmRwLock, ReadersShareWritersExclude)
+{
+    mshm::OpenOptions options;
+    options.sync_mode = mshm::SHMEM_SYNC_RWLOCK;
+    options.lock_timeout_ms = 50;
+
+    mshm::mshm_handle handle = nullptr;
+    ASSERT_EQ(mshm::shmem_open(handle, "mshm_test_rwlock", sizeof(SeqStruct), options).error_code, mshm::SHMEM_OK);
+
+    SeqStruct src{1, 2, 3};
+    ASSERT_EQ(mshm::shmem_write(handle, &src, sizeof(SeqStruct)).error_code, mshm::SHMEM_OK);
+
+    mshm::View view;
+    ASSERT_EQ(mshm::shmem_acquire_view(handle, view, mshm::SHMEM_VIEW_READ, sizeof(SeqStruct)).error_code, mshm::SHMEM_OK);
+
+    std::thread other([&]() {
+        SeqStruct dst{};
+        EXPECT_EQ(mshm::shmem_read(handle, &dst, sizeof(SeqStruct)).error_code, mshm::SHMEM_OK);
+        EXPECT_EQ(dst.c, 3u);
+        EXPECT_EQ(mshm::shmem_write(handle, &src, sizeof(SeqStruct)).error_code, mshm::SHMEM_ERR_TIMEOUT);
+    });
+    other.join();
+
+    ASSERT_EQ(mshm::shmem_release_view(view).error_code, mshm::SHMEM_OK);
+    EXPECT_EQ(mshm::shmem_write(handle, &src, sizeof(SeqStruct)).error_code, mshm::SHMEM_OK);
+
+    // the lock kind is part of the segment
+    mshm::mshm_handle other_handle = nullptr;
+    EXPECT_EQ(mshm::shmem_open(other_handle, "mshm_test_rwlock", sizeof(SeqStruct)).error_code, mshm::SHMEM_ERR_PARAM);
+
+    mshm::shmem_close(handle);
+    mshm::shmem_delete("mshm_test_rwlock");
+}
+
+TEST(ShmRwLock, WaitingWriterBlocksNewReaders)
+{
+    mshm::OpenOptions options;
+    options.sync_mode = mshm::SHMEM_SYNC_RWLOCK;
+
+    mshm::mshm_handle handle = nullptr;
+    ASSERT_EQ(mshm::shmem_open(handle, "mshm_test_rwlock_pref", sizeof(SeqStruct), options).error_code, mshm::SHMEM_OK);
+
+    mshm::View view;
+    ASSERT_EQ(mshm::shmem_acquire_view(handle, view, mshm::SHMEM_VIEW_READ, sizeof(SeqStruct)).error_code, mshm::SHMEM_OK);
+
+    std::atomic<bool> written{false};
+    std::thread writer([&]() {
+        SeqStruct src{4, 5, 6};
+        EXPECT_EQ(mshm::shmem_write(handle, &src, sizeof(SeqStruct)).error_code, mshm::SHMEM_OK);
+        written = true;
+    });
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    EXPECT_FALSE(written);
+
+    // a new reader queues behind the waiting writer instead of overtaking it
+    std::atomic<bool> read_done{false};
+    std::thread reader([&]() {
+        SeqStruct dst{};
+        EXPECT_EQ(mshm::shmem_read(handle, &dst, sizeof(SeqStruct)).error_code, mshm::SHMEM_OK);
+        EXPECT_EQ(dst.a, 4u);
+        read_done = true;
+    });
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    EXPECT_FALSE(read_done);
+
+    ASSERT_EQ(mshm::shmem_release_view(view).error_code, mshm::SHMEM_OK);
+    writer.join();
+    reader.join();
+    EXPECT_TRUE(written);
+    EXPECT_TRUE(read_done);
+
+    mshm::shmem_close(handle);
+    mshm::shmem_delete("mshm_test_rwlock_pref");
+}
+
+TEST(ShmRwLock, RejectsRobustPolicy)
+{
+    mshm::OpenOptions options;
+    options.sync_mode = mshm::SHMEM_SYNC_RWLOCK;
+    options.lock_policy = mshm::SHMEM_LOCK_ROBUST;
+
+    mshm::mshm_handle handle = nullptr;
+    EXPECT_EQ(mshm::shmem_open(handle, "mshm_test_rwlock_robust", 64, options).error_code, mshm::SHMEM_ERR_PARAM);
+}
+#endif
+
+// ============================================================
+// Typed SharedMemory<T>
+// ============================================================
+
+TEST(SharedMemoryClass, WholeObjectAndFields)
+{
+    mshm::SharedMemory<TestStruct> data_shm{"mshm_test_class"};
+    ASSERT_EQ(data_shm.open().error_code, mshm::SHMEM_OK);
+
+    TestStruct src{5, 1.25};
+    EXPECT_EQ(data_shm.write(src).error_code, mshm::SHMEM_OK);
+
+    EXPECT_EQ(data_shm.read_field<&TestStruct::foo>(), 5);
+    EXPECT_EQ(data_shm.status().error_code, mshm::SHMEM_OK);
+
+    EXPECT_EQ(data_shm.write_field<&TestStruct::bar>(7.5), mshm::SHMEM_OK);
+
+    TestStruct dst{};
+    EXPECT_EQ(data_shm.read(dst).error_code, mshm::SHMEM_OK);
+    EXPECT_EQ(dst.foo, 5);
+    EXPECT_DOUBLE_EQ(dst.bar, 7.5);
+
+    static_assert(std::is_same<mshm::SharedMemory<TestStruct>::field_type<&TestStruct::bar>, double>::value, "field type");
+}
+
+struct PaddedStruct
+{
+    char     tag;
+    uint16_t port;
+    char     name[5000];
+    uint64_t stamp = 1;
+};
+
+TEST(SharedMemoryClass, FieldOffsetsAreConstants)
+{
+    static_assert(mshm::member_offset<&TestStruct::foo>::value == offsetof(TestStruct, foo), "offset");
+    static_assert(mshm::member_offset<&TestStruct::bar>::value == offsetof(TestStruct, bar), "offset");
+    static_assert(mshm::member_offset<&PaddedStruct::port>::value == offsetof(PaddedStruct, port), "offset");
+    static_assert(mshm::member_offset<&PaddedStruct::stamp>::value == offsetof(PaddedStruct, stamp), "offset");
+
+    // no segment yet: the accessors must not touch the handle
+    mshm::SharedMemory<PaddedStruct> data_shm{"mshm_test_class_padded"};
+    EXPECT_EQ(data_shm.write_field<&PaddedStruct::stamp>(3), mshm::SHMEM_ERR_NOT_OPEN);
+    data_shm.read_field<&PaddedStruct::port>();
+    EXPECT_EQ(data_shm.status().error_code, mshm::SHMEM_ERR_NOT_OPEN);
+
+    ASSERT_EQ(data_shm.open().error_code, mshm::SHMEM_OK);
+    EXPECT_EQ(data_shm.write_field<&PaddedStruct::stamp>(3), mshm::SHMEM_OK);
+    EXPECT_EQ(data_shm.read_field<&PaddedStruct::stamp>(), 3u);
+}
+
+#ifndef _WIN32
+TEST(SharedMemoryClass, UsesSegmentSyncMode)
+{
+    mshm::OpenOptions options;
+    options.sync_mode = mshm::SHMEM_SYNC_SEQLOCK;
+
+    mshm::SharedMemory<SeqStruct> data_shm{"mshm_test_class_seqlock", options};
+    ASSERT_EQ(data_shm.open().error_code, mshm::SHMEM_OK);
+
+    data_shm.write_field<&SeqStruct::c>(9);
+    EXPECT_EQ(data_shm.read_field<&SeqStruct::c>(), 9u);
+
+    // a plain opener is refused: the wrapper really created a seqlock segment
+    mshm::mshm_handle other = nullptr;
+    EXPECT_EQ(mshm::shmem_open(other, "mshm_test_class_seqlock", sizeof(SeqStruct)).error_code, mshm::SHMEM_ERR_PARAM);
+}
+#endif
+
+// ============================================================
+// ErrorCode API
+// ============================================================
+
+TEST_F(ShmWriteRead, ErrorCodeApiRoundtrip)
+{
+    static_assert(noexcept(mshm::shmem_write_ec(nullptr, nullptr, 0)), "hot path must be noexcept");
+    static_assert(noexcept(mshm::shmem_read_ec(nullptr, nullptr, 0)), "hot path must be noexcept");
+
+    TestStruct src{3, 6.5};
+    EXPECT_EQ(mshm::shmem_write_ec(handle, &src, sizeof(TestStruct)), mshm::SHMEM_OK);
+
+    TestStruct dst{};
+    EXPECT_EQ(mshm::shmem_read_ec(handle, &dst, sizeof(TestStruct)), mshm::SHMEM_OK);
+    EXPECT_EQ(dst.foo, 3);
+
+    EXPECT_EQ(mshm::shmem_read_ec(handle, &dst, sizeof(TestStruct), 1), mshm::SHMEM_ERR_PARAM);
+
+    // offset + size wraps around: still out of bounds
+    EXPECT_EQ(mshm::shmem_read_ec(handle, &dst, 8, UINT64_MAX - 3), mshm::SHMEM_ERR_PARAM);
+    EXPECT_EQ(mshm::shmem_write_ec(handle, &src, 8, UINT64_MAX - 3), mshm::SHMEM_ERR_PARAM);
+    EXPECT_EQ(mshm::shmem_read_ec(handle, &dst, SIZE_MAX, 4), mshm::SHMEM_ERR_PARAM);
+
+    mshm::View view;
+    EXPECT_EQ(mshm::shmem_acquire_view_ec(handle, view, mshm::SHMEM_VIEW_READ, 8, UINT64_MAX - 3), mshm::SHMEM_ERR_PARAM);
+    EXPECT_EQ(mshm::shmem_read_ec(nullptr, &dst, sizeof(TestStruct)), mshm::SHMEM_ERR_NOT_OPEN);
+}
+
+TEST(ShmErrorString, EveryCodeHasAMessage)
+{
+    EXPECT_STREQ(mshm::shmem_error_string(mshm::SHMEM_OK), "No Error");
+
+    for (int code = mshm::SHMEM_OK; code <= mshm::SHMEM_ERR_OWNER_DEAD; ++code)
+    {
+        EXPECT_GT(strlen(mshm::shmem_error_string((mshm::ErrorCode)code)), 0u);
+    }
+
+    EXPECT_STREQ(mshm::shmem_error_string((mshm::ErrorCode)1000), "Unknown error");
+
+    // the Return API carries the same message
+    auto ret = mshm::shmem_write(nullptr, "x", 1);
+    EXPECT_EQ(ret.error_code, mshm::SHMEM_ERR_NOT_OPEN);
+    EXPECT_EQ(ret.error_string, mshm::shmem_error_string(mshm::SHMEM_ERR_NOT_OPEN));
+}
+
+// ============================================================
+// Arena allocator
+// ============================================================
+
+TEST(ShmArena, AllocFreeReuse)
+{
+    mshm::mshm_arena arena = nullptr;
+    ASSERT_EQ(mshm::shmem_arena_open(arena, "mshm_test_arena", 1 << 16).error_code, mshm::SHMEM_OK);
+
+    uint64_t a = mshm::shmem_arena_alloc(arena, 24);
+    uint64_t b = mshm::shmem_arena_alloc(arena, 24);
+    ASSERT_NE(a, 0u);
+    ASSERT_NE(b, 0u);
+    EXPECT_NE(a, b);
+    EXPECT_EQ(a % 16, 0u);
+
+    mshm::shmem_arena_free(arena, a);
+    EXPECT_EQ(mshm::shmem_arena_alloc(arena, 20), a); // same size class comes back from the free list
+
+    // exhaustion is reported, not thrown
+    EXPECT_EQ(mshm::shmem_arena_alloc(arena, 1 << 17), 0u);
+
+    // sizes where size + block header wraps around: no size class, not a tiny block
+    EXPECT_EQ(mshm::shmem_arena_alloc(arena, SIZE_MAX), 0u);
+    EXPECT_EQ(mshm::shmem_arena_alloc(arena, SIZE_MAX - 8), 0u);
+
+    mshm::shmem_arena_close(arena);
+    mshm::shmem_delete("mshm_test_arena");
+}
+
+TEST(ShmArena, OffsetsAreValidInEveryMapping)
+{
+    mshm::mshm_arena writer = nullptr;
+    mshm::mshm_arena reader = nullptr;
+    ASSERT_EQ(mshm::shmem_arena_open(writer, "mshm_test_arena_map", 1 << 16).error_code, mshm::SHMEM_OK);
+    ASSERT_EQ(mshm::shmem_arena_open(reader, "mshm_test_arena_map", 1 << 16).error_code, mshm::SHMEM_OK);
+
+    uint64_t text = mshm::shmem_arena_alloc(writer, 32);
+    strcpy((char*)mshm::shmem_arena_ptr(writer, text), "shared string");
+    mshm::shmem_arena_set_root(writer, text);
+
+    // two mappings, two addresses, one offset
+    EXPECT_NE(mshm::shmem_arena_ptr(writer, text), mshm::shmem_arena_ptr(reader, text));
+    EXPECT_STREQ((const char*)mshm::shmem_arena_ptr(reader, mshm::shmem_arena_root(reader)), "shared string");
+    EXPECT_EQ(mshm::shmem_arena_offset(reader, mshm::shmem_arena_ptr(reader, text)), text);
+
+    mshm::mshm_arena other = nullptr;
+    EXPECT_EQ(mshm::shmem_arena_open(other, "mshm_test_arena_map", 1 << 15).error_code, mshm::SHMEM_ERR_PARAM);
+
+    mshm::shmem_arena_close(reader);
+    mshm::shmem_arena_close(writer);
+    mshm::shmem_delete("mshm_test_arena_map");
+}
+
+TEST(ShmArena, ConcurrentAllocFree)
+{
+    mshm::mshm_arena arena = nullptr;
+    ASSERT_EQ(mshm::shmem_arena_open(arena, "mshm_test_arena_mt", 1 << 20).error_code, mshm::SHMEM_OK);
+
+    std::vector<std::thread> threads;
+    std::atomic<int> errors{0};
+
+    for (int t = 0; t < 4; ++t)
+    {
+        threads.emplace_back([&, t]() {
+            std::vector<uint64_t> mine;
+            for (int i = 0; i < 20000; ++i)
+            {
+                uint64_t offset = mshm::shmem_arena_alloc(arena, 8 + (i % 3) * 40);
+                if (offset == 0) { errors++; continue; }
+                *(int*)mshm::shmem_arena_ptr(arena, offset) = t;
+                mine.push_back(offset);
+
+                if (mine.size() > 16)
+                {
+                    uint64_t old = mine.front();
+                    if (*(int*)mshm::shmem_arena_ptr(arena, old) != t) errors++; // someone else got our block
+                    mshm::shmem_arena_free(arena, old);
+                    mine.erase(mine.begin());
+                }
+            }
+        });
+    }
+
+    for (auto& t : threads) t.join();
+    EXPECT_EQ(errors, 0);
+
+    mshm::shmem_arena_close(arena);
+    mshm::shmem_delete("mshm_test_arena_mt");
+}
+
+TEST(ShmArena, StdAllocator)
+{
+    mshm::mshm_arena arena = nullptr;
+    ASSERT_EQ(mshm::shmem_arena_open(arena, "mshm_test_arena_std", 1 << 16).error_code, mshm::SHMEM_OK);
+
+    std::vector<int, mshm::ArenaAllocator<int>> values{ mshm::ArenaAllocator<int>(arena) };
+    for (int i = 0; i < 100; ++i) values.push_back(i);
+
+    EXPECT_EQ(values[99], 99);
+    uint64_t offset = mshm::shmem_arena_offset(arena, values.data());
+    EXPECT_GT(offset, 0u);
+    EXPECT_LT(offset, (uint64_t)1 << 17);
+
+    EXPECT_THROW(values.reserve(1 << 20), std::bad_alloc);
+
+    values.clear();
+    values.shrink_to_fit();
+
+    mshm::shmem_arena_close(arena);
+    mshm::shmem_delete("mshm_test_arena_std");
+}
+
+// ============================================================
+// Hash map
+// ============================================================
+
+struct MapKey
+{
+    char symbol[16];
+};
+
+static MapKey map_key(const char* symbol)
+{
+    MapKey key{};
+    strncpy(key.symbol, symbol, sizeof(key.symbol) - 1);
+    return key;
+}
+
+TEST(ShmMap, PutGetUpdateErase)
+{
+    mshm::mshm_map map = nullptr;
+    ASSERT_EQ(mshm::shmem_map_open(map, "mshm_test_map", sizeof(MapKey), sizeof(double), 64).error_code, mshm::SHMEM_OK);
+
+    MapKey eur = map_key("EURUSD");
+    MapKey gbp = map_key("GBPUSD");
+    double value = 1.08;
+
+    EXPECT_TRUE(mshm::shmem_map_put(map, &eur, &value));
+    value = 1.27;
+    EXPECT_TRUE(mshm::shmem_map_put(map, &gbp, &value));
+    value = 1.09;
+    EXPECT_TRUE(mshm::shmem_map_put(map, &eur, &value)); // update
+    EXPECT_EQ(mshm::shmem_map_size(map), 2u);
+
+    double out = 0;
+    EXPECT_TRUE(mshm::shmem_map_get(map, &eur, &out));
+    EXPECT_DOUBLE_EQ(out, 1.09);
+
+    MapKey jpy = map_key("USDJPY");
+    EXPECT_FALSE(mshm::shmem_map_get(map, &jpy, &out));
+
+    EXPECT_TRUE(mshm::shmem_map_erase(map, &eur));
+    EXPECT_FALSE(mshm::shmem_map_erase(map, &eur));
+    EXPECT_FALSE(mshm::shmem_map_get(map, &eur, &out));
+    EXPECT_TRUE(mshm::shmem_map_get(map, &gbp, &out));
+    EXPECT_DOUBLE_EQ(out, 1.27);
+    EXPECT_EQ(mshm::shmem_map_size(map), 1u);
+
+    // another handle sees the same table
+    mshm::mshm_map other = nullptr;
+    ASSERT_EQ(mshm::shmem_map_open(other, "mshm_test_map", sizeof(MapKey), sizeof(double), 64).error_code, mshm::SHMEM_OK);
+    EXPECT_TRUE(mshm::shmem_map_get(other, &gbp, &out));
+    mshm::shmem_map_close(other);
+
+    EXPECT_EQ(mshm::shmem_map_open(other, "mshm_test_map", sizeof(MapKey), sizeof(float), 64).error_code, mshm::SHMEM_ERR_PARAM);
+
+    mshm::shmem_map_close(map);
+    mshm::shmem_delete("mshm_test_map");
+}
+
+TEST(ShmMap, FullTable)
+{
+    mshm::mshm_map map = nullptr;
+    ASSERT_EQ(mshm::shmem_map_open(map, "mshm_test_map_full", sizeof(uint64_t), sizeof(uint64_t), 8).error_code, mshm::SHMEM_OK);
+
+    for (uint64_t i = 0; i < 8; ++i)
+    {
+        EXPECT_TRUE(mshm::shmem_map_put(map, &i, &i));
+    }
+
+    uint64_t extra = 100;
+    EXPECT_FALSE(mshm::shmem_map_put(map, &extra, &extra));
+
+    // a tombstone is reused
+    uint64_t three = 3;
+    EXPECT_TRUE(mshm::shmem_map_erase(map, &three));
+    EXPECT_TRUE(mshm::shmem_map_put(map, &extra, &extra));
+
+    for (uint64_t i = 0; i < 8; ++i)
+    {
+        uint64_t out = 0;
+        EXPECT_EQ(mshm::shmem_map_get(map, &i, &out), i != 3);
+    }
+
+    mshm::shmem_map_close(map);
+    mshm::shmem_delete("mshm_test_map_full");
+}
+
+TEST(ShmMap, ConcurrentWritersAndReaders)
+{
+    struct Pair { uint64_t a, b; };
+
+    mshm::mshm_map map = nullptr;
+    ASSERT_EQ(mshm::shmem_map_open(map, "mshm_test_map_mt", sizeof(uint64_t), sizeof(Pair), 1024).error_code, mshm::SHMEM_OK);
+
+    std::atomic<bool> stop{false};
+    std::vector<std::thread> writers;
+
+    for (uint64_t w = 0; w < 2; ++w)
+    {
+        writers.emplace_back([&, w]() {
+            for (uint64_t i = 0; i < 20000; ++i)
+            {
+                uint64_t key = (i % 64) * 2 + w; // the two writers own disjoint keys
+                Pair value{i, i};
+                mshm::shmem_map_put(map, &key, &value);
+                if (i % 7 == 0) mshm::shmem_map_erase(map, &key);
+            }
+        });
+    }
+
+    std::thread reader([&]() {
+        while (!stop)
+        {
+            for (uint64_t key = 0; key < 128; ++key)
+            {
+                Pair value{};
+                if (mshm::shmem_map_get(map, &key, &value))
+                {
+                    ASSERT_EQ(value.a, value.b);
+                }
+            }
+        }
+    });
+
+    for (auto& t : writers) t.join();
+    stop = true;
+    reader.join();
+
+    EXPECT_LE(mshm::shmem_map_size(map), 128u);
+
+    mshm::shmem_map_close(map);
+    mshm::shmem_delete("mshm_test_map_mt");
+}
+
+// ============================================================
+// Dirty-block tracking
+// ============================================================
+
+#ifndef _WIN32
+static void check_read_changed(mshm::SyncMode mode, const char* name)
+{
+    mshm::OpenOptions options;
+    options.sync_mode = mode;
+    options.dirty_block_size = 256;
+
+    mshm::mshm_handle handle = nullptr;
+    ASSERT_EQ(mshm::shmem_open(handle, name, 1000, options).error_code, mshm::SHMEM_OK);
+
+    std::vector<unsigned char> src(1000, 1), image(1000, 0);
+    ASSERT_EQ(mshm::shmem_write(handle, src.data(), src.size()).error_code, mshm::SHMEM_OK);
+
+    uint64_t version = 0;
+    ASSERT_EQ(mshm::shmem_read_changed(handle, image.data(), version).error_code, mshm::SHMEM_OK);
+    EXPECT_EQ(image, src);
+    EXPECT_EQ(version, 1u);
+
+    // nothing changed: the image is left alone
+    image[0] = 0xEE;
+    ASSERT_EQ(mshm::shmem_read_changed(handle, image.data(), version).error_code, mshm::SHMEM_OK);
+    EXPECT_EQ(image[0], 0xEE);
+    EXPECT_EQ(version, 1u);
+
+    // only the last (partial) block is copied again
+    unsigned char value = 9;
+    ASSERT_EQ(mshm::shmem_write(handle, &value, 1, 999).error_code, mshm::SHMEM_OK);
+    ASSERT_EQ(mshm::shmem_read_changed(handle, image.data(), version).error_code, mshm::SHMEM_OK);
+    EXPECT_EQ(image[0], 0xEE);
+    EXPECT_EQ(image[768], 1);
+    EXPECT_EQ(image[999], 9);
+    EXPECT_EQ(version, 2u);
+
+    // a view spanning two blocks stamps both
+    mshm::View view;
+    ASSERT_EQ(mshm::shmem_acquire_view(handle, view, mshm::SHMEM_VIEW_WRITE, 2, 255).error_code, mshm::SHMEM_OK);
+    memset(view.data, 5, view.size);
+    ASSERT_EQ(mshm::shmem_release_view(view).error_code, mshm::SHMEM_OK);
+
+    image[0] = 0xEE;
+    ASSERT_EQ(mshm::shmem_read_changed(handle, image.data(), version).error_code, mshm::SHMEM_OK);
+    EXPECT_EQ(image[0], 1);
+    EXPECT_EQ(image[255], 5);
+    EXPECT_EQ(image[256], 5);
+    EXPECT_EQ(version, 3u);
+
+    mshm::shmem_close(handle);
+    mshm::shmem_delete(name);
+}
+
+TEST(ShmDirtyBlocks, MutexCopiesOnlyChangedBlocks)
+{
+    check_read_changed(mshm::SHMEM_SYNC_MUTEX, "mshm_test_dirty_mutex");
+}
+
+TEST(ShmDirtyBlocks, SeqlockCopiesOnlyChangedBlocks)
+{
+    check_read_changed(mshm::SHMEM_SYNC_SEQLOCK, "mshm_test_dirty_seqlock");
+}
+
+TEST(ShmDirtyBlocks, OptionIsPartOfTheLayout)
+{
+    mshm::OpenOptions options;
+    options.dirty_block_size = 100; // not a power of two
+
+    mshm::mshm_handle handle = nullptr;
+    EXPECT_EQ(mshm::shmem_open(handle, "mshm_test_dirty_layout", 4096, options).error_code, mshm::SHMEM_ERR_PARAM);
+
+    options.dirty_block_size = 128;
+    options.sync_mode = mshm::SHMEM_SYNC_TRIPLE_BUFFER;
+    EXPECT_EQ(mshm::shmem_open(handle, "mshm_test_dirty_layout", 4096, options).error_code, mshm::SHMEM_ERR_PARAM);
+
+    options.sync_mode = mshm::SHMEM_SYNC_MUTEX;
+    ASSERT_EQ(mshm::shmem_open(handle, "mshm_test_dirty_layout", 4096, options).error_code, mshm::SHMEM_OK);
+
+    mshm::mshm_handle other = nullptr;
+    EXPECT_EQ(mshm::shmem_open(other, "mshm_test_dirty_layout", 4096).error_code, mshm::SHMEM_ERR_PARAM);
+
+    // no tracking, no incremental read
+    mshm::mshm_handle plain = nullptr;
+    ASSERT_EQ(mshm::shmem_open(plain, "mshm_test_dirty_plain", 4096).error_code, mshm::SHMEM_OK);
+    unsigned char image[4096];
+    uint64_t version = 0;
+    EXPECT_EQ(mshm::shmem_read_changed(plain, image, version).error_code, mshm::SHMEM_ERR_NOT_SUPPORTED);
+
+    mshm::shmem_close(plain);
+    mshm::shmem_delete("mshm_test_dirty_plain");
+    mshm::shmem_close(handle);
+    mshm::shmem_delete("mshm_test_dirty_layout");
+}
+#endif
+
+// ============================================================
+// Broadcast ring
+// ============================================================
+
+TEST(ShmBroadcast, ReadersFollowAtTheirOwnPace)
+{
+    mshm::mshm_broadcast writer = nullptr, fast = nullptr, slow = nullptr;
+    ASSERT_EQ(mshm::shmem_broadcast_open(writer, "mshm_test_broadcast", 1024).error_code, mshm::SHMEM_OK);
+    ASSERT_EQ(mshm::shmem_broadcast_open(fast, "mshm_test_broadcast", 1024).error_code, mshm::SHMEM_OK);
+    ASSERT_EQ(mshm::shmem_broadcast_open(slow, "mshm_test_broadcast", 1024).error_code, mshm::SHMEM_OK);
+
+    mshm::mshm_broadcast other = nullptr;
+    EXPECT_EQ(mshm::shmem_broadcast_open(other, "mshm_test_broadcast", 2048).error_code, mshm::SHMEM_ERR_PARAM);
+
+    // underneath, attaching with a bigger size is refused by shmem_open, which never grows a segment
+    mshm::mshm_handle segment = nullptr;
+    EXPECT_EQ(mshm::shmem_open(segment, "mshm_test_broadcast", 1 << 20).error_code, mshm::SHMEM_ERR_SIZE);
+
+    char buffer[512];
+    size_t size = 0;
+    uint64_t sequence = 0;
+    EXPECT_EQ(mshm::shmem_broadcast_receive(fast, buffer, sizeof(buffer), size, sequence), mshm::SHMEM_BROADCAST_EMPTY);
+    EXPECT_EQ(mshm::shmem_broadcast_publish(writer, buffer, mshm::shmem_broadcast_max_size(writer) + 1), 0u);
+
+    // variable sizes, wrapping around the ring many times
+    for (uint64_t i = 1; i <= 200; ++i)
+    {
+        std::string msg(i % 50, (char)('a' + i % 26));
+        ASSERT_EQ(mshm::shmem_broadcast_publish(writer, msg.data(), msg.size()), i);
+
+        ASSERT_EQ(mshm::shmem_broadcast_receive(fast, buffer, sizeof(buffer), size, sequence), mshm::SHMEM_BROADCAST_RECORD);
+        EXPECT_EQ(sequence, i);
+        EXPECT_EQ(std::string(buffer, size), msg);
+    }
+
+    // the slow reader was lapped, then picks up again from the newest record
+    EXPECT_EQ(mshm::shmem_broadcast_receive(slow, buffer, sizeof(buffer), size, sequence), mshm::SHMEM_BROADCAST_LAPPED);
+    EXPECT_EQ(mshm::shmem_broadcast_receive(slow, buffer, sizeof(buffer), size, sequence), mshm::SHMEM_BROADCAST_EMPTY);
+
+    mshm::shmem_broadcast_publish(writer, "xyz", 3);
+    ASSERT_EQ(mshm::shmem_broadcast_receive(slow, buffer, 2, size, sequence), mshm::SHMEM_BROADCAST_RECORD);
+    EXPECT_EQ(sequence, 201u);
+    EXPECT_EQ(size, 3u);
+    EXPECT_EQ(mshm::shmem_broadcast_pending(slow), 0u);
+
+    mshm::shmem_broadcast_close(slow);
+    mshm::shmem_broadcast_close(fast);
+    mshm::shmem_broadcast_close(writer);
+    mshm::shmem_delete("mshm_test_broadcast");
+}
+
+TEST(ShmBroadcast, ConcurrentReaderSeesWholeRecordsInOrder)
+{
+    mshm::mshm_broadcast writer = nullptr, reader = nullptr;
+    ASSERT_EQ(mshm::shmem_broadcast_open(writer, "mshm_test_broadcast_mt", 4096).error_code, mshm::SHMEM_OK);
+    ASSERT_EQ(mshm::shmem_broadcast_open(reader, "mshm_test_broadcast_mt", 4096).error_code, mshm::SHMEM_OK);
+
+    const uint64_t count = 50000;
+    std::atomic<bool> done{false};
+
+    std::thread producer([&]() {
+        uint64_t msg[16];
+        for (uint64_t i = 1; i <= count; ++i)
+        {
+            size_t words = 1 + i % 16;
+            for (size_t w = 0; w < words; ++w) msg[w] = i;
+            mshm::shmem_broadcast_publish(writer, msg, words * sizeof(uint64_t));
+        }
+        done = true;
+    });
+
+    uint64_t msg[16], last = 0;
+    size_t size = 0;
+    uint64_t sequence = 0;
+
+    for (;;)
+    {
+        bool finished = done;
+        mshm::BroadcastResult result = mshm::shmem_broadcast_receive(reader, msg, sizeof(msg), size, sequence);
+
+        if (result == mshm::SHMEM_BROADCAST_RECORD)
+        {
+            ASSERT_GT(sequence, last);
+            ASSERT_EQ(size, (1 + sequence % 16) * sizeof(uint64_t));
+            for (size_t w = 0; w < size / sizeof(uint64_t); ++w) ASSERT_EQ(msg[w], sequence);
+            last = sequence;
+        }
+        else if (result == mshm::SHMEM_BROADCAST_EMPTY)
+        {
+            if (finished) break;
+            std::this_thread::yield();
+        }
+    }
+
+    producer.join();
+
+    // lapped or not, the reader is back in step with the writer
+    ASSERT_EQ(mshm::shmem_broadcast_publish(writer, msg, sizeof(uint64_t)), count + 1);
+    EXPECT_EQ(mshm::shmem_broadcast_receive(reader, msg, sizeof(msg), size, sequence), mshm::SHMEM_BROADCAST_RECORD);
+    EXPECT_EQ(sequence, count + 1);
+
+    mshm::shmem_broadcast_close(reader);
+    mshm::shmem_broadcast_close(writer);
+    mshm::shmem_delete("mshm_test_broadcast_mt");
+}
+
+// ============================================================
+// Segment stats
+// ============================================================
+
+#ifndef _WIN32
+TEST(ShmStats, CountsCopiesAndLockWaits)
+{
+    mshm::OpenOptions options;
+    options.stats = true;
+
+    mshm::mshm_handle handle = nullptr, monitor = nullptr;
+    ASSERT_EQ(mshm::shmem_open(handle, "mshm_test_stats", sizeof(SeqStruct), options).error_code, mshm::SHMEM_OK);
+    ASSERT_EQ(mshm::shmem_open(monitor, "mshm_test_stats", sizeof(SeqStruct)).error_code, mshm::SHMEM_OK);
+
+    SeqStruct value{1, 2, 3};
+    ASSERT_EQ(mshm::shmem_write(handle, &value, sizeof(value)).error_code, mshm::SHMEM_OK);
+    ASSERT_EQ(mshm::shmem_read(handle, &value, sizeof(value)).error_code, mshm::SHMEM_OK);
+    ASSERT_EQ(mshm::shmem_read(handle, &value.a, sizeof(value.a)).error_code, mshm::SHMEM_OK);
+
+    // a writer waiting on a held view is a contended acquisition
+    mshm::View view;
+    ASSERT_EQ(mshm::shmem_acquire_view(handle, view, mshm::SHMEM_VIEW_WRITE, sizeof(value)).error_code, mshm::SHMEM_OK);
+    std::thread writer([&]() {
+        EXPECT_EQ(mshm::shmem_write(handle, &value, sizeof(value)).error_code, mshm::SHMEM_OK);
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    ASSERT_EQ(mshm::shmem_release_view(view).error_code, mshm::SHMEM_OK);
+    writer.join();
+
+    // the monitor sees the counters of the segment, not of its handle
+    mshm::Stats stats;
+    ASSERT_EQ(mshm::shmem_stats(monitor, stats).error_code, mshm::SHMEM_OK);
+    EXPECT_EQ(stats.writes, 2u);
+    EXPECT_EQ(stats.reads, 2u);
+    EXPECT_EQ(stats.bytes_written, 2 * sizeof(SeqStruct));
+    EXPECT_EQ(stats.bytes_read, sizeof(SeqStruct) + sizeof(uint64_t));
+    EXPECT_EQ(stats.lock_acquisitions, 5u);
+    EXPECT_EQ(stats.contended_acquisitions, 1u);
+    EXPECT_GE(stats.lock_wait_ns, 10000000u);
+    EXPECT_GT(stats.max_lock_hold_ns, 0u);
+
+    mshm::shmem_close(monitor);
+    mshm::shmem_close(handle);
+    mshm::shmem_delete("mshm_test_stats");
+}
+
+TEST(ShmStats, DisabledByDefault)
+{
+    mshm::mshm_handle handle = nullptr;
+    ASSERT_EQ(mshm::shmem_open(handle, "mshm_test_stats_off", 64).error_code, mshm::SHMEM_OK);
+
+    mshm::Stats stats;
+    EXPECT_EQ(mshm::shmem_stats(handle, stats).error_code, mshm::SHMEM_ERR_NOT_SUPPORTED);
+    EXPECT_EQ(mshm::shmem_stats(nullptr, stats).error_code, mshm::SHMEM_ERR_NOT_OPEN);
+
+    mshm::shmem_close(handle);
+    mshm::shmem_delete("mshm_test_stats_off");
+}
+#endif
+
+// ============================================================
+// Online resize
+// ============================================================
+
+#ifndef _WIN32
+TEST(ShmResize, OtherHandlesFollowTheGrowth)
+{
+    mshm::OpenOptions options;
+    options.max_size = 1 << 20;
+
+    mshm::mshm_handle owner = nullptr, other = nullptr;
+    ASSERT_EQ(mshm::shmem_open(owner, "mshm_test_resize", 4096, options).error_code, mshm::SHMEM_OK);
+    ASSERT_EQ(mshm::shmem_open(other, "mshm_test_resize", 4096).error_code, mshm::SHMEM_OK);
+
+    uint64_t value = 42;
+    ASSERT_EQ(mshm::shmem_write(owner, &value, sizeof(value), 100).error_code, mshm::SHMEM_OK);
+    EXPECT_EQ(mshm::shmem_write(other, &value, sizeof(value), 60000).error_code, mshm::SHMEM_ERR_PARAM);
+
+    ASSERT_EQ(mshm::shmem_resize(owner, 65536).error_code, mshm::SHMEM_OK);
+    EXPECT_EQ(mshm::shmem_size(owner), 65536u);
+
+    // the other handle maps the new tail on its next operation, the old data is still there
+    value = 7;
+    ASSERT_EQ(mshm::shmem_write(other, &value, sizeof(value), 60000).error_code, mshm::SHMEM_OK);
+    EXPECT_EQ(mshm::shmem_size(other), 65536u);
+
+    uint64_t read = 0;
+    ASSERT_EQ(mshm::shmem_read(owner, &read, sizeof(read), 60000).error_code, mshm::SHMEM_OK);
+    EXPECT_EQ(read, 7u);
+    ASSERT_EQ(mshm::shmem_read(other, &read, sizeof(read), 100).error_code, mshm::SHMEM_OK);
+    EXPECT_EQ(read, 42u);
+
+    EXPECT_EQ(mshm::shmem_resize(owner, 4096).error_code, mshm::SHMEM_ERR_PARAM);       // only grows
+    EXPECT_EQ(mshm::shmem_resize(owner, 2 << 20).error_code, mshm::SHMEM_ERR_PARAM);    // beyond max_size
+
+    // a later attacher sees the current size
+    mshm::mshm_handle late = nullptr;
+    ASSERT_EQ(mshm::shmem_open(late, "mshm_test_resize", 65536).error_code, mshm::SHMEM_OK);
+    ASSERT_EQ(mshm::shmem_resize(late, 1 << 20).error_code, mshm::SHMEM_OK);
+    ASSERT_EQ(mshm::shmem_read(owner, &read, sizeof(read), (1 << 20) - sizeof(read)).error_code, mshm::SHMEM_OK);
+
+    mshm::shmem_close(late);
+    mshm::shmem_close(other);
+    mshm::shmem_close(owner);
+    mshm::shmem_delete("mshm_test_resize");
+}
+
+TEST(ShmResize, ViewsAndOtherProcessesSurviveTheGrowth)
+{
+    mshm::OpenOptions options;
+    options.sync_mode = mshm::SHMEM_SYNC_SEQLOCK;
+    options.max_size = 1 << 20;
+
+    mshm::mshm_handle handle = nullptr;
+    ASSERT_EQ(mshm::shmem_open(handle, "mshm_test_resize_fork", 4096, options).error_code, mshm::SHMEM_OK);
+
+    uint64_t value = 99;
+    ASSERT_EQ(mshm::shmem_write(handle, &value, sizeof(value)).error_code, mshm::SHMEM_OK);
+
+    // a lock-free read view held across the resize keeps pointing at the same data
+    mshm::View view;
+    ASSERT_EQ(mshm::shmem_acquire_view(handle, view, mshm::SHMEM_VIEW_READ, sizeof(value)).error_code, mshm::SHMEM_OK);
+    ASSERT_EQ(mshm::shmem_resize(handle, 8192).error_code, mshm::SHMEM_OK);
+    EXPECT_EQ(*(const uint64_t*)view.data, 99u);
+    EXPECT_EQ(mshm::shmem_release_view(view).error_code, mshm::SHMEM_OK);
+
+    pid_t child = fork();
+
+    if (child == 0)
+    {
+        // attached before the next resize, grows with it
+        mshm::mshm_handle attached = nullptr;
+        if (mshm::shmem_open(attached, "mshm_test_resize_fork", 8192, options).error_code != mshm::SHMEM_OK) _exit(1);
+
+        uint64_t offset = 500000;
+        while (mshm::shmem_write_ec(attached, &offset, sizeof(offset), offset) != mshm::SHMEM_OK)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+
+        mshm::shmem_close(attached);
+        _exit(0);
+    }
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    ASSERT_EQ(mshm::shmem_resize(handle, 1 << 20).error_code, mshm::SHMEM_OK);
+
+    int status = 0;
+    waitpid(child, &status, 0);
+    EXPECT_TRUE(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+    uint64_t read = 0;
+    ASSERT_EQ(mshm::shmem_read(handle, &read, sizeof(read), 500000).error_code, mshm::SHMEM_OK);
+    EXPECT_EQ(read, 500000u);
+
+    mshm::shmem_close(handle);
+    mshm::shmem_delete("mshm_test_resize_fork");
+}
+
+TEST(ShmResize, AttachingNeverResizes)
+{
+    mshm::mshm_handle handle = nullptr, other = nullptr;
+    ASSERT_EQ(mshm::shmem_open(handle, "mshm_test_resize_attach", 64).error_code, mshm::SHMEM_OK);
+
+    EXPECT_EQ(mshm::shmem_open(other, "mshm_test_resize_attach", 1 << 20).error_code, mshm::SHMEM_ERR_SIZE);
+    EXPECT_EQ(mshm::shmem_resize(handle, 128).error_code, mshm::SHMEM_ERR_NOT_SUPPORTED);
+
+    // a smaller request attaches to the whole segment
+    ASSERT_EQ(mshm::shmem_open(other, "mshm_test_resize_attach", 16).error_code, mshm::SHMEM_OK);
+    EXPECT_EQ(mshm::shmem_size(other), 64u);
+
+    mshm::OpenOptions options;
+    options.max_size = 1 << 20;
+    options.lock_stripes = 2;
+    mshm::mshm_handle striped = nullptr;
+    EXPECT_EQ(mshm::shmem_open(striped, "mshm_test_resize_striped", 4096, options).error_code, mshm::SHMEM_ERR_PARAM);
+
+    mshm::shmem_close(other);
+    mshm::shmem_close(handle);
+    mshm::shmem_delete("mshm_test_resize_attach");
+}
+#endif
+
+// ============================================================
+// Anonymous segments: descriptor passing and sealing
+// ============================================================
+
+#ifndef _WIN32
+TEST(ShmAnonymous, ReceiverSharesTheSegment)
+{
+    mshm::mshm_handle handle = nullptr;
+    ASSERT_EQ(mshm::shmem_create_anonymous(handle, 4096).error_code, mshm::SHMEM_OK);
+
+    uint64_t value = 1234;
+    ASSERT_EQ(mshm::shmem_write(handle, &value, sizeof(value)).error_code, mshm::SHMEM_OK);
+
+    int sockets[2];
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, sockets), 0);
+
+    pid_t child = fork();
+
+    if (child == 0)
+    {
+        mshm::mshm_handle received = nullptr;
+        if (mshm::shmem_receive_fd(received, sockets[1]).error_code != mshm::SHMEM_OK) _exit(1);
+
+        uint64_t read = 0;
+        if (mshm::shmem_read_ec(received, &read, sizeof(read)) != mshm::SHMEM_OK || read != 1234) _exit(2);
+
+        read = 5678;
+        if (mshm::shmem_write_ec(received, &read, sizeof(read), 8) != mshm::SHMEM_OK) _exit(3);
+
+        mshm::shmem_close(received);
+        _exit(0);
+    }
+
+    ASSERT_EQ(mshm::shmem_send_fd(handle, sockets[0]).error_code, mshm::SHMEM_OK);
+
+    int status = 0;
+    waitpid(child, &status, 0);
+    EXPECT_TRUE(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+    uint64_t read = 0;
+    ASSERT_EQ(mshm::shmem_read(handle, &read, sizeof(read), 8).error_code, mshm::SHMEM_OK);
+    EXPECT_EQ(read, 5678u);
+
+    close(sockets[0]);
+    close(sockets[1]);
+    mshm::shmem_close(handle);
+}
+
+TEST(ShmAnonymous, SealedSegmentIsReadOnly)
+{
+    mshm::OpenOptions options;
+    options.sync_mode = mshm::SHMEM_SYNC_SEQLOCK;
+
+    mshm::mshm_handle handle = nullptr;
+    ASSERT_EQ(mshm::shmem_create_anonymous(handle, 4096, options).error_code, mshm::SHMEM_OK);
+
+    uint64_t value = 77;
+    ASSERT_EQ(mshm::shmem_write(handle, &value, sizeof(value), 16).error_code, mshm::SHMEM_OK);
+    ASSERT_EQ(mshm::shmem_seal(handle).error_code, mshm::SHMEM_OK);
+
+    EXPECT_EQ(mshm::shmem_write(handle, &value, sizeof(value)).error_code, mshm::SHMEM_ERR_NOT_SUPPORTED);
+
+    int sockets[2];
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, sockets), 0);
+    ASSERT_EQ(mshm::shmem_send_fd(handle, sockets[0]).error_code, mshm::SHMEM_OK);
+
+    mshm::mshm_handle received = nullptr;
+    ASSERT_EQ(mshm::shmem_receive_fd(received, sockets[1]).error_code, mshm::SHMEM_OK);
+
+    uint64_t read = 0;
+    ASSERT_EQ(mshm::shmem_read(received, &read, sizeof(read), 16).error_code, mshm::SHMEM_OK);
+    EXPECT_EQ(read, 77u);
+    EXPECT_EQ(mshm::shmem_write(received, &value, sizeof(value)).error_code, mshm::SHMEM_ERR_NOT_SUPPORTED);
+
+    // views need neither a lock nor a validation
+    mshm::View view;
+    ASSERT_EQ(mshm::shmem_acquire_view(received, view, mshm::SHMEM_VIEW_READ, sizeof(value), 16).error_code, mshm::SHMEM_OK);
+    EXPECT_EQ(*(const uint64_t*)view.data, 77u);
+    EXPECT_EQ(mshm::shmem_release_view(view).error_code, mshm::SHMEM_OK);
+    EXPECT_EQ(mshm::shmem_acquire_view(received, view, mshm::SHMEM_VIEW_WRITE, sizeof(value)).error_code, mshm::SHMEM_ERR_NOT_SUPPORTED);
+
+    close(sockets[0]);
+    close(sockets[1]);
+    mshm::shmem_close(received);
+    mshm::shmem_close(handle);
+}
+
+TEST(ShmAnonymous, WaitChangedOnSealedSegmentReturnsAtOnce)
+{
+    mshm::mshm_handle handle = nullptr, received = nullptr;
+    ASSERT_EQ(mshm::shmem_create_anonymous(handle, 64).error_code, mshm::SHMEM_OK);
+
+    uint64_t value = 5;
+    ASSERT_EQ(mshm::shmem_write(handle, &value, sizeof(value)).error_code, mshm::SHMEM_OK);
+    ASSERT_EQ(mshm::shmem_seal(handle).error_code, mshm::SHMEM_OK);
+
+    int sockets[2];
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, sockets), 0);
+    ASSERT_EQ(mshm::shmem_send_fd(handle, sockets[0]).error_code, mshm::SHMEM_OK);
+    ASSERT_EQ(mshm::shmem_receive_fd(received, sockets[1]).error_code, mshm::SHMEM_OK);
+
+    // both the sealing handle and the received one map the header read-only
+    for (mshm::mshm_handle h : { handle, received })
+    {
+        uint32_t last_seen = 0;
+        EXPECT_EQ(mshm::shmem_wait_changed(h, last_seen, 10).error_code, mshm::SHMEM_OK);
+        EXPECT_EQ(last_seen, 1u);
+
+        auto begin = std::chrono::steady_clock::now();
+        EXPECT_EQ(mshm::shmem_wait_changed(h, last_seen, -1, 100).error_code, mshm::SHMEM_ERR_TIMEOUT);
+        EXPECT_LT(std::chrono::steady_clock::now() - begin, std::chrono::seconds(1));
+    }
+
+    close(sockets[0]);
+    close(sockets[1]);
+    mshm::shmem_close(received);
+    mshm::shmem_close(handle);
+}
+
+TEST(ShmAnonymous, SealWaitsForWritableMappingsToGo)
+{
+    mshm::mshm_handle handle = nullptr, received = nullptr;
+    ASSERT_EQ(mshm::shmem_create_anonymous(handle, 4096).error_code, mshm::SHMEM_OK);
+
+    int sockets[2];
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, sockets), 0);
+    ASSERT_EQ(mshm::shmem_send_fd(handle, sockets[0]).error_code, mshm::SHMEM_OK);
+    ASSERT_EQ(mshm::shmem_receive_fd(received, sockets[1]).error_code, mshm::SHMEM_OK);
+
+    // the receiver still maps it writable: refused, and the handle keeps working
+    EXPECT_EQ(mshm::shmem_seal(handle).error_code, mshm::SHMEM_ERR_MMAP);
+
+    uint64_t value = 3;
+    EXPECT_EQ(mshm::shmem_write(handle, &value, sizeof(value)).error_code, mshm::SHMEM_OK);
+
+    mshm::shmem_close(received);
+    EXPECT_EQ(mshm::shmem_seal(handle).error_code, mshm::SHMEM_OK);
+    EXPECT_EQ(mshm::shmem_write(handle, &value, sizeof(value)).error_code, mshm::SHMEM_ERR_NOT_SUPPORTED);
+
+    // named segments can not be sealed
+    mshm::mshm_handle named = nullptr;
+    ASSERT_EQ(mshm::shmem_open(named, "mshm_test_seal_named", 64).error_code, mshm::SHMEM_OK);
+    EXPECT_EQ(mshm::shmem_seal(named).error_code, mshm::SHMEM_ERR_NOT_SUPPORTED);
+
+    close(sockets[0]);
+    close(sockets[1]);
+    mshm::shmem_close(named);
+    mshm::shmem_delete("mshm_test_seal_named");
+    mshm::shmem_close(handle);
+}
+#endif
+
+// ============================================================
+// File-backed persistent segments
+// ============================================================
+
+#ifndef _WIN32
+class ShmPersist : public ::testing::Test
+{
+protected:
+    void SetUp() override
+    {
+        char pattern[] = "/tmp/mshm_persist_XXXXXX";
+        ASSERT_NE(mkdtemp(pattern), nullptr);
+        dir = pattern;
+        options.persist_dir = dir.c_str();
+    }
+
+    void TearDown() override
+    {
+        unlink((dir + "/segment").c_str());
+        rmdir(dir.c_str());
+    }
+
+    std::string dir;
+    mshm::OpenOptions options;
+};
+
+TEST_F(ShmPersist, LastCloseLeavesAnImageToRestore)
+{
+    mshm::mshm_handle handle = nullptr, other = nullptr;
+    ASSERT_EQ(mshm::shmem_open(handle, "segment", 4096, options).error_code, mshm::SHMEM_OK);
+    EXPECT_FALSE(mshm::shmem_restored(handle));
+
+    uint64_t value = 314;
+    ASSERT_EQ(mshm::shmem_write(handle, &value, sizeof(value), 128).error_code, mshm::SHMEM_OK);
+
+    // attaching to a live segment is a plain attach
+    ASSERT_EQ(mshm::shmem_open(other, "segment", 4096, options).error_code, mshm::SHMEM_OK);
+    EXPECT_FALSE(mshm::shmem_restored(other));
+
+    EXPECT_EQ(mshm::shmem_flush(other, 128, sizeof(value), true).error_code, mshm::SHMEM_OK);
+    EXPECT_EQ(mshm::shmem_flush(other, 4000, 200).error_code, mshm::SHMEM_ERR_PARAM);
+
+    mshm::shmem_close(other);
+    mshm::shmem_close(handle);
+
+    ASSERT_EQ(mshm::shmem_open(handle, "segment", 4096, options).error_code, mshm::SHMEM_OK);
+    EXPECT_TRUE(mshm::shmem_restored(handle));
+
+    uint64_t read = 0;
+    ASSERT_EQ(mshm::shmem_read(handle, &read, sizeof(read), 128).error_code, mshm::SHMEM_OK);
+    EXPECT_EQ(read, 314u);
+
+    mshm::shmem_close(handle);
+}
+
+TEST_F(ShmPersist, CrashKeepsOnlyTheFlushedImage)
+{
+    options.lock_timeout_ms = 1000;
+
+    // flushed, then killed while holding the lock
+    pid_t child = fork();
+
+    if (child == 0)
+    {
+        mshm::mshm_handle handle = nullptr;
+        if (mshm::shmem_open(handle, "segment", 4096, options).error_code != mshm::SHMEM_OK) _exit(1);
+
+        uint64_t value = 2718;
+        if (mshm::shmem_write_ec(handle, &value, sizeof(value)) != mshm::SHMEM_OK) _exit(2);
+        if (mshm::shmem_flush(handle).error_code != mshm::SHMEM_OK) _exit(3);
+
+        mshm::View view;
+        if (mshm::shmem_acquire_view_ec(handle, view, mshm::SHMEM_VIEW_WRITE, sizeof(value)) != mshm::SHMEM_OK) _exit(4);
+        _exit(0);
+    }
+
+    int status = 0;
+    waitpid(child, &status, 0);
+    ASSERT_TRUE(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+    // the image comes back with working locks
+    mshm::mshm_handle handle = nullptr;
+    ASSERT_EQ(mshm::shmem_open(handle, "segment", 4096, options).error_code, mshm::SHMEM_OK);
+    EXPECT_TRUE(mshm::shmem_restored(handle));
+
+    uint64_t read = 0;
+    ASSERT_EQ(mshm::shmem_read(handle, &read, sizeof(read)).error_code, mshm::SHMEM_OK);
+    EXPECT_EQ(read, 2718u);
+    mshm::shmem_close(handle);
+
+    // written after the flush, then killed: the file no longer matches any image
+    child = fork();
+
+    if (child == 0)
+    {
+        mshm::mshm_handle handle = nullptr;
+        if (mshm::shmem_open(handle, "segment", 4096, options).error_code != mshm::SHMEM_OK) _exit(1);
+
+        uint64_t value = 1;
+        if (mshm::shmem_write_ec(handle, &value, sizeof(value), 64) != mshm::SHMEM_OK) _exit(2);
+        _exit(0);
+    }
+
+    waitpid(child, &status, 0);
+    ASSERT_TRUE(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+    ASSERT_EQ(mshm::shmem_open(handle, "segment", 4096, options).error_code, mshm::SHMEM_OK);
+    EXPECT_FALSE(mshm::shmem_restored(handle));
+
+    ASSERT_EQ(mshm::shmem_read(handle, &read, sizeof(read)).error_code, mshm::SHMEM_OK);
+    EXPECT_EQ(read, 0u);
+    mshm::shmem_close(handle);
+}
+
+TEST_F(ShmPersist, ConcurrentClosersKeepTheImage)
+{
+    for (uint64_t round = 1; round <= 50; ++round)
+    {
+        mshm::mshm_handle first = nullptr, second = nullptr;
+        ASSERT_EQ(mshm::shmem_open(first, "segment", 4096, options).error_code, mshm::SHMEM_OK);
+        ASSERT_EQ(mshm::shmem_open(second, "segment", 4096, options).error_code, mshm::SHMEM_OK);
+        ASSERT_EQ(mshm::shmem_write(first, &round, sizeof(round), 256).error_code, mshm::SHMEM_OK);
+
+        // both still count as users when the other one closes: one of them must flush
+        std::atomic<int> ready{0};
+        auto closer = [&](mshm::mshm_handle handle) {
+            ready.fetch_add(1);
+            while (ready.load() < 2) {}
+            mshm::shmem_close(handle);
+        };
+
+        std::thread a(closer, first), b(closer, second);
+        a.join();
+        b.join();
+
+        mshm::mshm_handle handle = nullptr;
+        ASSERT_EQ(mshm::shmem_open(handle, "segment", 4096, options).error_code, mshm::SHMEM_OK);
+        EXPECT_TRUE(mshm::shmem_restored(handle));
+
+        uint64_t read = 0;
+        ASSERT_EQ(mshm::shmem_read(handle, &read, sizeof(read), 256).error_code, mshm::SHMEM_OK);
+        EXPECT_EQ(read, round);
+        mshm::shmem_close(handle);
+    }
+}
+
+TEST_F(ShmPersist, FlushExcludesReadersInRwlockMode)
+{
+    options.sync_mode = mshm::SHMEM_SYNC_RWLOCK;
+    options.lock_timeout_ms = 50;
+
+    mshm::mshm_handle handle = nullptr;
+    ASSERT_EQ(mshm::shmem_open(handle, "segment", 4096, options).error_code, mshm::SHMEM_OK);
+
+    // a reader holds the shared lock: the image write needs the exclusive one
+    std::atomic<bool> held{false}, release{false};
+    std::thread reader([&]() {
+        mshm::View view;
+        ASSERT_EQ(mshm::shmem_acquire_view_ec(handle, view, mshm::SHMEM_VIEW_READ, 64), mshm::SHMEM_OK);
+        held.store(true);
+        while (!release.load()) std::this_thread::yield();
+        mshm::shmem_release_view_ec(view);
+    });
+
+    while (!held.load()) std::this_thread::yield();
+    EXPECT_EQ(mshm::shmem_flush(handle).error_code, mshm::SHMEM_ERR_TIMEOUT);
+
+    release.store(true);
+    reader.join();
+    EXPECT_EQ(mshm::shmem_flush(handle).error_code, mshm::SHMEM_OK);
+
+    mshm::shmem_close(handle);
+}
+
+TEST_F(ShmPersist, RangedAndAsyncFlushesRecordTheImage)
+{
+    for (bool async : { false, true })
+    {
+        // flushed just the field it wrote, then killed without closing
+        pid_t child = fork();
+
+        if (child == 0)
+        {
+            mshm::mshm_handle handle = nullptr;
+            if (mshm::shmem_open(handle, "segment", 4096, options).error_code != mshm::SHMEM_OK) _exit(1);
+
+            uint64_t value = async ? 42 : 41;
+            if (mshm::shmem_write_ec(handle, &value, sizeof(value), 512) != mshm::SHMEM_OK) _exit(2);
+            if (mshm::shmem_flush(handle, 512, sizeof(value), async).error_code != mshm::SHMEM_OK) _exit(3);
+            _exit(0);
+        }
+
+        int status = 0;
+        waitpid(child, &status, 0);
+        ASSERT_TRUE(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+        mshm::mshm_handle handle = nullptr;
+        ASSERT_EQ(mshm::shmem_open(handle, "segment", 4096, options).error_code, mshm::SHMEM_OK);
+        EXPECT_TRUE(mshm::shmem_restored(handle));
+
+        uint64_t read = 0;
+        ASSERT_EQ(mshm::shmem_read(handle, &read, sizeof(read), 512).error_code, mshm::SHMEM_OK);
+        EXPECT_EQ(read, async ? 42u : 41u);
+
+        // leaves an image behind for the next round
+        mshm::shmem_close(handle);
+    }
+}
+
+TEST_F(ShmPersist, RestoreKeepsTheImageOnOptionMismatch)
+{
+    options.sync_mode = mshm::SHMEM_SYNC_SEQLOCK;
+    options.dirty_block_size = 64;
+
+    mshm::mshm_handle handle = nullptr;
+    ASSERT_EQ(mshm::shmem_open(handle, "segment", 1024, options).error_code, mshm::SHMEM_OK);
+
+    uint64_t value = 55;
+    ASSERT_EQ(mshm::shmem_write(handle, &value, sizeof(value), 512).error_code, mshm::SHMEM_OK);
+    mshm::shmem_close(handle);
+
+    mshm::OpenOptions other;
+    other.persist_dir = dir.c_str();
+    EXPECT_EQ(mshm::shmem_open(handle, "segment", 1024, other).error_code, mshm::SHMEM_ERR_PARAM);
+
+    ASSERT_EQ(mshm::shmem_open(handle, "segment", 1024, options).error_code, mshm::SHMEM_OK);
+    EXPECT_TRUE(mshm::shmem_restored(handle));
+
+    // block versions come back too
+    std::vector<unsigned char> copy(1024, 0);
+    uint64_t version = 0;
+    ASSERT_EQ(mshm::shmem_read_changed(handle, copy.data(), version).error_code, mshm::SHMEM_OK);
+    EXPECT_EQ(*(const uint64_t*)&copy[512], 55u);
+    EXPECT_EQ(version, 1u);
+
+    mshm::shmem_close(handle);
+
+    options.page_size = mshm::SHMEM_PAGE_HUGE_2M;
+    EXPECT_EQ(mshm::shmem_open(handle, "segment", 1024, options).error_code, mshm::SHMEM_ERR_PARAM);
+}
+#endif